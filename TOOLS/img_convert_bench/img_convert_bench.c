@@ -0,0 +1,209 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures the throughput of the subtitle bitmap conversions in
+// sub/img_convert.c in megapixels per second, for the C code and every SIMD
+// version the CPU supports. It also checks that all versions of a conversion
+// produce the same output as the C code.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "sub/img_convert.c"
+
+// Minimum run time of each measurement, in seconds.
+#define MIN_TIME 0.5
+
+struct bench {
+    int w, h;
+    uint32_t *colors;       // random RGBA pixels
+    uint8_t *glyphs;        // glyph-like coverage bitmap, or palette indexes
+    uint32_t palette[256];
+    uint32_t *out;
+};
+
+static double get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t rnd(void)
+{
+    static uint32_t state = 1;
+    state = state * 1664525 + 1013904223;
+    return state >> 8;
+}
+
+static void setup_premultiply(struct bench *b)
+{
+    memcpy(b->out, b->colors, b->w * b->h * sizeof(b->out[0]));
+}
+
+// Premultiplying again does the same amount of work, so the timed runs don't
+// need to restore the input.
+static void premultiply_c(struct bench *b)
+{
+    rgba_to_premultiplied_rgba_c(b->out, b->w * b->h);
+}
+
+static void setup_palette(struct bench *b)
+{
+}
+
+static void palette_c(struct bench *b)
+{
+    for (int y = 0; y < b->h; y++) {
+        expand_palette_c(b->out + y * b->w, b->glyphs + y * b->w, b->w,
+                         b->palette);
+    }
+}
+
+static void setup_ass(struct bench *b)
+{
+    memset(b->out, 0, b->w * b->h * sizeof(b->out[0]));
+}
+
+#define ASS_COLOR 0xFFD08020
+
+static void ass_c(struct bench *b)
+{
+    draw_ass_rgba_c(b->glyphs, b->w, b->h, b->w, (uint8_t *)b->out, b->w * 4,
+                    ASS_COLOR);
+}
+
+#if HAVE_X86_INTRINSICS
+static void premultiply_sse2(struct bench *b)
+{
+    rgba_to_premultiplied_rgba_sse2(b->out, b->w * b->h);
+}
+
+static void palette_avx2(struct bench *b)
+{
+    for (int y = 0; y < b->h; y++) {
+        expand_palette_avx2(b->out + y * b->w, b->glyphs + y * b->w, b->w,
+                            b->palette);
+    }
+}
+
+static void ass_sse2(struct bench *b)
+{
+    draw_ass_rgba_sse2(b->glyphs, b->w, b->h, b->w, (uint8_t *)b->out,
+                       b->w * 4, ASS_COLOR);
+}
+#endif
+
+struct test {
+    const char *name;
+    const char *impl;
+    bool *cpu_flag;         // NULL for the C code, which is the reference
+    void (*setup)(struct bench *b);
+    void (*run)(struct bench *b);
+};
+
+// The C code must come first for each conversion.
+static const struct test tests[] = {
+    {"premultiply", "C", NULL, setup_premultiply, premultiply_c},
+#if HAVE_X86_INTRINSICS
+    {"premultiply", "SSE2", &gCpuCaps.hasSSE2, setup_premultiply,
+     premultiply_sse2},
+#endif
+    {"palette", "C", NULL, setup_palette, palette_c},
+#if HAVE_X86_INTRINSICS
+    {"palette", "AVX2", &gCpuCaps.hasAVX2, setup_palette, palette_avx2},
+#endif
+    {"ass-to-rgba", "C", NULL, setup_ass, ass_c},
+#if HAVE_X86_INTRINSICS
+    {"ass-to-rgba", "SSE2", &gCpuCaps.hasSSE2, setup_ass, ass_sse2},
+#endif
+};
+
+int main(int argc, char **argv)
+{
+    struct bench b = {1920, 1080};
+    if (argc == 3) {
+        b.w = atoi(argv[1]);
+        b.h = atoi(argv[2]);
+    }
+    if (b.w < 1 || b.h < 1 || argc == 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s [width height]\n", argv[0]);
+        return 2;
+    }
+
+    GetCpuCaps(&gCpuCaps);
+
+    size_t num_pixels = b.w * (size_t)b.h;
+    b.colors = talloc_array(NULL, uint32_t, num_pixels);
+    b.glyphs = talloc_array(NULL, uint8_t, num_pixels);
+    b.out = talloc_array(NULL, uint32_t, num_pixels);
+    uint32_t *ref = talloc_array(NULL, uint32_t, num_pixels);
+
+    for (size_t n = 0; n < num_pixels; n++)
+        b.colors[n] = rnd() ^ (rnd() << 16);
+    for (int n = 0; n < 256; n++)
+        b.palette[n] = rnd() ^ (rnd() << 16);
+    // Runs of fully transparent and of covered pixels, like in glyph bitmaps.
+    bool ink = false;
+    for (size_t n = 0; n < num_pixels; n++) {
+        if (rnd() % 16 == 0)
+            ink = !ink;
+        b.glyphs[n] = ink ? (rnd() % 4 ? 255 : rnd() % 256) : 0;
+    }
+
+    printf("%dx%d pixels\n", b.w, b.h);
+
+    int ret = 0;
+    for (int n = 0; n < MP_ARRAY_SIZE(tests); n++) {
+        const struct test *t = &tests[n];
+        if (t->cpu_flag && !*t->cpu_flag) {
+            printf("%-12s %-5s not supported by the CPU\n", t->name, t->impl);
+            continue;
+        }
+
+        t->setup(&b);
+        t->run(&b);
+        bool mismatch = false;
+        if (t->cpu_flag) {
+            mismatch = memcmp(b.out, ref, num_pixels * sizeof(ref[0])) != 0;
+        } else {
+            memcpy(ref, b.out, num_pixels * sizeof(ref[0]));
+        }
+
+        t->setup(&b);
+        long long runs = 0;
+        double start = get_time(), elapsed;
+        do {
+            t->run(&b);
+            runs++;
+            elapsed = get_time() - start;
+        } while (elapsed < MIN_TIME);
+
+        printf("%-12s %-5s %10.1f Mpixel/s%s\n", t->name, t->impl,
+               runs * num_pixels / elapsed / 1e6,
+               mismatch ? "  OUTPUT DIFFERS FROM C" : "");
+        if (mismatch)
+            ret = 1;
+    }
+
+    talloc_free(b.colors);
+    talloc_free(b.glyphs);
+    talloc_free(b.out);
+    talloc_free(ref);
+    return ret;
+}
@@ -145,8 +145,45 @@ static void mp_msg_av_log_callback(void *ptr, int level, const char *fmt,
     pthread_mutex_unlock(&log_lock);
 }
 
+// libavcodec requires a lock manager for opening and closing codecs from
+// several threads, as done by the image writer threads and the decoders.
+static int lockmgr_cb(void **mutex, enum AVLockOp op)
+{
+    switch (op) {
+    case AV_LOCK_CREATE: {
+        pthread_mutex_t *m = malloc(sizeof(*m));
+        if (!m || pthread_mutex_init(m, NULL)) {
+            free(m);
+            return 1;
+        }
+        *mutex = m;
+        return 0;
+    }
+    case AV_LOCK_OBTAIN:
+        return !!pthread_mutex_lock(*mutex);
+    case AV_LOCK_RELEASE:
+        return !!pthread_mutex_unlock(*mutex);
+    case AV_LOCK_DESTROY:
+        pthread_mutex_destroy(*mutex);
+        free(*mutex);
+        *mutex = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+// Registering again would replace the mutexes while they might be in use.
+static pthread_once_t lockmgr_once = PTHREAD_ONCE_INIT;
+
+static void register_lockmgr(void)
+{
+    av_lockmgr_register(lockmgr_cb);
+}
+
 void init_libav(struct mpv_global *global)
 {
+    pthread_once(&lockmgr_once, register_lockmgr);
+
     pthread_mutex_lock(&log_lock);
     if (!log_mpv_instance) {
         log_mpv_instance = global;
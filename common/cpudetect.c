@@ -39,5 +39,7 @@ void GetCpuCaps(CpuCaps *c)
     c->hasSSE2 = (flags & AV_CPU_FLAG_SSE2) && !(flags & AV_CPU_FLAG_SSE2SLOW);
     c->hasSSE3 = (flags & AV_CPU_FLAG_SSE3) && !(flags & AV_CPU_FLAG_SSE3SLOW);
     c->hasSSSE3 = flags & AV_CPU_FLAG_SSSE3;
+    c->hasAVX = flags & AV_CPU_FLAG_AVX;
+    c->hasAVX2 = flags & AV_CPU_FLAG_AVX2;
 #endif
 }
@@ -31,6 +31,8 @@ typedef struct cpucaps_s {
     bool hasSSE2;
     bool hasSSE3;
     bool hasSSSE3;
+    bool hasAVX;
+    bool hasAVX2;
 } CpuCaps;
 
 extern CpuCaps gCpuCaps;
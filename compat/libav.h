@@ -28,6 +28,11 @@
 #define AV_CPU_FLAG_MMX2 AV_CPU_FLAG_MMXEXT
 #endif
 
+// Older libavutil versions can't detect AVX2; never report it there.
+#ifndef AV_CPU_FLAG_AVX2
+#define AV_CPU_FLAG_AVX2 0
+#endif
+
 // At least Libav 9 doesn't define the new symbols
 #ifndef AV_PIX_FMT_FLAG_BE
 #define AV_PIX_FMT_FLAG_BE         PIX_FMT_BE
@@ -362,6 +362,7 @@ const m_option_t mp_opts[] = {
     OPT_SETTINGSLIST("af-defaults", af_defs, 0, &af_obj_list),
     OPT_SETTINGSLIST("af*", af_settings, 0, &af_obj_list),
     OPT_SETTINGSLIST("vf-defaults", vf_defs, 0, &vf_obj_list),
+    OPT_FLAG("vf-pipeline", vf_pipeline, 0),
     OPT_SETTINGSLIST("vf*", vf_settings, 0, &vf_obj_list),
 
     OPT_CHOICE("deinterlace", deinterlace, M_OPT_OPTIONAL_PARAM,
@@ -440,6 +441,7 @@ const m_option_t mp_opts[] = {
                ({"simple", 0}, {"complex", 1})),
     OPT_CHOICE("ass-style-override", ass_style_override, 0,
                ({"no", 0}, {"yes", 1})),
+    OPT_INTRANGE("ass-render-ahead", ass_render_ahead, 0, 0, 16),
     OPT_FLAG("osd-bar", osd_bar_visible, 0),
     OPT_FLOATRANGE("osd-bar-align-x", osd_bar_align_x, 0, -1.0, +1.0),
     OPT_FLOATRANGE("osd-bar-align-y", osd_bar_align_y, 0, -1.0, +1.0),
@@ -455,6 +457,7 @@ const m_option_t mp_opts[] = {
     OPT_SETTINGSLIST("ao-defaults", ao_defs, 0, &ao_obj_list),
     OPT_FLAG("fixed-vo", fixed_vo, CONF_GLOBAL),
     OPT_FLAG("force-window", force_vo, CONF_GLOBAL),
+    OPT_FLAG("vo-thread", vo.threaded, 0),
     OPT_FLAG("ontop", vo.ontop, 0),
     OPT_FLAG("border", vo.border, 0),
 
@@ -672,6 +675,9 @@ const struct MPOpts mp_default_opts = {
         .keepaspect = 1,
         .border = 1,
         .WinID = -1,
+#if !HAVE_COCOA
+        .threaded = 1,
+#endif
     },
     .wintitle = "mpv - ${media-title}",
     .heartbeat_interval = 30.0,
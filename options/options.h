@@ -41,6 +41,8 @@ typedef struct mp_vo_opts {
     int force_window_position;
 
     int native_fs;
+
+    int threaded;
 } mp_vo_opts;
 
 typedef struct MPOpts {
@@ -182,6 +184,7 @@ typedef struct MPOpts {
     int dtshd;
     double playback_speed;
     struct m_obj_settings *vf_settings, *vf_defs;
+    int vf_pipeline;
     struct m_obj_settings *af_settings, *af_defs;
     int deinterlace;
     float movie_aspect;
@@ -214,6 +217,7 @@ typedef struct MPOpts {
     int ass_style_override;
     int ass_hinting;
     int ass_shaper;
+    int ass_render_ahead;
 
     int hwdec_api;
     char *hwdec_codecs;
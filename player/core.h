@@ -445,6 +445,7 @@ void uninit_subs(struct demuxer *demuxer);
 void reinit_subs(struct MPContext *mpctx, int order);
 void update_osd_msg(struct MPContext *mpctx);
 void update_subtitles(struct MPContext *mpctx);
+void prefetch_subtitles(struct MPContext *mpctx, double video_pts);
 
 // timeline/tl_matroska.c
 void build_ordered_chapter_timeline(struct MPContext *mpctx);
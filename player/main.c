@@ -129,6 +129,8 @@ static MP_NORETURN void exit_player(struct MPContext *mpctx,
     cocoa_set_input_context(NULL);
 #endif
 
+    screenshot_uninit(mpctx);
+
     command_uninit(mpctx);
 
     mp_input_uninit(mpctx->input);
@@ -43,6 +43,9 @@
 #define MODE_FULL_WINDOW 1
 #define MODE_SUBTITLES 2
 
+// Screenshots taken, but not written yet. Taking more screenshots blocks.
+#define MAX_PENDING_SCREENSHOTS 16
+
 typedef struct screenshot_ctx {
     struct MPContext *mpctx;
 
@@ -51,6 +54,9 @@ typedef struct screenshot_ctx {
     bool osd;
 
     int frameno;
+
+    // Created on first use.
+    struct image_writer_queue *queue;
 } screenshot_ctx;
 
 void screenshot_init(struct MPContext *mpctx)
@@ -62,6 +68,15 @@ void screenshot_init(struct MPContext *mpctx)
     };
 }
 
+void screenshot_uninit(struct MPContext *mpctx)
+{
+    screenshot_ctx *ctx = mpctx->screenshot_ctx;
+
+    // Waits until all pending screenshots are written.
+    talloc_free(ctx->queue);
+    ctx->queue = NULL;
+}
+
 #define SMSG_OK 0
 #define SMSG_ERR 1
 
@@ -261,7 +276,8 @@ static char *gen_fname(screenshot_ctx *ctx, const char *file_ext)
             return NULL;
         }
 
-        if (!mp_path_exists(fname))
+        if (!mp_path_exists(fname) &&
+            !(ctx->queue && image_writer_queue_has_file(ctx->queue, fname)))
             return fname;
 
         if (sequence == prev_sequence) {
@@ -292,6 +308,8 @@ static void add_subs(struct MPContext *mpctx, struct mp_image *image)
                       OSD_DRAW_SUB_ONLY, image);
 }
 
+// Takes ownership of the image. It's encoded and written on a worker thread,
+// so errors are only logged.
 static void screenshot_save(struct MPContext *mpctx, struct mp_image *image)
 {
     screenshot_ctx *ctx = mpctx->screenshot_ctx;
@@ -300,10 +318,15 @@ static void screenshot_save(struct MPContext *mpctx, struct mp_image *image)
 
     char *filename = gen_fname(ctx, image_writer_file_ext(opts));
     if (filename) {
+        if (!ctx->queue) {
+            ctx->queue = image_writer_queue_create(ctx, mpctx->log, 0,
+                                                   MAX_PENDING_SCREENSHOTS);
+        }
         screenshot_msg(ctx, SMSG_OK, "Screenshot: '%s'", filename);
-        if (!write_image(image, opts, filename, mpctx->log))
-            screenshot_msg(ctx, SMSG_ERR, "Error writing screenshot!");
+        image_writer_queue_add(ctx->queue, image, opts, filename);
         talloc_free(filename);
+    } else {
+        talloc_free(image);
     }
 }
 
@@ -388,8 +411,6 @@ void screenshot_request(struct MPContext *mpctx, int mode, bool each_frame,
     } else {
         screenshot_msg(ctx, SMSG_ERR, "Taking screenshot failed.");
     }
-
-    talloc_free(image);
 }
 
 void screenshot_flip(struct MPContext *mpctx)
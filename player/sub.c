@@ -149,6 +149,31 @@ void update_subtitles(struct MPContext *mpctx)
     update_subtitle(mpctx, 1);
 }
 
+// Tell the subtitle renderers which video frame is going to be displayed
+// next, so that they can prepare the bitmaps for it in advance.
+void prefetch_subtitles(struct MPContext *mpctx, double video_pts)
+{
+    struct MPOpts *opts = mpctx->opts;
+    if (video_pts == MP_NOPTS_VALUE || !mpctx->d_video)
+        return;
+
+    double fps = mpctx->d_video->fps;
+    for (int order = 0; order < 2; order++) {
+        int init_flag = order ? INITIALIZED_SUB2 : INITIALIZED_SUB;
+        if (!(mpctx->initialized_flags & init_flag))
+            continue;
+        struct track *track = mpctx->current_track[order][STREAM_SUB];
+        struct osd_object *osd_obj
+            = mpctx->osd->objs[order ? OSDTYPE_SUB2 : OSDTYPE_SUB];
+        if (!track || !osd_obj->render_bitmap_subs)
+            continue;
+        double video_offset = track->under_timeline ? mpctx->video_offset : 0;
+        double a[2] = {video_pts - video_offset + opts->sub_delay,
+                       fps > 0 ? 1.0 / fps : 0};
+        sub_control(mpctx->d_sub[order], SD_CTRL_RENDER_AHEAD, a);
+    }
+}
+
 static void set_dvdsub_fake_extradata(struct dec_sub *dec_sub, struct stream *st,
                                       int width, int height)
 {
@@ -57,7 +57,7 @@ static void set_allowed_vo_formats(struct vf_chain *c, struct vo *vo)
 {
     for (int fmt = IMGFMT_START; fmt < IMGFMT_END; fmt++) {
         c->allowed_output_formats[fmt - IMGFMT_START] =
-            vo->driver->query_format(vo, fmt);
+            vo_query_format(vo, fmt);
     }
 }
 
@@ -265,6 +265,8 @@ static bool load_next_vo_frame(struct MPContext *mpctx, bool eof)
 {
     if (vo_get_buffered_frame(mpctx->video_out, eof) >= 0)
         return true;
+    if (eof)
+        vf_wait_queued_frame(mpctx->d_video->vfilter);
     if (filter_output_queued_frame(mpctx))
         return true;
     return false;
@@ -434,6 +436,7 @@ double update_video(struct MPContext *mpctx, double endpts)
         frame_time = 0;
     }
     mpctx->video_next_pts = pts;
+    prefetch_subtitles(mpctx, pts);
     if (mpctx->d_audio)
         mpctx->delay -= frame_time;
     return frame_time;
@@ -78,6 +78,7 @@ struct dec_sub *sub_create(struct mpv_global *global)
     struct dec_sub *sub = talloc_zero(NULL, struct dec_sub);
     sub->log = mp_log_new(sub, global->log, "sub");
     sub->opts = global->opts;
+    sub->init_sd.global = global;
     return sub;
 }
 
@@ -192,6 +193,7 @@ void sub_init_from_sh(struct dec_sub *sub, struct sh_stream *sh)
             return;
         }
         init_sd = (struct sd) {
+            .global = sub->init_sd.global,
             .codec = sd->output_codec,
             .converted_from = sd->codec,
             .extradata = sd->output_extradata,
@@ -20,6 +20,7 @@ enum sd_ctrl {
     SD_CTRL_SUB_STEP,
     SD_CTRL_SET_VIDEO_PARAMS,
     SD_CTRL_GET_RESOLUTION,
+    SD_CTRL_RENDER_AHEAD,       // double[2]: next pts, frame duration (or 0)
 };
 
 struct dec_sub *sub_create(struct mpv_global *global);
@@ -25,7 +25,9 @@
 #include <libswscale/swscale.h>
 #include <libavutil/common.h>
 
+#include "config.h"
 #include "common/common.h"
+#include "common/cpudetect.h"
 #include "draw_bmp.h"
 #include "img_convert.h"
 #include "video/mp_image.h"
@@ -39,14 +41,19 @@ const bool mp_draw_sub_formats[SUBBITMAP_COUNT] = {
 };
 
 struct sub_cache {
+    // SUBBITMAP_RGBA only: scaled to (dw, dh), converted to part->imgfmt
     struct mp_image *i, *a;
+    // draw_direct() only: depends on the sub-bitmap position
+    struct blend_plan *plan;
 };
 
 struct part {
-    int bitmap_pos_id;
+    int bitmap_id, bitmap_pos_id;
     int imgfmt;
     enum mp_csp colorspace;
     enum mp_csp_levels levels;
+    // target image the plans were made for
+    int plan_imgfmt, plan_w, plan_h;
     int num_imgs;
     struct sub_cache *imgs;
 };
@@ -115,6 +122,77 @@ static void blend_const8_alpha(void *dst, int dst_stride, uint16_t srcp,
     }
 }
 
+#if HAVE_X86_INTRINSICS
+#include <immintrin.h>
+
+// (srcp * a + d * (65025 - a) + 32512) / 65025 for 4 lanes. All intermediate
+// values are integers below 2^24, so they are exact in single precision; the
+// quotient from the reciprocal multiplication is off by at most 1 and is fixed
+// up with the remainder.
+__attribute__((target("sse2")))
+static inline __m128i blend4_const_sse2(__m128 srcp, __m128i a, __m128i d)
+{
+    const __m128 max = _mm_set1_ps(65025.0f);
+    __m128 fa = _mm_cvtepi32_ps(a);
+    __m128 fd = _mm_cvtepi32_ps(d);
+    __m128 n = _mm_add_ps(_mm_add_ps(_mm_mul_ps(srcp, fa),
+                                     _mm_mul_ps(fd, _mm_sub_ps(max, fa))),
+                          _mm_set1_ps(32512.0f));
+    __m128i q = _mm_cvttps_epi32(_mm_mul_ps(n, _mm_set1_ps(1.0f / 65025.0f)));
+    __m128 r = _mm_sub_ps(n, _mm_mul_ps(_mm_cvtepi32_ps(q), max));
+    // masks are -1 where true
+    q = _mm_add_epi32(q, _mm_castps_si128(_mm_cmplt_ps(r, _mm_setzero_ps())));
+    q = _mm_sub_epi32(q, _mm_castps_si128(_mm_cmpge_ps(r, max)));
+    return q;
+}
+
+// Same results as blend_const8_alpha() with ACCURATE and CONDITIONAL.
+__attribute__((target("sse2")))
+static void blend_const8_alpha_sse2(void *dst, int dst_stride, uint16_t srcp,
+                                    uint8_t *srca, int srca_stride,
+                                    uint8_t srcamul, int w, int h)
+{
+    if (!srcamul)
+        return;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i amul = _mm_set1_epi16(srcamul);
+    const __m128 fsrcp = _mm_set1_ps(srcp);
+    for (int y = 0; y < h; y++) {
+        uint8_t *dst_r = (uint8_t *)dst + dst_stride * y;
+        uint8_t *srca_r = srca + srca_stride * y;
+        int x = 0;
+        for (; x + 16 <= w; x += 16) {
+            __m128i a = _mm_loadu_si128((__m128i *)(srca_r + x));
+            // Most of a subtitle bitmap is usually fully transparent.
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, zero)) == 0xFFFF)
+                continue;
+            __m128i d = _mm_loadu_si128((__m128i *)(dst_r + x));
+            __m128i res[2];
+            for (int k = 0; k < 2; k++) {
+                __m128i a16 = k ? _mm_unpackhi_epi8(a, zero)
+                                : _mm_unpacklo_epi8(a, zero);
+                __m128i d16 = k ? _mm_unpackhi_epi8(d, zero)
+                                : _mm_unpacklo_epi8(d, zero);
+                a16 = _mm_mullo_epi16(a16, amul); // now 0..65025
+                __m128i lo = blend4_const_sse2(fsrcp,
+                                               _mm_unpacklo_epi16(a16, zero),
+                                               _mm_unpacklo_epi16(d16, zero));
+                __m128i hi = blend4_const_sse2(fsrcp,
+                                               _mm_unpackhi_epi16(a16, zero),
+                                               _mm_unpackhi_epi16(d16, zero));
+                res[k] = _mm_packs_epi32(lo, hi);
+            }
+            _mm_storeu_si128((__m128i *)(dst_r + x),
+                             _mm_packus_epi16(res[0], res[1]));
+        }
+        if (x < w) {
+            blend_const8_alpha(dst_r + x, dst_stride, srcp, srca_r + x,
+                               srca_stride, srcamul, w - x, 1);
+        }
+    }
+}
+#endif /* HAVE_X86_INTRINSICS */
+
 static void blend_const_alpha(void *dst, int dst_stride, int srcp,
                               uint8_t *srca, int srca_stride, uint8_t srcamul,
                               int w, int h, int bytes)
@@ -123,6 +201,13 @@ static void blend_const_alpha(void *dst, int dst_stride, int srcp,
         blend_const16_alpha(dst, dst_stride, srcp, srca, srca_stride, srcamul,
                             w, h);
     } else if (bytes == 1) {
+#if HAVE_X86_INTRINSICS
+        if (gCpuCaps.hasSSE2) {
+            blend_const8_alpha_sse2(dst, dst_stride, srcp, srca, srca_stride,
+                                    srcamul, w, h);
+            return;
+        }
+#endif
         blend_const8_alpha(dst, dst_stride, srcp, srca, srca_stride, srcamul,
                            w, h);
     }
@@ -382,39 +467,52 @@ static void get_closest_y444_format(int imgfmt, int *out_format, int *out_bits)
     *out_bits = 8;
 }
 
+// The returned part keeps all data derived from the sub-bitmaps for as long
+// as sbs->bitmap_id doesn't change. If only the positions changed, data that
+// depends on the position is dropped, and the rest is reused.
 static struct part *get_cache(struct mp_draw_sub_cache *cache,
                               struct sub_bitmaps *sbs, struct mp_image *format)
 {
-    struct part *part = NULL;
-
-    bool use_cache = sbs->format == SUBBITMAP_RGBA;
-    if (use_cache) {
-        part = cache->parts[sbs->render_index];
-        if (part) {
-            if (part->bitmap_pos_id != sbs->bitmap_pos_id
-                || part->imgfmt != format->imgfmt
-                || part->colorspace != format->colorspace
-                || part->levels != format->levels)
-            {
-                talloc_free(part);
-                part = NULL;
-            }
+    struct part *part = cache->parts[sbs->render_index];
+    if (part) {
+        if (part->bitmap_id != sbs->bitmap_id
+            || part->num_imgs != sbs->num_parts
+            || part->imgfmt != format->imgfmt
+            || part->colorspace != format->colorspace
+            || part->levels != format->levels)
+        {
+            talloc_free(part);
+            part = NULL;
         }
-        if (!part) {
-            part = talloc(cache, struct part);
-            *part = (struct part) {
-                .bitmap_pos_id = sbs->bitmap_pos_id,
-                .num_imgs = sbs->num_parts,
-                .imgfmt = format->imgfmt,
-                .levels = format->levels,
-                .colorspace = format->colorspace,
-            };
-            part->imgs = talloc_zero_array(part, struct sub_cache,
-                                           part->num_imgs);
+    }
+    if (!part) {
+        part = talloc(cache, struct part);
+        *part = (struct part) {
+            .bitmap_id = sbs->bitmap_id,
+            .bitmap_pos_id = sbs->bitmap_pos_id,
+            .num_imgs = sbs->num_parts,
+            .imgfmt = format->imgfmt,
+            .levels = format->levels,
+            .colorspace = format->colorspace,
+        };
+        part->imgs = talloc_zero_array(part, struct sub_cache,
+                                       part->num_imgs);
+    }
+    if (part->bitmap_pos_id != sbs->bitmap_pos_id) {
+        for (int n = 0; n < part->num_imgs; n++) {
+            struct sub_cache *c = &part->imgs[n];
+            struct sub_bitmap *sb = &sbs->parts[n];
+            if (c->i && (c->i->w != sb->dw || c->i->h != sb->dh)) {
+                talloc_free(c->i);
+                talloc_free(c->a);
+                c->i = c->a = NULL;
+            }
+            talloc_free(c->plan);
+            c->plan = NULL;
         }
-        assert(part->num_imgs == sbs->num_parts);
-        cache->parts[sbs->render_index] = part;
+        part->bitmap_pos_id = sbs->bitmap_pos_id;
     }
+    cache->parts[sbs->render_index] = part;
 
     return part;
 }
@@ -518,6 +616,429 @@ static void chroma_down(struct mp_image *old_src, struct mp_image *temp)
     }
 }
 
+// One component of the destination image, as seen by the direct blend path.
+struct blend_plane {
+    uint8_t *ptr;       // sample at (0, 0)
+    int stride;
+    int step;           // bytes from one sample to the next in a row
+    int xs, ys;         // subsampling (log2) relative to the luma plane
+};
+
+// Packed RGB formats the direct path can draw into. The offsets are the byte
+// positions of the components within a pixel; padding/alpha is left alone.
+static const struct {
+    int imgfmt, bytes, r, g, b;
+} packed_rgb[] = {
+    {IMGFMT_BGR24, 3, 2, 1, 0},
+    {IMGFMT_RGB24, 3, 0, 1, 2},
+    {IMGFMT_BGRA,  4, 2, 1, 0},
+    {IMGFMT_BGR0,  4, 2, 1, 0},
+    {IMGFMT_RGBA,  4, 0, 1, 2},
+    {IMGFMT_RGB0,  4, 0, 1, 2},
+    {IMGFMT_ARGB,  4, 1, 2, 3},
+    {IMGFMT_0RGB,  4, 1, 2, 3},
+    {IMGFMT_ABGR,  4, 3, 2, 1},
+    {IMGFMT_0BGR,  4, 3, 2, 1},
+};
+
+// Setup the components of dst in the same order as the planes of the 444
+// format get_closest_y444_format() returns (Y/U/V, or G/B/R). Returns the
+// number of components, or 0 if dst can't be drawn into directly.
+static int get_blend_planes(struct mp_image *dst, int bits,
+                            struct blend_plane planes[3])
+{
+    struct mp_imgfmt_desc desc = dst->fmt;
+    if ((desc.flags & MP_IMGFLAG_YUV_P) && (desc.flags & MP_IMGFLAG_NE) &&
+        desc.plane_bits == bits && bits >= 8 && bits <= 16 &&
+        desc.num_planes != 2)
+    {
+        int num = desc.num_planes > 2 ? 3 : 1;
+        for (int p = 0; p < num; p++) {
+            planes[p] = (struct blend_plane) {
+                .ptr = dst->planes[p],
+                .stride = dst->stride[p],
+                .step = desc.bytes[p],
+                .xs = desc.xs[p],
+                .ys = desc.ys[p],
+            };
+        }
+        return num;
+    }
+    for (int n = 0; n < MP_ARRAY_SIZE(packed_rgb); n++) {
+        if (packed_rgb[n].imgfmt == dst->imgfmt) {
+            int offsets[3] = {packed_rgb[n].g, packed_rgb[n].b, packed_rgb[n].r};
+            for (int p = 0; p < 3; p++) {
+                planes[p] = (struct blend_plane) {
+                    .ptr = dst->planes[0] + offsets[p],
+                    .stride = dst->stride[0],
+                    .step = packed_rgb[n].bytes,
+                };
+            }
+            return 3;
+        }
+    }
+    return 0;
+}
+
+static inline uint32_t load_sample(uint8_t *p, int bytes)
+{
+    return bytes == 2 ? *(uint16_t *)p : *p;
+}
+
+static inline void store_sample(uint8_t *p, int bytes, uint32_t v)
+{
+    if (bytes == 2) {
+        *(uint16_t *)p = v;
+    } else {
+        *p = v;
+    }
+}
+
+// Blend a constant color into a component that is not subsampled. (x, y) is
+// the destination position of the w*h alpha map srca.
+static void blend_const_comp(struct blend_plane *pl, int bytes, int srcp,
+                             uint8_t *srca, int srca_stride, uint8_t srcamul,
+                             int x, int y, int w, int h)
+{
+    uint8_t *dst = pl->ptr + y * pl->stride + x * pl->step;
+    if (pl->step == bytes) {
+        blend_const_alpha(dst, pl->stride, srcp, srca, srca_stride, srcamul,
+                          w, h, bytes);
+        return;
+    }
+    // packed RGB, always 8 bit
+    if (!srcamul)
+        return;
+    for (int ry = 0; ry < h; ry++) {
+        uint8_t *dst_r = dst + pl->stride * ry;
+        uint8_t *srca_r = srca + srca_stride * ry;
+        for (int rx = 0; rx < w; rx++) {
+            uint32_t srcap = srca_r[rx];
+            if (!srcap)
+                continue;
+            srcap *= srcamul; // now 0..65025
+            uint8_t *d = dst_r + rx * pl->step;
+            *d = (srcp * srcap + *d * (65025 - srcap) + 32512) / 65025;
+        }
+    }
+}
+
+// Like blend_const_comp(), but with per-pixel colors from src.
+static void blend_src_comp(struct blend_plane *pl, int bytes, uint8_t *src,
+                           int src_stride, uint8_t *srca, int srca_stride,
+                           int x, int y, int w, int h)
+{
+    uint8_t *dst = pl->ptr + y * pl->stride + x * pl->step;
+    if (pl->step == bytes) {
+        blend_src_alpha(dst, pl->stride, src, src_stride, srca, srca_stride,
+                        w, h, bytes);
+        return;
+    }
+    for (int ry = 0; ry < h; ry++) {
+        uint8_t *dst_r = dst + pl->stride * ry;
+        uint8_t *src_r = src + src_stride * ry;
+        uint8_t *srca_r = srca + srca_stride * ry;
+        for (int rx = 0; rx < w; rx++) {
+            uint32_t srcap = srca_r[rx];
+            if (!srcap)
+                continue;
+            uint8_t *d = dst_r + rx * pl->step;
+            *d = (src_r[rx] * srcap + *d * (255 - srcap) + 127) / 255;
+        }
+    }
+}
+
+// Everything about a sub-bitmap that is needed to blend it into a frame, but
+// doesn't depend on the frame contents. It's created on first use, and then
+// reused as long as the sub-bitmap doesn't change or move, so that drawing
+// the same subtitles on many frames doesn't redo this work.
+struct blend_plan {
+    // clipped destination rectangle (luma/unsubsampled coordinates)
+    struct mp_rect rc;
+    int src_x, src_y;
+    // per row of rc: range of columns with non-0 alpha (relative to rc.x0),
+    // empty rows have span[0] >= span[1]
+    uint16_t (*spans)[2];
+    // Subsampled chroma, if the target has any. Each sample uses the average
+    // alpha of the luma pixels it covers, with pixels outside of rc counting
+    // as transparent. This is what upsampling the chroma with SWS_POINT,
+    // blending, and downsampling with SWS_AREA used to compute.
+    int c_x0, c_y0, c_w, c_h;
+    // SUBBITMAP_LIBASS: average alpha * color alpha (0..65025)
+    // SUBBITMAP_RGBA: sum of the alpha values
+    uint16_t *c_a;
+    // SUBBITMAP_RGBA: sum of color * alpha, for the first and second chroma
+    // plane
+    uint32_t *c_ca[2];
+};
+
+// srca/src point to the top/left pixel of rc. src is NULL for libass bitmaps,
+// which use the constant srcamul alpha multiplier instead.
+static struct blend_plan *create_plan(void *ta_parent, struct mp_rect rc,
+                                      int src_x, int src_y,
+                                      uint8_t *srca, int srca_stride,
+                                      uint8_t srcamul, struct mp_image *src,
+                                      int bytes, struct blend_plane *chroma)
+{
+    struct blend_plan *plan = talloc_ptrtype(ta_parent, plan);
+    int w = rc.x1 - rc.x0, h = rc.y1 - rc.y0;
+    *plan = (struct blend_plan) {
+        .rc = rc,
+        .src_x = src_x,
+        .src_y = src_y,
+    };
+    plan->spans = talloc_array_ptrtype(plan, plan->spans, h);
+    for (int y = 0; y < h; y++) {
+        uint8_t *srca_r = srca + y * srca_stride;
+        int x0 = 0, x1 = w;
+        while (x0 < x1 && !srca_r[x0])
+            x0++;
+        while (x1 > x0 && !srca_r[x1 - 1])
+            x1--;
+        plan->spans[y][0] = x0;
+        plan->spans[y][1] = x1;
+    }
+
+    if (!chroma)
+        return plan;
+
+    int xs = chroma->xs, ys = chroma->ys;
+    plan->c_x0 = rc.x0 >> xs;
+    plan->c_y0 = rc.y0 >> ys;
+    plan->c_w = ((rc.x1 - 1) >> xs) - plan->c_x0 + 1;
+    plan->c_h = ((rc.y1 - 1) >> ys) - plan->c_y0 + 1;
+    int c_size = plan->c_w * plan->c_h;
+    uint32_t *sum_a = talloc_zero_array(NULL, uint32_t, c_size);
+    if (src) {
+        for (int c = 0; c < 2; c++)
+            plan->c_ca[c] = talloc_zero_array(plan, uint32_t, c_size);
+    }
+    for (int y = 0; y < h; y++) {
+        uint8_t *srca_r = srca + y * srca_stride;
+        int row = (((rc.y0 + y) >> ys) - plan->c_y0) * plan->c_w;
+        for (int x = plan->spans[y][0]; x < plan->spans[y][1]; x++) {
+            uint32_t a = srca_r[x];
+            if (!a)
+                continue;
+            int i = row + ((rc.x0 + x) >> xs) - plan->c_x0;
+            sum_a[i] += a;
+            for (int c = 0; c < 2 && src; c++) {
+                uint8_t *src_r = src->planes[1 + c]
+                                 + (src_y + y) * src->stride[1 + c];
+                plan->c_ca[c][i] += load_sample(src_r + (src_x + x) * bytes,
+                                                bytes) * a;
+            }
+        }
+    }
+    plan->c_a = talloc_array(plan, uint16_t, c_size);
+    int shift = xs + ys;
+    for (int i = 0; i < c_size; i++) {
+        plan->c_a[i] = src ? sum_a[i]
+                           : (sum_a[i] * srcamul + (1 << shift >> 1)) >> shift;
+    }
+    talloc_free(sum_a);
+
+    return plan;
+}
+
+static void blend_plan_luma_const(struct blend_plan *plan,
+                                  struct blend_plane *pl, int bytes, int srcp,
+                                  uint8_t *srca, int srca_stride,
+                                  uint8_t srcamul)
+{
+    for (int y = 0; y < plan->rc.y1 - plan->rc.y0; y++) {
+        int x0 = plan->spans[y][0], x1 = plan->spans[y][1];
+        if (x0 < x1) {
+            blend_const_comp(pl, bytes, srcp, srca + y * srca_stride + x0,
+                             srca_stride, srcamul, plan->rc.x0 + x0,
+                             plan->rc.y0 + y, x1 - x0, 1);
+        }
+    }
+}
+
+static void blend_plan_luma_src(struct blend_plan *plan,
+                                struct blend_plane *pl, int bytes,
+                                uint8_t *src, int src_stride,
+                                uint8_t *srca, int srca_stride)
+{
+    for (int y = 0; y < plan->rc.y1 - plan->rc.y0; y++) {
+        int x0 = plan->spans[y][0], x1 = plan->spans[y][1];
+        if (x0 < x1) {
+            blend_src_comp(pl, bytes, src + y * src_stride + x0 * bytes,
+                           src_stride, srca + y * srca_stride + x0,
+                           srca_stride, plan->rc.x0 + x0, plan->rc.y0 + y,
+                           x1 - x0, 1);
+        }
+    }
+}
+
+// c is the index of the chroma plane (0 or 1); srcp is ignored if the plan
+// has per-pixel colors.
+static void blend_plan_chroma(struct blend_plan *plan, struct blend_plane *pl,
+                              int bytes, int c, int srcp)
+{
+    uint64_t div = 255 << (pl->xs + pl->ys);
+    for (int y = 0; y < plan->c_h; y++) {
+        uint8_t *dst_r = pl->ptr + (plan->c_y0 + y) * pl->stride
+                         + plan->c_x0 * pl->step;
+        uint16_t *a_r = plan->c_a + y * plan->c_w;
+        for (int x = 0; x < plan->c_w; x++) {
+            uint32_t a = a_r[x];
+            if (!a)
+                continue;
+            uint8_t *d = dst_r + x * pl->step;
+            uint64_t v = load_sample(d, bytes);
+            if (plan->c_ca[c]) {
+                uint32_t ca = plan->c_ca[c][y * plan->c_w + x];
+                store_sample(d, bytes, (ca + v * (div - a) + div / 2) / div);
+            } else {
+                store_sample(d, bytes, (srcp * a + v * (65025 - a) + 32512)
+                                       / 65025);
+            }
+        }
+    }
+}
+
+// Clip the sub-bitmap against dst, and return the source offset.
+static bool get_sub_rect(struct mp_image *dst, struct sub_bitmap *sb,
+                         struct mp_rect *out_rc, int *out_src_x, int *out_src_y)
+{
+    struct mp_rect rc = {sb->x, sb->y, sb->x + sb->dw, sb->y + sb->dh};
+    if (!mp_rect_intersection(&rc, &(struct mp_rect){0, 0, dst->w, dst->h}))
+        return false;
+    *out_rc = rc;
+    *out_src_x = rc.x0 - sb->x;
+    *out_src_y = rc.y0 - sb->y;
+    return true;
+}
+
+// Blend the sub-bitmaps directly into dst, without converting it to a 444
+// format first. format/bits are the values from get_closest_y444_format(),
+// which are used for cached RGBA sub-bitmaps. Returns false if dst is not
+// supported by this.
+static bool draw_direct(struct mp_draw_sub_cache *cache, struct mp_image *dst,
+                        int format, int bits, struct sub_bitmaps *sbs)
+{
+    struct blend_plane planes[3];
+    int num_planes = get_blend_planes(dst, bits, planes);
+    if (!num_planes)
+        return false;
+    int bytes = (bits + 7) / 8;
+    struct blend_plane *chroma = NULL;
+    if (num_planes > 1 && (planes[1].xs || planes[1].ys))
+        chroma = &planes[1];
+
+    struct mp_image fmt = {0};
+    mp_image_setfmt(&fmt, format);
+    fmt.colorspace = dst->colorspace;
+    fmt.levels = dst->levels;
+    struct part *part = get_cache(cache, sbs, &fmt);
+    assert(part);
+
+    if (part->plan_imgfmt != dst->imgfmt || part->plan_w != dst->w ||
+        part->plan_h != dst->h)
+    {
+        for (int n = 0; n < part->num_imgs; n++) {
+            talloc_free(part->imgs[n].plan);
+            part->imgs[n].plan = NULL;
+        }
+        part->plan_imgfmt = dst->imgfmt;
+        part->plan_w = dst->w;
+        part->plan_h = dst->h;
+    }
+
+    if (sbs->format == SUBBITMAP_RGBA) {
+        for (int i = 0; i < sbs->num_parts; ++i) {
+            struct sub_bitmap *sb = &sbs->parts[i];
+            struct sub_cache *c = &part->imgs[i];
+
+            struct mp_rect rc;
+            int src_x, src_y;
+            if (sb->w < 1 || sb->h < 1 ||
+                !get_sub_rect(dst, sb, &rc, &src_x, &src_y))
+                continue;
+
+            if (!(c->i && c->a)) {
+                scale_sb_rgba(sb, &fmt, &c->i, &c->a);
+                talloc_steal(part, c->i);
+                talloc_steal(part, c->a);
+            }
+            struct mp_image *sbi = c->i, *sba = c->a;
+
+            uint8_t *alpha_p = sba->planes[0] + src_y * sba->stride[0] + src_x;
+            if (!c->plan) {
+                c->plan = create_plan(part, rc, src_x, src_y, alpha_p,
+                                      sba->stride[0], 255, sbi, bytes, chroma);
+            }
+
+            for (int p = 0; p < num_planes; p++) {
+                if (chroma && p > 0) {
+                    blend_plan_chroma(c->plan, &planes[p], bytes, p - 1, 0);
+                } else {
+                    uint8_t *src = sbi->planes[p] + src_y * sbi->stride[p]
+                                   + src_x * bytes;
+                    blend_plan_luma_src(c->plan, &planes[p], bytes, src,
+                                        sbi->stride[p], alpha_p, sba->stride[0]);
+                }
+            }
+        }
+    } else if (sbs->format == SUBBITMAP_LIBASS) {
+        bool yuv = dst->flags & MP_IMGFLAG_YUV;
+        float yuv2rgb[3][4], rgb2yuv[3][4];
+        if (yuv) {
+            struct mp_csp_params cspar = MP_CSP_PARAMS_DEFAULTS;
+            cspar.colorspace.format = dst->colorspace;
+            cspar.colorspace.levels_in = dst->levels;
+            cspar.colorspace.levels_out = MP_CSP_LEVELS_PC; // RGB (libass.color)
+            cspar.int_bits_in = bits;
+            cspar.int_bits_out = 8;
+            mp_get_yuv2rgb_coeffs(&cspar, yuv2rgb);
+            mp_invert_yuv2rgb(rgb2yuv, yuv2rgb);
+        }
+
+        for (int i = 0; i < sbs->num_parts; ++i) {
+            struct sub_bitmap *sb = &sbs->parts[i];
+            struct sub_cache *c = &part->imgs[i];
+
+            struct mp_rect rc;
+            int src_x, src_y;
+            if (!get_sub_rect(dst, sb, &rc, &src_x, &src_y))
+                continue;
+
+            int r = (sb->libass.color >> 24) & 0xFF;
+            int g = (sb->libass.color >> 16) & 0xFF;
+            int b = (sb->libass.color >> 8) & 0xFF;
+            int a = 255 - (sb->libass.color & 0xFF);
+            int color[3] = {r, g, b};
+            if (yuv) {
+                mp_map_int_color(rgb2yuv, bits, color);
+            } else {
+                color[0] = g;
+                color[1] = b;
+                color[2] = r;
+            }
+
+            uint8_t *alpha_p = (uint8_t *)sb->bitmap + src_y * sb->stride + src_x;
+            if (!c->plan) {
+                c->plan = create_plan(part, rc, src_x, src_y, alpha_p,
+                                      sb->stride, a, NULL, bytes, chroma);
+            }
+
+            for (int p = 0; p < num_planes; p++) {
+                if (chroma && p > 0) {
+                    blend_plan_chroma(c->plan, &planes[p], bytes, p - 1,
+                                      color[p]);
+                } else {
+                    blend_plan_luma_const(c->plan, &planes[p], bytes, color[p],
+                                          alpha_p, sb->stride, a);
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
 // cache: if not NULL, the function will set *cache to a talloc-allocated cache
 //        containing scaled versions of sbs contents - free the cache with
 //        talloc_free()
@@ -536,13 +1057,16 @@ void mp_draw_sub_bitmaps(struct mp_draw_sub_cache **cache, struct mp_image *dst,
     get_closest_y444_format(dst->imgfmt, &format, &bits);
 
     struct mp_rect rc_list[MP_SUB_BB_LIST_MAX];
-    int num_rc = mp_get_sub_bb_list(sbs, rc_list, MP_SUB_BB_LIST_MAX);
+    int num_rc = 0;
+    // Fall back to converting the affected areas to 444 with swscale
+    if (!draw_direct(cache_, dst, format, bits, sbs))
+        num_rc = mp_get_sub_bb_list(sbs, rc_list, MP_SUB_BB_LIST_MAX);
 
     for (int r = 0; r < num_rc; r++) {
         struct mp_rect bb = rc_list[r];
 
         if (!align_bbox_for_swscale(dst, &bb))
-            return;
+            continue;
 
         struct mp_image dst_region = *dst;
         mp_image_crop_rc(&dst_region, bb);
@@ -0,0 +1,306 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+
+#include "talloc.h"
+#include "common/common.h"
+#include "event_index.h"
+
+struct event {
+    long long start, end;
+    int id;
+};
+
+// The events are kept in two arrays, one sorted by start and one sorted by
+// end time (ties broken by id). On top of the array sorted by start there is
+// an implicit binary tree, whose nodes contain the maximum end time of their
+// subtree. This allows finding all events overlapping with a range by
+// skipping subtrees that end too early.
+//
+// Subtitles are normally added in order, which is cheap. Events which would
+// have to be inserted in the middle are collected in an unsorted pending list
+// instead, which queries scan linearly. Once the pending list gets too long,
+// it is sorted and merged into the array sorted by start in one go, and the
+// tree is rebuilt. The array sorted by end is needed by event_index_step()
+// only, so it is merely appended to, and sorted there.
+struct event_index {
+    struct event *by_start;     // sorted events (num_sorted entries)
+    int num_sorted;
+    struct event *pending;      // events not yet merged into by_start
+    int num_pending;
+    struct event *by_end;       // all events
+    int num_events;
+    bool end_sorted;
+
+    long long *max_end;         // tree; node n has children 2n and 2n+1
+    int num_leaves;             // power of 2, leaf for event i is at this + i
+    bool tree_valid;
+
+    int *ids;                   // result of the last query
+};
+
+struct event_index *event_index_create(void *talloc_ctx)
+{
+    struct event_index *idx = talloc_zero(talloc_ctx, struct event_index);
+    event_index_reset(idx);
+    return idx;
+}
+
+void event_index_reset(struct event_index *idx)
+{
+    idx->num_events = 0;
+    idx->num_sorted = 0;
+    idx->num_pending = 0;
+    idx->end_sorted = true;
+    idx->tree_valid = false;
+}
+
+int event_index_num(struct event_index *idx)
+{
+    return idx->num_events;
+}
+
+static int cmp_start(const void *pa, const void *pb)
+{
+    const struct event *a = pa, *b = pb;
+    if (a->start != b->start)
+        return a->start < b->start ? -1 : 1;
+    return a->id - b->id;
+}
+
+static int cmp_end(const void *pa, const void *pb)
+{
+    const struct event *a = pa, *b = pb;
+    if (a->end != b->end)
+        return a->end < b->end ? -1 : 1;
+    return a->id - b->id;
+}
+
+static int cmp_id(const void *pa, const void *pb)
+{
+    return *(const int *)pa - *(const int *)pb;
+}
+
+static void update_node(struct event_index *idx, int n)
+{
+    idx->max_end[n] = MPMAX(idx->max_end[n * 2], idx->max_end[n * 2 + 1]);
+}
+
+static void rebuild_tree(struct event_index *idx)
+{
+    int leaves = 16;
+    while (leaves < idx->num_sorted)
+        leaves *= 2;
+    if (leaves != idx->num_leaves) {
+        idx->num_leaves = leaves;
+        idx->max_end = talloc_realloc(idx, idx->max_end, long long, leaves * 2);
+    }
+    for (int i = 0; i < leaves; i++) {
+        idx->max_end[leaves + i] =
+            i < idx->num_sorted ? idx->by_start[i].end : LLONG_MIN;
+    }
+    for (int n = leaves - 1; n >= 1; n--)
+        update_node(idx, n);
+    idx->tree_valid = true;
+}
+
+void event_index_add(struct event_index *idx, long long start, long long end,
+                     int id)
+{
+    struct event ev = {start, end, id};
+    int n = idx->num_events;
+    if (n && cmp_end(&idx->by_end[n - 1], &ev) > 0)
+        idx->end_sorted = false;
+    MP_TARRAY_GROW(idx, idx->by_end, n);
+    idx->by_end[n] = ev;
+    idx->num_events = n + 1;
+
+    int pos = idx->num_sorted;
+    if (pos && cmp_start(&idx->by_start[pos - 1], &ev) > 0) {
+        MP_TARRAY_APPEND(idx, idx->pending, idx->num_pending, ev);
+        return;
+    }
+
+    MP_TARRAY_GROW(idx, idx->by_start, pos);
+    idx->by_start[pos] = ev;
+    idx->num_sorted = pos + 1;
+
+    // Appending in order only requires updating the path to the root.
+    if (idx->tree_valid && pos < idx->num_leaves) {
+        int node = idx->num_leaves + pos;
+        idx->max_end[node] = end;
+        for (node /= 2; node >= 1; node /= 2)
+            update_node(idx, node);
+    } else {
+        idx->tree_valid = false;
+    }
+}
+
+// Sort the pending events and merge them into by_start (from the back, so
+// that no temporary array is needed).
+static void merge_pending(struct event_index *idx)
+{
+    int num = idx->num_pending;
+    qsort(idx->pending, num, sizeof(struct event), cmp_start);
+    int i = idx->num_sorted - 1, k = idx->num_sorted + num - 1;
+    MP_TARRAY_GROW(idx, idx->by_start, k);
+    for (int j = num - 1; j >= 0; k--) {
+        if (i >= 0 && cmp_start(&idx->by_start[i], &idx->pending[j]) > 0) {
+            idx->by_start[k] = idx->by_start[i--];
+        } else {
+            idx->by_start[k] = idx->pending[j--];
+        }
+    }
+    idx->num_sorted += num;
+    idx->num_pending = 0;
+    idx->tree_valid = false;
+}
+
+// If all is set, merge all pending events. Otherwise, only if there are so
+// many that scanning them on each query would be slower: the merge costs
+// O(n), so doing it every sqrt(n) added events keeps both costs at O(sqrt(n))
+// per event.
+static void prepare(struct event_index *idx, bool all)
+{
+    int num = idx->num_pending;
+    if (num && (all || (num > 16 && (long long)num * num > idx->num_events)))
+        merge_pending(idx);
+    if (!idx->tree_valid)
+        rebuild_tree(idx);
+}
+
+// Return the number of events with start < t (or start <= t if inclusive).
+static int count_start_before(struct event_index *idx, long long t,
+                              bool inclusive)
+{
+    int lo = 0, hi = idx->num_sorted;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        long long s = idx->by_start[mid].start;
+        if (s < t || (inclusive && s == t)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Same as count_start_before(), for end times.
+static int count_end_before(struct event_index *idx, long long t)
+{
+    int lo = 0, hi = idx->num_events;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (idx->by_end[mid].end < t) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Collect events from leaves [lo, hi) of the subtree at node, which contains
+// the leaves [node_lo, node_hi), if their end time is > a.
+static void collect(struct event_index *idx, int node, int node_lo,
+                    int node_hi, int hi, long long a, int *num)
+{
+    if (node_lo >= hi || idx->max_end[node] <= a)
+        return;
+    if (node >= idx->num_leaves) {
+        MP_TARRAY_APPEND(idx, idx->ids, *num, idx->by_start[node_lo].id);
+        return;
+    }
+    int mid = node_lo + (node_hi - node_lo) / 2;
+    collect(idx, node * 2, node_lo, mid, hi, a, num);
+    collect(idx, node * 2 + 1, mid, node_hi, hi, a, num);
+}
+
+int event_index_query(struct event_index *idx, long long a, long long b,
+                      int **ids)
+{
+    prepare(idx, false);
+    int num = 0;
+    int hi = count_start_before(idx, b, false);
+    collect(idx, 1, 0, idx->num_leaves, hi, a, &num);
+    for (int n = 0; n < idx->num_pending; n++) {
+        struct event *ev = &idx->pending[n];
+        if (ev->start < b && ev->end > a)
+            MP_TARRAY_APPEND(idx, idx->ids, num, ev->id);
+    }
+    qsort(idx->ids, num, sizeof(int), cmp_id);
+    *ids = idx->ids;
+    return num;
+}
+
+// Mirrors the loop in libass' ass_step_sub(), with the linear searches
+// replaced by binary searches. Ties are resolved the same way (in the order
+// the events were added).
+long long event_index_step(struct event_index *idx, long long now,
+                           int movement)
+{
+    prepare(idx, true);
+    if (!idx->end_sorted) {
+        qsort(idx->by_end, idx->num_events, sizeof(struct event), cmp_end);
+        idx->end_sorted = true;
+    }
+    if (!idx->num_events)
+        return 0;
+
+    struct event *best = NULL;
+    long long target = now;
+    int direction = (movement > 0 ? 1 : -1) * !!movement;
+
+    do {
+        struct event *closest = NULL;
+        long long closest_time = now;
+        if (direction < 0) {
+            // Largest end < target; the first added event among equal ones.
+            int i = count_end_before(idx, target);
+            if (i > 0) {
+                closest_time = idx->by_end[i - 1].end;
+                closest = &idx->by_end[count_end_before(idx, closest_time)];
+            }
+        } else if (direction > 0) {
+            // Smallest start > target.
+            int i = count_start_before(idx, target, true);
+            if (i < idx->num_events) {
+                closest = &idx->by_start[i];
+                closest_time = closest->start;
+            }
+        } else {
+            // Largest start < target; the last added event among equal ones.
+            int i = count_start_before(idx, target, false);
+            if (i > 0) {
+                closest = &idx->by_start[i - 1];
+                closest_time = closest->start;
+            }
+        }
+        target = closest_time + direction;
+        movement -= direction;
+        if (closest)
+            best = closest;
+    } while (movement);
+
+    return best ? best->start - now : 0;
+}
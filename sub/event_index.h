@@ -0,0 +1,47 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPLAYER_SUB_EVENT_INDEX_H
+#define MPLAYER_SUB_EVENT_INDEX_H
+
+// Index of timed subtitle events, for finding the events visible at a given
+// time without walking the whole list. Events are identified by an int id
+// chosen by the caller (e.g. the index into ASS_Track.events). The time unit
+// doesn't matter; an event covers the range [start, end).
+
+struct event_index;
+
+struct event_index *event_index_create(void *talloc_ctx);
+void event_index_reset(struct event_index *idx);
+void event_index_add(struct event_index *idx, long long start, long long end,
+                     int id);
+int event_index_num(struct event_index *idx);
+
+// Find all events overlapping with [a, b), i.e. start < b && end > a. Returns
+// the number of events, and sets *ids to their ids in ascending order. The
+// array is valid until the next call on idx.
+int event_index_query(struct event_index *idx, long long a, long long b,
+                      int **ids);
+
+// Same as ass_step_sub(): return the offset from now to the start of the
+// movement-th next (movement > 0) or previous (movement < 0) event, or to the
+// last event starting before now (movement == 0). Returns 0 if there is none.
+long long event_index_step(struct event_index *idx, long long now,
+                           int movement);
+
+#endif
@@ -23,7 +23,9 @@
 
 #include "talloc.h"
 
+#include "config.h"
 #include "common/common.h"
+#include "common/cpudetect.h"
 #include "img_convert.h"
 #include "osd.h"
 #include "video/img_format.h"
@@ -42,7 +44,7 @@ struct osd_conv_cache *osd_conv_cache_new(void)
     return talloc_zero(NULL, struct osd_conv_cache);
 }
 
-static void rgba_to_premultiplied_rgba(uint32_t *colors, size_t count)
+static void rgba_to_premultiplied_rgba_c(uint32_t *colors, size_t count)
 {
     for (int n = 0; n < count; n++) {
         uint32_t c = colors[n];
@@ -57,6 +59,209 @@ static void rgba_to_premultiplied_rgba(uint32_t *colors, size_t count)
     }
 }
 
+static void expand_palette_c(uint32_t *dst, uint8_t *src, int w,
+                             uint32_t *palette)
+{
+    for (int x = 0; x < w; x++)
+        dst[x] = palette[src[x]];
+}
+
+static void draw_ass_rgba_c(unsigned char *src, int src_w, int src_h,
+                            int src_stride, unsigned char *dst,
+                            size_t dst_stride, uint32_t color)
+{
+    const unsigned int r = (color >> 24) & 0xff;
+    const unsigned int g = (color >> 16) & 0xff;
+    const unsigned int b = (color >>  8) & 0xff;
+    const unsigned int a = 0xff - (color & 0xff);
+
+    for (int y = 0; y < src_h; y++, dst += dst_stride, src += src_stride) {
+        uint32_t *dstrow = (uint32_t *) dst;
+        for (int x = 0; x < src_w; x++) {
+            const unsigned int v = src[x];
+            int rr = (r * a * v);
+            int gg = (g * a * v);
+            int bb = (b * a * v);
+            int aa =      a * v;
+            uint32_t dstpix = dstrow[x];
+            unsigned int dstb =  dstpix        & 0xFF;
+            unsigned int dstg = (dstpix >>  8) & 0xFF;
+            unsigned int dstr = (dstpix >> 16) & 0xFF;
+            unsigned int dsta = (dstpix >> 24) & 0xFF;
+            dstb = (bb       + dstb * (255 * 255 - aa)) / (255 * 255);
+            dstg = (gg       + dstg * (255 * 255 - aa)) / (255 * 255);
+            dstr = (rr       + dstr * (255 * 255 - aa)) / (255 * 255);
+            dsta = (aa * 255 + dsta * (255 * 255 - aa)) / (255 * 255);
+            dstrow[x] = dstb | (dstg << 8) | (dstr << 16) | (dsta << 24);
+        }
+    }
+}
+
+#if HAVE_X86_INTRINSICS
+#include <immintrin.h>
+
+// Exactly x / 255 for 0 <= x <= 255 * 255 (unsigned 16 bit lanes).
+__attribute__((target("sse2")))
+static inline __m128i div255_sse2(__m128i x)
+{
+    x = _mm_add_epi16(x, _mm_add_epi16(_mm_srli_epi16(x, 8),
+                                       _mm_set1_epi16(1)));
+    return _mm_srli_epi16(x, 8);
+}
+
+__attribute__((target("sse2")))
+static void rgba_to_premultiplied_rgba_sse2(uint32_t *colors, size_t count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    // alpha is multiplied with 255 instead of itself, which keeps it
+    const __m128i amask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+    size_t n = 0;
+    for (; n + 4 <= count; n += 4) {
+        __m128i c = _mm_loadu_si128((__m128i *)(colors + n));
+        __m128i res[2];
+        for (int k = 0; k < 2; k++) {
+            __m128i c16 = k ? _mm_unpackhi_epi8(c, zero)
+                            : _mm_unpacklo_epi8(c, zero);
+            __m128i a16 = _mm_shufflehi_epi16(
+                            _mm_shufflelo_epi16(c16, _MM_SHUFFLE(3, 3, 3, 3)),
+                            _MM_SHUFFLE(3, 3, 3, 3));
+            a16 = _mm_or_si128(_mm_andnot_si128(amask, a16),
+                               _mm_and_si128(amask, _mm_set1_epi16(255)));
+            res[k] = div255_sse2(_mm_mullo_epi16(c16, a16));
+        }
+        _mm_storeu_si128((__m128i *)(colors + n),
+                         _mm_packus_epi16(res[0], res[1]));
+    }
+    rgba_to_premultiplied_rgba_c(colors + n, count - n);
+}
+
+__attribute__((target("avx2")))
+static void expand_palette_avx2(uint32_t *dst, uint8_t *src, int w,
+                                uint32_t *palette)
+{
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        __m128i idx8 = _mm_loadl_epi64((__m128i *)(src + x));
+        __m256i c = _mm256_i32gather_epi32((const int *)palette,
+                                           _mm256_cvtepu8_epi32(idx8), 4);
+        _mm256_storeu_si256((__m256i *)(dst + x), c);
+    }
+    expand_palette_c(dst + x, src + x, w - x, palette);
+}
+
+// floor(n / 65025) for 4 lanes. n must be an integer below 2^24, so that it's
+// exact in single precision; the quotient from the reciprocal multiplication
+// is off by at most 1 and is fixed up with the remainder.
+__attribute__((target("sse2")))
+static inline __m128i div65025_sse2(__m128 n)
+{
+    const __m128 d = _mm_set1_ps(65025.0f);
+    __m128i q = _mm_cvttps_epi32(_mm_mul_ps(n, _mm_set1_ps(1.0f / 65025.0f)));
+    __m128 r = _mm_sub_ps(n, _mm_mul_ps(_mm_cvtepi32_ps(q), d));
+    // masks are -1 where true
+    q = _mm_add_epi32(q, _mm_castps_si128(_mm_cmplt_ps(r, _mm_setzero_ps())));
+    q = _mm_sub_epi32(q, _mm_castps_si128(_mm_cmpge_ps(r, d)));
+    return q;
+}
+
+// Blend one pixel (4 components in 32 bit lanes) with coverage aa (0..65025,
+// broadcast to all lanes). fc is the source color with alpha set to 255.
+__attribute__((target("sse2")))
+static inline __m128i blend_pixel_sse2(__m128 fc, __m128i aa, __m128i d)
+{
+    __m128 fa = _mm_cvtepi32_ps(aa);
+    __m128 fd = _mm_cvtepi32_ps(d);
+    __m128 n = _mm_add_ps(_mm_mul_ps(fc, fa),
+                          _mm_mul_ps(fd, _mm_sub_ps(_mm_set1_ps(65025.0f), fa)));
+    return div65025_sse2(n);
+}
+
+// Same results as draw_ass_rgba_c().
+__attribute__((target("sse2")))
+static void draw_ass_rgba_sse2(unsigned char *src, int src_w, int src_h,
+                               int src_stride, unsigned char *dst,
+                               size_t dst_stride, uint32_t color)
+{
+    const unsigned int a = 0xff - (color & 0xff);
+    if (!a)
+        return;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 fc = _mm_setr_ps((color >> 8) & 0xff, (color >> 16) & 0xff,
+                                  (color >> 24) & 0xff, 255);
+    const __m128i a16 = _mm_set1_epi16(a);
+
+    for (int y = 0; y < src_h; y++, dst += dst_stride, src += src_stride) {
+        int x = 0;
+        for (; x + 4 <= src_w; x += 4) {
+            uint32_t v4;
+            memcpy(&v4, src + x, 4);
+            // Most of a glyph bitmap is usually fully transparent.
+            if (!v4)
+                continue;
+            __m128i v = _mm_unpacklo_epi8(_mm_cvtsi32_si128(v4), zero);
+            __m128i aa = _mm_unpacklo_epi16(_mm_mullo_epi16(v, a16), zero);
+            __m128i d = _mm_loadu_si128((__m128i *)(dst + x * 4));
+            __m128i d16[2] = {_mm_unpacklo_epi8(d, zero),
+                              _mm_unpackhi_epi8(d, zero)};
+            __m128i p[4];
+            p[0] = blend_pixel_sse2(fc, _mm_shuffle_epi32(aa, 0x00),
+                                    _mm_unpacklo_epi16(d16[0], zero));
+            p[1] = blend_pixel_sse2(fc, _mm_shuffle_epi32(aa, 0x55),
+                                    _mm_unpackhi_epi16(d16[0], zero));
+            p[2] = blend_pixel_sse2(fc, _mm_shuffle_epi32(aa, 0xAA),
+                                    _mm_unpacklo_epi16(d16[1], zero));
+            p[3] = blend_pixel_sse2(fc, _mm_shuffle_epi32(aa, 0xFF),
+                                    _mm_unpackhi_epi16(d16[1], zero));
+            __m128i res = _mm_packus_epi16(_mm_packs_epi32(p[0], p[1]),
+                                           _mm_packs_epi32(p[2], p[3]));
+            _mm_storeu_si128((__m128i *)(dst + x * 4), res);
+        }
+        if (x < src_w) {
+            draw_ass_rgba_c(src + x, src_w - x, 1, src_stride, dst + x * 4,
+                            dst_stride, color);
+        }
+    }
+}
+#endif /* HAVE_X86_INTRINSICS */
+
+static void rgba_to_premultiplied_rgba(uint32_t *colors, size_t count)
+{
+#if HAVE_X86_INTRINSICS
+    if (gCpuCaps.hasSSE2) {
+        rgba_to_premultiplied_rgba_sse2(colors, count);
+        return;
+    }
+#endif
+    rgba_to_premultiplied_rgba_c(colors, count);
+}
+
+static void expand_palette(uint32_t *dst, uint8_t *src, int w,
+                           uint32_t *palette)
+{
+#if HAVE_X86_INTRINSICS
+    if (gCpuCaps.hasAVX2) {
+        expand_palette_avx2(dst, src, w, palette);
+        return;
+    }
+#endif
+    expand_palette_c(dst, src, w, palette);
+}
+
+static void draw_ass_rgba(unsigned char *src, int src_w, int src_h,
+                          int src_stride, unsigned char *dst, size_t dst_stride,
+                          int dst_x, int dst_y, uint32_t color)
+{
+    dst += dst_y * dst_stride + dst_x * 4;
+#if HAVE_X86_INTRINSICS
+    if (gCpuCaps.hasSSE2) {
+        draw_ass_rgba_sse2(src, src_w, src_h, src_stride, dst, dst_stride,
+                           color);
+        return;
+    }
+#endif
+    draw_ass_rgba_c(src, src_w, src_h, src_stride, dst, dst_stride, color);
+}
+
 bool osd_conv_idx_to_rgba(struct osd_conv_cache *c, struct sub_bitmaps *imgs)
 {
     struct sub_bitmaps src = *imgs;
@@ -83,8 +288,7 @@ bool osd_conv_idx_to_rgba(struct osd_conv_cache *c, struct sub_bitmaps *imgs)
         for (int y = 0; y < s->h; y++) {
             uint8_t *inbmp = sb.bitmap + y * s->stride;
             uint32_t *outbmp = (uint32_t*)((uint8_t*)d->bitmap + y * d->stride);
-            for (int x = 0; x < s->w; x++)
-                *outbmp++ = sb.palette[*inbmp++];
+            expand_palette(outbmp, inbmp, s->w, sb.palette);
         }
     }
     return true;
@@ -108,8 +312,13 @@ bool osd_conv_blur_rgba(struct osd_conv_cache *c, struct sub_bitmaps *imgs,
         int pad = 5;
         struct mp_image *temp = mp_image_alloc(IMGFMT_BGRA, s->w + pad * 2,
                                                             s->h + pad * 2);
-        memset_pic(temp->planes[0], 0, temp->w * 4, temp->h, temp->stride[0]);
         uint8_t *p0 = temp->planes[0] + pad * 4 + pad * temp->stride[0];
+        // clear only the border; the rest is overwritten
+        memset_pic(temp->planes[0], 0, temp->w * 4, pad, temp->stride[0]);
+        memset_pic(temp->planes[0] + (pad + s->h) * temp->stride[0], 0,
+                   temp->w * 4, pad, temp->stride[0]);
+        memset_pic(p0 - pad * 4, 0, pad * 4, s->h, temp->stride[0]);
+        memset_pic(p0 + s->w * 4, 0, pad * 4, s->h, temp->stride[0]);
         memcpy_pic(p0, s->bitmap, s->w * 4, s->h, temp->stride[0], s->stride);
 
         double sx = (double)s->dw / s->w;
@@ -211,39 +420,6 @@ bool osd_conv_idx_to_gray(struct osd_conv_cache *c, struct sub_bitmaps *imgs)
     return true;
 }
 
-static void draw_ass_rgba(unsigned char *src, int src_w, int src_h,
-                          int src_stride, unsigned char *dst, size_t dst_stride,
-                          int dst_x, int dst_y, uint32_t color)
-{
-    const unsigned int r = (color >> 24) & 0xff;
-    const unsigned int g = (color >> 16) & 0xff;
-    const unsigned int b = (color >>  8) & 0xff;
-    const unsigned int a = 0xff - (color & 0xff);
-
-    dst += dst_y * dst_stride + dst_x * 4;
-
-    for (int y = 0; y < src_h; y++, dst += dst_stride, src += src_stride) {
-        uint32_t *dstrow = (uint32_t *) dst;
-        for (int x = 0; x < src_w; x++) {
-            const unsigned int v = src[x];
-            int rr = (r * a * v);
-            int gg = (g * a * v);
-            int bb = (b * a * v);
-            int aa =      a * v;
-            uint32_t dstpix = dstrow[x];
-            unsigned int dstb =  dstpix        & 0xFF;
-            unsigned int dstg = (dstpix >>  8) & 0xFF;
-            unsigned int dstr = (dstpix >> 16) & 0xFF;
-            unsigned int dsta = (dstpix >> 24) & 0xFF;
-            dstb = (bb       + dstb * (255 * 255 - aa)) / (255 * 255);
-            dstg = (gg       + dstg * (255 * 255 - aa)) / (255 * 255);
-            dstr = (rr       + dstr * (255 * 255 - aa)) / (255 * 255);
-            dsta = (aa * 255 + dsta * (255 * 255 - aa)) / (255 * 255);
-            dstrow[x] = dstb | (dstg << 8) | (dstr << 16) | (dsta << 24);
-        }
-    }
-}
-
 bool osd_conv_ass_to_rgba(struct osd_conv_cache *c, struct sub_bitmaps *imgs)
 {
     struct sub_bitmaps src = *imgs;
@@ -5,6 +5,7 @@
 #include "demux/packet.h"
 
 struct sd {
+    struct mpv_global *global;
     struct mp_log *log;
     struct MPOpts *opts;
 
@@ -19,6 +19,8 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <limits.h>
+#include <pthread.h>
 
 #include <libavutil/common.h>
 #include <ass/ass.h>
@@ -30,18 +32,87 @@
 #include "common/msg.h"
 #include "video/csputils.h"
 #include "video/mp_image.h"
+#include "video/memcpy_pic.h"
 #include "dec_sub.h"
 #include "ass_mp.h"
+#include "event_index.h"
 #include "sd.h"
 
 struct sd_ass_priv {
     struct ass_track *ass_track;
+    // Index of ass_track's events. If the render-ahead thread is running,
+    // this is protected by ra->track_lock like the track itself.
+    struct event_index *index;
     bool is_converted;
     struct sub_bitmap *parts;
     bool flush_on_seek;
     char last_text[500];
     struct mp_image_params video_params;
     struct mp_image_params last_params;
+    struct render_ahead *ra;
+    bool ra_failed;             // don't try to start render-ahead again
+    bool rendered_empty;        // last ass_render_frame() had no events
+};
+
+#define MAX_RENDER_AHEAD 16
+
+// A frame rendered ahead can be used for pts values this close to the one it
+// was rendered for (in ms), as long as no event starts or ends in between.
+// This hides rounding differences between predicted and actual frame pts.
+#define PTS_TOLERANCE 2
+
+// Everything that affects rendering, except the track.
+struct render_params {
+    struct mp_osd_res dim;
+    double aspect;
+    int storage_w, storage_h;
+    // MPOpts fields used by mp_ass_configure()
+    int ass_style_override, ass_use_margins, sub_pos, ass_hinting, ass_shaper;
+    float ass_line_spacing, sub_scale;
+};
+
+// A frame rendered by the render-ahead thread. It has its own copy of the
+// bitmap data, as libass reuses its images on the next ass_render_frame().
+struct ass_frame {
+    struct render_params params;
+    long long ipts;
+    long long valid_min, valid_max;
+    bool valid;                 // false if the track changed for this range
+    struct sub_bitmap *parts;
+    int num_parts;
+};
+
+// State of the render-ahead thread. Once it's running, the track and the
+// renderer are used by the thread only, and decode() merely queues packets.
+struct render_ahead {
+    pthread_t thread;
+    // Protects the track. Lock order: track_lock, then lock.
+    pthread_mutex_t track_lock;
+
+    pthread_mutex_t lock;       // protects all fields below
+    pthread_cond_t wakeup;
+    bool terminate;
+    bool failed;                // renderer could not be created
+
+    // Incremented when the track is flushed. Frames rendered before that
+    // are discarded.
+    int gen;
+
+    // Packets not yet passed to libass (allocated without talloc parent).
+    struct demux_packet *pending;
+    int num_pending;
+    bool flush;                 // ass_flush_events() before adding pending
+    long long pending_start, pending_end; // pts range affected by pending
+
+    struct render_params params; // of the last get_bitmaps() call
+    bool want;                  // get_bitmaps() is waiting for want_ipts
+    long long want_ipts;
+    long long ahead[MAX_RENDER_AHEAD];
+    int num_ahead;
+
+    struct ass_frame *cache[MAX_RENDER_AHEAD + 2];
+    int num_cache;
+    struct ass_frame *cur;      // frame returned by the last get_bitmaps()
 };
 
 static void mangle_colors(struct sd *sd, struct sub_bitmaps *parts);
@@ -82,10 +153,39 @@ static int init(struct sd *sd)
 
     mp_ass_add_default_styles(ctx->ass_track, opts);
 
+    ctx->index = event_index_create(ctx);
+
     return 0;
 }
 
-static void decode(struct sd *sd, struct demux_packet *packet)
+// Add events the index doesn't know about yet. libass only ever appends
+// events to the track, except for ass_flush_events(), after which the index
+// must be reset with event_index_reset(). If the render-ahead thread is
+// running, the caller must hold ra->track_lock.
+static struct event_index *get_index(struct sd *sd)
+{
+    struct sd_ass_priv *ctx = sd->priv;
+    ASS_Track *track = ctx->ass_track;
+    if (track->n_events < event_index_num(ctx->index))
+        event_index_reset(ctx->index);
+    for (int i = event_index_num(ctx->index); i < track->n_events; i++) {
+        ASS_Event *event = track->events + i;
+        event_index_add(ctx->index, event->Start,
+                        event->Start + event->Duration, i);
+    }
+    return ctx->index;
+}
+
+static void flush_events(struct sd *sd)
+{
+    struct sd_ass_priv *ctx = sd->priv;
+    ass_flush_events(ctx->ass_track);
+    event_index_reset(ctx->index);
+}
+
+// Add the packet to the track. If the render-ahead thread is running, the
+// caller must hold ra->track_lock.
+static void decode_packet(struct sd *sd, struct demux_packet *packet)
 {
     struct sd_ass_priv *ctx = sd->priv;
     ASS_Track *track = ctx->ass_track;
@@ -95,8 +195,6 @@ static void decode(struct sd *sd, struct demux_packet *packet)
         ass_process_chunk(track, packet->buffer, packet->len, ipts, iduration);
         return;
     } else if (strcmp(sd->codec, "ssa") == 0) {
-        // broken ffmpeg ASS packet format
-        ctx->flush_on_seek = true;
         ass_process_data(track, packet->buffer, packet->len);
         return;
     }
@@ -112,10 +210,12 @@ static void decode(struct sd *sd, struct demux_packet *packet)
     }
     unsigned char *text = packet->buffer;
     if (!sd->no_remove_duplicates) {
-        for (int i = 0; i < track->n_events; i++) {
-            if (track->events[i].Start == ipts
-                && (track->events[i].Duration == iduration)
-                && strcmp(track->events[i].Text, text) == 0)
+        int *ids;
+        int num = event_index_query(get_index(sd), ipts, ipts + 1, &ids);
+        for (int n = 0; n < num; n++) {
+            ASS_Event *event = track->events + ids[n];
+            if (event->Start == ipts && event->Duration == iduration
+                && strcmp(event->Text, text) == 0)
                 return;   // We've already added this subtitle
         }
     }
@@ -127,39 +227,470 @@ static void decode(struct sd *sd, struct demux_packet *packet)
     event->Text = strdup(text);
 }
 
-static void get_bitmaps(struct sd *sd, struct mp_osd_res dim, double pts,
-                        struct sub_bitmaps *res)
+// Caller holds ra->lock.
+static void invalidate_frames(struct render_ahead *ra, long long start,
+                              long long end)
+{
+    for (int n = 0; n < ra->num_cache + 1; n++) {
+        struct ass_frame *f = n < ra->num_cache ? ra->cache[n] : ra->cur;
+        if (f && f->valid_min < end && f->valid_max >= start)
+            f->valid = false;
+    }
+}
+
+// Pass queued packets to libass. Caller holds ra->track_lock. Returns the
+// ra->gen value the track contents correspond to.
+static int apply_pending(struct sd *sd)
 {
     struct sd_ass_priv *ctx = sd->priv;
-    struct MPOpts *opts = sd->opts;
+    struct render_ahead *ra = ctx->ra;
+
+    pthread_mutex_lock(&ra->lock);
+    struct demux_packet *pending = ra->pending;
+    int num_pending = ra->num_pending;
+    bool flush = ra->flush;
+    long long start = ra->pending_start, end = ra->pending_end;
+    ra->pending = NULL;
+    ra->num_pending = 0;
+    ra->flush = false;
+    ra->pending_start = LLONG_MAX;
+    ra->pending_end = LLONG_MIN;
+    int gen = ra->gen;
+    pthread_mutex_unlock(&ra->lock);
+
+    if (flush)
+        flush_events(sd);
+    for (int n = 0; n < num_pending; n++)
+        decode_packet(sd, &pending[n]);
+    talloc_free(pending);
+
+    if (num_pending) {
+        pthread_mutex_lock(&ra->lock);
+        invalidate_frames(ra, start, end);
+        pthread_mutex_unlock(&ra->lock);
+    }
 
-    if (pts == MP_NOPTS_VALUE || !sd->ass_renderer)
+    return gen;
+}
+
+static void decode(struct sd *sd, struct demux_packet *packet)
+{
+    struct sd_ass_priv *ctx = sd->priv;
+    struct render_ahead *ra = ctx->ra;
+    bool is_ssa = strcmp(sd->codec, "ssa") == 0;
+    if (is_ssa) {
+        // broken ffmpeg ASS packet format
+        ctx->flush_on_seek = true;
+    }
+    if (!ra) {
+        decode_packet(sd, packet);
         return;
+    }
+    // Events of "ssa" packets have their own timestamps.
+    long long start = LLONG_MIN, end = LLONG_MAX;
+    if (!is_ssa && packet->pts != MP_NOPTS_VALUE) {
+        start = packet->pts * 1000 + 0.5;
+        end = start + (long long)(packet->duration * 1000 + 0.5);
+    }
+    pthread_mutex_lock(&ra->lock);
+    ra->pending = talloc_realloc(NULL, ra->pending, struct demux_packet,
+                                 ra->num_pending + 1);
+    char *buffer = talloc_size(ra->pending, packet->len + 1);
+    memcpy(buffer, packet->buffer, packet->len);
+    buffer[packet->len] = '\0';
+    ra->pending[ra->num_pending++] = (struct demux_packet) {
+        .buffer = buffer,
+        .len = packet->len,
+        .pts = packet->pts,
+        .duration = packet->duration,
+    };
+    ra->pending_start = FFMIN(ra->pending_start, start);
+    ra->pending_end = FFMAX(ra->pending_end, end);
+    pthread_mutex_unlock(&ra->lock);
+}
+
+static void get_render_params(struct sd *sd, struct mp_osd_res dim,
+                              struct render_params *p)
+{
+    struct sd_ass_priv *ctx = sd->priv;
+    struct MPOpts *opts = sd->opts;
 
-    ASS_Renderer *renderer = sd->ass_renderer;
-    double scale = dim.display_par;
+    memset(p, 0, sizeof(*p)); // compared with memcmp()
+    p->dim = dim;
+    p->aspect = dim.display_par;
     if (!ctx->is_converted && (!opts->ass_style_override ||
                                opts->ass_vsfilter_aspect_compat))
     {
         // Let's use the original video PAR for vsfilter compatibility:
-        scale = scale
+        p->aspect = p->aspect
             * (ctx->video_params.d_w / (double)ctx->video_params.d_h)
             / (ctx->video_params.w   / (double)ctx->video_params.h);
     }
-    mp_ass_configure(renderer, opts, &dim);
-    ass_set_aspect_ratio(renderer, scale, 1);
-#if LIBASS_VERSION >= 0x01020000
     if (!ctx->is_converted && (!opts->ass_style_override ||
                                opts->ass_vsfilter_blur_compat))
     {
-        ass_set_storage_size(renderer, ctx->video_params.w, ctx->video_params.h);
-    } else {
-        ass_set_storage_size(renderer, 0, 0);
+        p->storage_w = ctx->video_params.w;
+        p->storage_h = ctx->video_params.h;
     }
+    p->ass_style_override = opts->ass_style_override;
+    p->ass_use_margins = opts->ass_use_margins;
+    p->sub_pos = opts->sub_pos;
+    p->ass_hinting = opts->ass_hinting;
+    p->ass_shaper = opts->ass_shaper;
+    p->ass_line_spacing = opts->ass_line_spacing;
+    p->sub_scale = opts->sub_scale;
+}
+
+static void configure_renderer(ASS_Renderer *renderer, struct render_params *p)
+{
+    struct MPOpts opts = {
+        .ass_style_override = p->ass_style_override,
+        .ass_use_margins = p->ass_use_margins,
+        .sub_pos = p->sub_pos,
+        .ass_hinting = p->ass_hinting,
+        .ass_shaper = p->ass_shaper,
+        .ass_line_spacing = p->ass_line_spacing,
+        .sub_scale = p->sub_scale,
+    };
+    mp_ass_configure(renderer, &opts, &p->dim);
+    ass_set_aspect_ratio(renderer, p->aspect, 1);
+#if LIBASS_VERSION >= 0x01020000
+    ass_set_storage_size(renderer, p->storage_w, p->storage_h);
 #endif
-    mp_ass_render_frame(renderer, ctx->ass_track, pts * 1000 + .5,
-                        &ctx->parts, res);
-    talloc_steal(ctx, ctx->parts);
+}
+
+// Find the range around ipts in which the set of visible events is the same.
+static void get_valid_range(struct sd *sd, long long ipts,
+                            long long *out_min, long long *out_max)
+{
+    struct sd_ass_priv *ctx = sd->priv;
+    long long min = ipts - PTS_TOLERANCE, max = ipts + PTS_TOLERANCE;
+    // Only events starting or ending within [min, max] matter.
+    int *ids;
+    int num = event_index_query(get_index(sd), min, max + 1, &ids);
+    for (int n = 0; n < num; n++) {
+        ASS_Event *event = ctx->ass_track->events + ids[n];
+        long long bounds[2] = {event->Start, event->Start + event->Duration};
+        for (int b = 0; b < 2; b++) {
+            if (bounds[b] > min && bounds[b] <= ipts)
+                min = bounds[b];
+            if (bounds[b] > ipts && bounds[b] <= max)
+                max = bounds[b] - 1;
+        }
+    }
+    *out_min = min;
+    *out_max = max;
+}
+
+// Render thread only; caller holds ra->track_lock.
+static struct ass_frame *render_frame(struct sd *sd, ASS_Renderer *renderer,
+                                      struct render_params *params,
+                                      long long ipts)
+{
+    struct sd_ass_priv *ctx = sd->priv;
+
+    configure_renderer(renderer, params);
+    ASS_Image *imgs = ass_render_frame(renderer, ctx->ass_track, ipts, NULL);
+
+    struct ass_frame *frame = talloc_zero(NULL, struct ass_frame);
+    frame->params = *params;
+    frame->ipts = ipts;
+    frame->valid = true;
+    get_valid_range(sd, ipts, &frame->valid_min, &frame->valid_max);
+
+    for (struct ass_image *img = imgs; img; img = img->next) {
+        if (img->w == 0 || img->h == 0)
+            continue;
+        void *data = talloc_size(frame, img->w * img->h);
+        memcpy_pic(data, img->bitmap, img->w, img->h, img->w, img->stride);
+        MP_TARRAY_APPEND(frame, frame->parts, frame->num_parts,
+                         (struct sub_bitmap) {
+                            .bitmap = data,
+                            .stride = img->w,
+                            .libass.color = img->color,
+                            .w = img->w, .dw = img->w,
+                            .h = img->h, .dh = img->h,
+                            .x = img->dst_x,
+                            .y = img->dst_y,
+                         });
+    }
+
+    return frame;
+}
+
+// Return 0 if the frames are equal, 1 if only the positions changed, and 2
+// if the bitmaps changed (like ass_render_frame()'s detect_change).
+static int compare_frames(struct ass_frame *a, struct ass_frame *b)
+{
+    if (!a || !b || a->num_parts != b->num_parts)
+        return 2;
+    int res = 0;
+    for (int n = 0; n < a->num_parts; n++) {
+        struct sub_bitmap *pa = &a->parts[n], *pb = &b->parts[n];
+        if (pa->w != pb->w || pa->h != pb->h ||
+            pa->libass.color != pb->libass.color ||
+            memcmp(pa->bitmap, pb->bitmap, pa->w * pa->h) != 0)
+            return 2;
+        if (pa->x != pb->x || pa->y != pb->y)
+            res = 1;
+    }
+    return res;
+}
+
+// Caller holds ra->lock. If check_pending is set, frames which might be
+// affected by packets not yet passed to libass are not returned.
+static struct ass_frame *find_frame(struct render_ahead *ra, long long ipts,
+                                    struct render_params *params,
+                                    bool check_pending)
+{
+    for (int n = 0; n < ra->num_cache + 1; n++) {
+        struct ass_frame *f = n < ra->num_cache ? ra->cache[n] : ra->cur;
+        if (f && f->valid && ipts >= f->valid_min && ipts <= f->valid_max &&
+            memcmp(&f->params, params, sizeof(*params)) == 0)
+        {
+            if (check_pending && (ra->flush || (ra->num_pending &&
+                ra->pending_start <= f->valid_max &&
+                ra->pending_end > f->valid_min)))
+                continue;
+            return f;
+        }
+    }
+    return NULL;
+}
+
+// Caller holds ra->lock.
+static void remove_frame(struct render_ahead *ra, int index, bool free_frame)
+{
+    if (free_frame)
+        talloc_free(ra->cache[index]);
+    MP_TARRAY_REMOVE_AT(ra->cache, ra->num_cache, index);
+}
+
+// Caller holds ra->lock.
+static void add_frame(struct render_ahead *ra, struct ass_frame *frame)
+{
+    if (ra->num_cache == MP_ARRAY_SIZE(ra->cache)) {
+        // Evict unusable frames first, then the oldest one.
+        int evict = 0;
+        for (int n = 0; n < ra->num_cache; n++) {
+            struct ass_frame *f = ra->cache[n];
+            if (!f->valid || memcmp(&f->params, &ra->params, sizeof(f->params))) {
+                evict = n;
+                break;
+            }
+            if (f->ipts < ra->cache[evict]->ipts)
+                evict = n;
+        }
+        remove_frame(ra, evict, true);
+    }
+    ra->cache[ra->num_cache++] = frame;
+}
+
+static void *render_thread(void *arg)
+{
+    struct sd *sd = arg;
+    struct sd_ass_priv *ctx = sd->priv;
+    struct render_ahead *ra = ctx->ra;
+
+    ASS_Renderer *renderer = ass_renderer_init(sd->ass_library);
+    if (renderer) {
+        mp_ass_configure_fonts(renderer, sd->opts->sub_text_style, sd->global,
+                               sd->log);
+    } else {
+        MP_ERR(sd, "Could not create libass renderer for render-ahead.\n");
+    }
+
+    pthread_mutex_lock(&ra->lock);
+    ra->failed = !renderer;
+    pthread_cond_broadcast(&ra->wakeup);
+    while (!ra->terminate) {
+        bool have_job = false;
+        long long ipts = 0;
+        if (renderer && ra->want) {
+            ipts = ra->want_ipts;
+            ra->want = false;
+            have_job = true;
+        }
+        for (int n = 0; n < ra->num_ahead && renderer && !have_job; n++) {
+            if (!find_frame(ra, ra->ahead[n], &ra->params, false)) {
+                ipts = ra->ahead[n];
+                have_job = true;
+            }
+        }
+        if (!have_job && !ra->num_pending && !ra->flush) {
+            pthread_cond_wait(&ra->wakeup, &ra->lock);
+            continue;
+        }
+        struct render_params params = ra->params;
+        pthread_mutex_unlock(&ra->lock);
+
+        pthread_mutex_lock(&ra->track_lock);
+        int gen = apply_pending(sd);
+        struct ass_frame *frame = NULL;
+        if (have_job)
+            frame = render_frame(sd, renderer, &params, ipts);
+        pthread_mutex_lock(&ra->lock);
+        pthread_mutex_unlock(&ra->track_lock);
+
+        if (frame) {
+            if (gen == ra->gen) {
+                add_frame(ra, frame);
+            } else {
+                talloc_free(frame);
+            }
+        }
+        pthread_cond_broadcast(&ra->wakeup);
+    }
+    pthread_mutex_unlock(&ra->lock);
+
+    if (renderer)
+        ass_renderer_done(renderer);
+    return NULL;
+}
+
+static void start_render_ahead(struct sd *sd)
+{
+    struct sd_ass_priv *ctx = sd->priv;
+
+    struct render_ahead *ra = talloc_zero(ctx, struct render_ahead);
+    ra->pending_start = LLONG_MAX;
+    ra->pending_end = LLONG_MIN;
+    pthread_mutex_init(&ra->track_lock, NULL);
+    pthread_mutex_init(&ra->lock, NULL);
+    pthread_cond_init(&ra->wakeup, NULL);
+
+    ctx->ra = ra;
+    if (pthread_create(&ra->thread, NULL, render_thread, sd)) {
+        MP_ERR(sd, "Could not start render-ahead thread.\n");
+        ctx->ra_failed = true;
+        pthread_cond_destroy(&ra->wakeup);
+        pthread_mutex_destroy(&ra->lock);
+        pthread_mutex_destroy(&ra->track_lock);
+        talloc_free(ra);
+        ctx->ra = NULL;
+    }
+}
+
+static void stop_render_ahead(struct sd *sd)
+{
+    struct sd_ass_priv *ctx = sd->priv;
+    struct render_ahead *ra = ctx->ra;
+    if (!ra)
+        return;
+
+    pthread_mutex_lock(&ra->lock);
+    ra->terminate = true;
+    pthread_cond_broadcast(&ra->wakeup);
+    pthread_mutex_unlock(&ra->lock);
+    pthread_join(ra->thread, NULL);
+
+    // Add packets that arrived late, in case the track is shared.
+    apply_pending(sd);
+    while (ra->num_cache)
+        remove_frame(ra, 0, true);
+    talloc_free(ra->cur);
+
+    pthread_cond_destroy(&ra->wakeup);
+    pthread_mutex_destroy(&ra->lock);
+    pthread_mutex_destroy(&ra->track_lock);
+    talloc_free(ra);
+    ctx->ra = NULL;
+}
+
+// Returns false if the render-ahead thread can't render anything; the caller
+// has to fall back to rendering synchronously then.
+static bool get_bitmaps_ahead(struct sd *sd, struct render_params *params,
+                              long long ipts, struct sub_bitmaps *res)
+{
+    struct sd_ass_priv *ctx = sd->priv;
+    struct render_ahead *ra = ctx->ra;
+
+    pthread_mutex_lock(&ra->lock);
+    ra->params = *params;
+    struct ass_frame *frame;
+    while (!(frame = find_frame(ra, ipts, params, true)) && !ra->failed) {
+        if (!ra->want || ra->want_ipts != ipts) {
+            ra->want = true;
+            ra->want_ipts = ipts;
+            pthread_cond_broadcast(&ra->wakeup);
+        }
+        pthread_cond_wait(&ra->wakeup, &ra->lock);
+    }
+    if (frame && frame != ra->cur) {
+        for (int n = 0; n < ra->num_cache; n++) {
+            if (ra->cache[n] == frame) {
+                remove_frame(ra, n, false);
+                break;
+            }
+        }
+        int change = compare_frames(ra->cur, frame);
+        res->bitmap_id = change == 2;
+        res->bitmap_pos_id = change >= 1;
+        talloc_free(ra->cur);
+        ra->cur = frame;
+    }
+    // Frames for the past are useless for normal playback.
+    for (int n = ra->num_cache - 1; n >= 0; n--) {
+        if (ra->cache[n]->valid_max < ipts)
+            remove_frame(ra, n, true);
+    }
+    bool failed = ra->failed;
+    pthread_mutex_unlock(&ra->lock);
+
+    if (!frame)
+        return !failed;
+
+    // Copy, because mangle_colors() changes the colors.
+    res->format = SUBBITMAP_LIBASS;
+    res->num_parts = frame->num_parts;
+    ctx->parts = talloc_realloc(ctx, ctx->parts, struct sub_bitmap,
+                                frame->num_parts);
+    memcpy(ctx->parts, frame->parts, frame->num_parts * sizeof(ctx->parts[0]));
+    res->parts = ctx->parts;
+    return true;
+}
+
+static void get_bitmaps(struct sd *sd, struct mp_osd_res dim, double pts,
+                        struct sub_bitmaps *res)
+{
+    struct sd_ass_priv *ctx = sd->priv;
+    struct MPOpts *opts = sd->opts;
+
+    if (pts == MP_NOPTS_VALUE || !sd->ass_renderer)
+        return;
+
+    if (opts->ass_render_ahead > 0 && !ctx->ra && !ctx->ra_failed)
+        start_render_ahead(sd);
+
+    struct render_params params;
+    get_render_params(sd, dim, &params);
+    long long ipts = pts * 1000 + .5;
+
+    if (ctx->ra && !get_bitmaps_ahead(sd, &params, ipts, res)) {
+        MP_WARN(sd, "Disabling subtitle render-ahead.\n");
+        stop_render_ahead(sd);
+        ctx->ra_failed = true;
+        ctx->rendered_empty = false;
+    }
+
+    if (!ctx->ra) {
+        // libass walks all events on every frame. Skip it if nothing is
+        // visible, and the previous frame was empty as well (so libass'
+        // change detection is still correct when the next event starts).
+        int *ids;
+        bool empty = !event_index_query(get_index(sd), ipts, ipts + 1, &ids);
+        if (empty && ctx->rendered_empty) {
+            res->format = SUBBITMAP_LIBASS;
+            res->parts = ctx->parts;
+            res->num_parts = 0;
+            return;
+        }
+        ASS_Renderer *renderer = sd->ass_renderer;
+        configure_renderer(renderer, &params);
+        mp_ass_render_frame(renderer, ctx->ass_track, ipts, &ctx->parts, res);
+        talloc_steal(ctx, ctx->parts);
+        ctx->rendered_empty = empty;
+    }
 
     if (!ctx->is_converted)
         mangle_colors(sd, res);
@@ -237,23 +768,31 @@ static char *get_text(struct sd *sd, double pts)
         return NULL;
     long long ipts = pts * 1000 + 0.5;
 
+    if (ctx->ra) {
+        pthread_mutex_lock(&ctx->ra->track_lock);
+        apply_pending(sd);
+    }
+
     struct buf b = {ctx->last_text, sizeof(ctx->last_text) - 1};
 
-    for (int i = 0; i < track->n_events; ++i) {
-        ASS_Event *event = track->events + i;
-        if (ipts >= event->Start && ipts < event->Start + event->Duration) {
-            if (event->Text) {
-                int start = b.len;
-                ass_to_plaintext(&b, event->Text);
-                if (is_whitespace_only(&b.start[start], b.len - start)) {
-                    b.len = start;
-                } else {
-                    append(&b, '\n');
-                }
+    int *ids;
+    int num = event_index_query(get_index(sd), ipts, ipts + 1, &ids);
+    for (int n = 0; n < num; n++) {
+        ASS_Event *event = track->events + ids[n];
+        if (event->Text) {
+            int start = b.len;
+            ass_to_plaintext(&b, event->Text);
+            if (is_whitespace_only(&b.start[start], b.len - start)) {
+                b.len = start;
+            } else {
+                append(&b, '\n');
             }
         }
     }
 
+    if (ctx->ra)
+        pthread_mutex_unlock(&ctx->ra->track_lock);
+
     b.start[b.len] = '\0';
 
     if (b.len > 0 && b.start[b.len - 1] == '\n')
@@ -271,8 +810,22 @@ static void fix_events(struct sd *sd)
 static void reset(struct sd *sd)
 {
     struct sd_ass_priv *ctx = sd->priv;
-    if (ctx->flush_on_seek)
-        ass_flush_events(ctx->ass_track);
+    struct render_ahead *ra = ctx->ra;
+    if (ra) {
+        pthread_mutex_lock(&ra->lock);
+        if (ctx->flush_on_seek) {
+            talloc_free(ra->pending);
+            ra->pending = NULL;
+            ra->num_pending = 0;
+            ra->flush = true;
+            ra->gen++;
+            invalidate_frames(ra, LLONG_MIN, LLONG_MAX);
+        }
+        ra->num_ahead = 0;
+        pthread_mutex_unlock(&ra->lock);
+    } else if (ctx->flush_on_seek) {
+        flush_events(sd);
+    }
     ctx->flush_on_seek = false;
 }
 
@@ -280,6 +833,7 @@ static void uninit(struct sd *sd)
 {
     struct sd_ass_priv *ctx = sd->priv;
 
+    stop_render_ahead(sd);
     if (sd->ass_track != ctx->ass_track)
         ass_free_track(ctx->ass_track);
     talloc_free(ctx);
@@ -291,7 +845,13 @@ static int control(struct sd *sd, enum sd_ctrl cmd, void *arg)
     switch (cmd) {
     case SD_CTRL_SUB_STEP: {
         double *a = arg;
-        long long res = ass_step_sub(ctx->ass_track, a[0] * 1000 + 0.5, a[1]);
+        if (ctx->ra) {
+            pthread_mutex_lock(&ctx->ra->track_lock);
+            apply_pending(sd);
+        }
+        long long res = event_index_step(get_index(sd), a[0] * 1000 + 0.5, a[1]);
+        if (ctx->ra)
+            pthread_mutex_unlock(&ctx->ra->track_lock);
         if (!res)
             return false;
         a[0] = res / 1000.0;
@@ -299,6 +859,20 @@ static int control(struct sd *sd, enum sd_ctrl cmd, void *arg)
     case SD_CTRL_SET_VIDEO_PARAMS:
         ctx->video_params = *(struct mp_image_params *)arg;
         return CONTROL_OK;
+    case SD_CTRL_RENDER_AHEAD: {
+        struct render_ahead *ra = ctx->ra;
+        if (!ra)
+            return CONTROL_OK;
+        double *a = arg;
+        int num = MPMIN(sd->opts->ass_render_ahead, MAX_RENDER_AHEAD);
+        pthread_mutex_lock(&ra->lock);
+        ra->num_ahead = 0;
+        for (int n = 0; n < num && (n == 0 || a[1] > 0); n++)
+            ra->ahead[ra->num_ahead++] = (a[0] + n * a[1]) * 1000 + 0.5;
+        pthread_cond_broadcast(&ra->wakeup);
+        pthread_mutex_unlock(&ra->lock);
+        return CONTROL_OK;
+    }
     }
     default:
         return CONTROL_UNKNOWN;
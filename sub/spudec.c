@@ -49,9 +49,7 @@
 
 typedef struct spu_packet_t packet_t;
 struct spu_packet_t {
-  int is_decoded;
   unsigned char *packet;
-  int data_len;
   unsigned int palette[4];
   unsigned int alpha[4];
   unsigned int control_start;	/* index of start of control data */
@@ -86,11 +84,10 @@ typedef struct {
   unsigned int start_col;
   unsigned int start_row;
   unsigned int width, height, stride;
-  size_t image_size;		/* Size of the image buffer */
-  unsigned char *image;		/* Grayscale value */
   unsigned int pal_start_col, pal_start_row;
   unsigned int pal_width, pal_height;
   unsigned char *pal_image;	/* palette entry value */
+  size_t pal_image_size;	/* size of the pal_image buffer */
   int auto_palette; /* 1 if we lack a palette and must use an heuristic. */
   int font_start_level;  /* Darkest value used for the computed font */
   int spu_changed;
@@ -161,29 +158,46 @@ static inline unsigned char get_nibble(spudec_handle_t *this, packet_t *packet)
   return nib;
 }
 
+/* Read a whole RLE code of the current field. Codes are 4, 8, 12 or 16 bits
+   long; the length follows from the number of leading zero bits, so it can
+   be determined from a 16 bit window at once. */
+static inline unsigned int get_rle_code(spudec_handle_t *this, packet_t *packet)
+{
+  unsigned int *nibblep = packet->current_nibble + packet->deinterlace_oddness;
+  unsigned int pos = *nibblep / 2;
+  if (pos + 2 < packet->control_start) {
+    unsigned int v = (get_be24(packet->packet + pos) >> (*nibblep % 2 ? 4 : 8))
+                     & 0xffff;
+    unsigned int nibbles = v >= 0x4000 ? 1 : v >= 0x1000 ? 2 : v >= 0x0400 ? 3 : 4;
+    *nibblep += nibbles;
+    return v >> (16 - 4 * nibbles);
+  }
+  // Near the end of the data: read nibble by nibble, with bounds checks.
+  unsigned int rle = get_nibble(this, packet);
+  if (rle < 0x04) {
+    if (rle == 0) {
+      rle = (rle << 4) | get_nibble(this, packet);
+      if (rle < 0x04)
+        rle = (rle << 4) | get_nibble(this, packet);
+    }
+    rle = (rle << 4) | get_nibble(this, packet);
+  }
+  return rle;
+}
+
 static int spudec_alloc_image(spudec_handle_t *this, int stride, int height)
 {
   if (this->width > stride) // just a safeguard
     this->width = stride;
   this->stride = stride;
   this->height = height;
-  if (this->image_size < this->stride * this->height) {
-    if (this->image != NULL) {
-      free(this->image);
-      this->image = NULL;
-      free(this->pal_image);
-      this->pal_image = NULL;
-      this->image_size = 0;
-      this->pal_width = this->pal_height  = 0;
-    }
-    this->image = malloc(2 * this->stride * this->height);
-    if (this->image) {
-      this->image_size = this->stride * this->height;
-      // use stride here as well to simplify reallocation checks
-      this->pal_image = malloc(this->stride * this->height);
-    }
+  // use stride here as well to simplify reallocation checks
+  if (this->pal_image_size < this->stride * this->height) {
+    free(this->pal_image);
+    this->pal_image = malloc(this->stride * this->height);
+    this->pal_image_size = this->pal_image ? this->stride * this->height : 0;
   }
-  return this->image != NULL;
+  return this->pal_image != NULL;
 }
 
 static void setup_palette(spudec_handle_t *spu, uint32_t palette[256])
@@ -209,46 +223,6 @@ static void setup_palette(spudec_handle_t *spu, uint32_t palette[256])
     }
 }
 
-static void crop_image(struct sub_bitmap *part)
-{
-    if (part->w < 1 || part->h < 1)
-        return;
-    struct osd_bmp_indexed *bmp = part->bitmap;
-    bool invisible[256];
-    for (int n = 0; n < 256; n++)
-        invisible[n] = !(bmp->palette[n] >> 24);
-    int y0 = 0, y1 = part->h, x0 = part->w, x1 = 0;
-    bool y_all_invisible = true;
-    for (int y = 0; y < part->h; y++) {
-        uint8_t *pixels = bmp->bitmap + part->stride * y;
-        int cur = 0;
-        while (cur < part->w && invisible[pixels[cur]])
-            cur++;
-        int start_visible = cur;
-        int last_visible = -1;
-        while (cur < part->w) {
-            if (!invisible[pixels[cur]])
-                last_visible = cur;
-            cur++;
-        }
-        x0 = FFMIN(x0, start_visible);
-        x1 = FFMAX(x1, last_visible);
-        bool all_invisible = last_visible == -1;
-        if (all_invisible) {
-            if (y_all_invisible)
-                y0 = y;
-        } else {
-            y_all_invisible = false;
-            y1 = y + 1;
-        }
-    }
-    bmp->bitmap += x0 + y0 * part->stride;
-    part->w = FFMAX(x1 - x0, 0);
-    part->h = FFMAX(y1 - y0, 0);
-    part->x += x0;
-    part->y += y0;
-}
-
 static void spudec_process_data(spudec_handle_t *this, packet_t *packet)
 {
   unsigned int i, x, y;
@@ -265,6 +239,15 @@ static void spudec_process_data(spudec_handle_t *this, packet_t *packet)
   memcpy(this->palette, packet->palette, sizeof(this->palette));
   memcpy(this->alpha,   packet->alpha,   sizeof(this->alpha));
 
+  struct osd_bmp_indexed *bmp = &this->borrowed_bmp;
+  setup_palette(this, bmp->palette);
+  bool visible[4];
+  for (i = 0; i < 4; i++)
+    visible[i] = bmp->palette[i] >> 24;
+
+  // Bounding box of the visible pixels, used to crop the bitmap.
+  unsigned int x0 = this->pal_width, x1 = 0, y0 = this->pal_height, y1 = 0;
+
   i = packet->current_nibble[1];
   x = 0;
   y = 0;
@@ -272,41 +255,43 @@ static void spudec_process_data(spudec_handle_t *this, packet_t *packet)
   while (packet->current_nibble[0] < i
 	 && packet->current_nibble[1] / 2 < packet->control_start
 	 && y < this->pal_height) {
-    unsigned int len, color;
-    unsigned int rle = 0;
-    rle = get_nibble(this, packet);
-    if (rle < 0x04) {
-      if (rle == 0) {
-	rle = (rle << 4) | get_nibble(this, packet);
-	if (rle < 0x04)
-	  rle = (rle << 4) | get_nibble(this, packet);
-      }
-      rle = (rle << 4) | get_nibble(this, packet);
+    unsigned int rle = get_rle_code(this, packet);
+    unsigned int color = 3 - (rle & 0x3);
+    unsigned int len = rle >> 2;
+    bool end_of_line = len == 0 || x + len >= this->pal_width;
+    if (end_of_line)
+      len = this->pal_width - x;
+    if (visible[color] && len) {
+      x0 = FFMIN(x0, x);
+      x1 = FFMAX(x1, x + len);
+      y0 = FFMIN(y0, y);
+      y1 = y + 1;
     }
-    color = 3 - (rle & 0x3);
-    len = rle >> 2;
+    memset(dst, color, len);
+    dst += len;
     x += len;
-    if (len == 0 || x >= this->pal_width) {
-      len += this->pal_width - x;
+    if (end_of_line) {
       next_line(packet);
       x = 0;
       ++y;
     }
-    memset(dst, color, len);
-    dst += len;
   }
+  // Truncated data: don't leave the rest uninitialized.
+  memset(dst, 0, this->pal_image + this->pal_width * this->pal_height - dst);
 
   struct sub_bitmap *sub_part = &this->sub_part;
-  struct osd_bmp_indexed *bmp = &this->borrowed_bmp;
-  bmp->bitmap = this->pal_image;
-  setup_palette(this, bmp->palette);
   sub_part->bitmap = bmp;
   sub_part->stride = this->pal_width;
-  sub_part->w = this->pal_width;
-  sub_part->h = this->pal_height;
+  sub_part->w = x1 > x0 ? x1 - x0 : 0;
+  sub_part->h = y1 > y0 ? y1 - y0 : 0;
   sub_part->x = this->pal_start_col;
   sub_part->y = this->pal_start_row;
-  crop_image(sub_part);
+  bmp->bitmap = this->pal_image;
+  if (sub_part->w && sub_part->h) {
+    bmp->bitmap += x0 + y0 * sub_part->stride;
+    sub_part->x += x0;
+    sub_part->y += y0;
+  }
 }
 
 
@@ -605,21 +590,9 @@ void spudec_heartbeat(void *this, unsigned int pts100)
     packet_t *packet = spudec_dequeue_packet(spu);
     spu->start_pts = packet->start_pts;
     spu->end_pts = packet->end_pts;
-    if (packet->is_decoded) {
-      free(spu->image);
-      spu->image_size = packet->data_len;
-      spu->image      = packet->packet;
-      packet->packet  = NULL;
-      spu->width      = packet->width;
-      spu->height     = packet->height;
-      spu->stride     = packet->stride;
-      spu->start_col  = packet->start_col;
-      spu->start_row  = packet->start_row;
-    } else {
-      if (spu->auto_palette)
-        compute_palette(spu, packet);
-      spudec_process_data(spu, packet);
-    }
+    if (spu->auto_palette)
+      compute_palette(spu, packet);
+    spudec_process_data(spu, packet);
     spudec_free_packet(packet);
     spudec_set_changed(spu);
   }
@@ -788,11 +761,9 @@ void spudec_free(void *this)
       spudec_free_packet(spudec_dequeue_packet(spu));
     free(spu->packet);
     spu->packet = NULL;
-    free(spu->image);
-    spu->image = NULL;
     free(spu->pal_image);
     spu->pal_image = NULL;
-    spu->image_size = 0;
+    spu->pal_image_size = 0;
     spu->pal_width = spu->pal_height  = 0;
     free(spu);
   }
@@ -212,6 +212,58 @@ static int var_y_mmx(unsigned char *a, unsigned char *b, int s)
 #endif
 #endif
 
+#if HAVE_X86_INTRINSICS
+#include <immintrin.h>
+
+/* Two 8 pixel rows packed into one register. */
+#define LOAD2(p, s) _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(p)), \
+                                       _mm_loadl_epi64((const __m128i *)((p)+(s))))
+
+__attribute__((target("sse2")))
+static int diff_y_sse2(unsigned char *a, unsigned char *b, int s)
+{
+	__m128i sum = _mm_add_epi64(_mm_sad_epu8(LOAD2(a, s), LOAD2(b, s)),
+				    _mm_sad_epu8(LOAD2(a+2*s, s), LOAD2(b+2*s, s)));
+	sum = _mm_add_epi64(sum, _mm_srli_si128(sum, 8));
+	return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("sse2")))
+static int licomb_y_sse2(unsigned char *a, unsigned char *b, int s)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i sum = zero;
+	int i;
+#define LOAD8(p) _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p)), zero)
+#define ABS16(x) _mm_max_epi16(x, _mm_sub_epi16(zero, x))
+	for (i=4; i; i--) {
+		__m128i va = LOAD8(a), vb = LOAD8(b);
+		__m128i t1 = _mm_sub_epi16(_mm_sub_epi16(_mm_add_epi16(va, va), LOAD8(b-s)), vb);
+		__m128i t2 = _mm_sub_epi16(_mm_sub_epi16(_mm_add_epi16(vb, vb), va), LOAD8(a+s));
+		sum = _mm_add_epi16(sum, _mm_add_epi16(ABS16(t1), ABS16(t2)));
+		a+=s; b+=s;
+	}
+#undef LOAD8
+#undef ABS16
+	sum = _mm_madd_epi16(sum, _mm_set1_epi16(1));
+	sum = _mm_add_epi32(sum, _mm_srli_si128(sum, 8));
+	sum = _mm_add_epi32(sum, _mm_srli_si128(sum, 4));
+	return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("sse2")))
+static int var_y_sse2(unsigned char *a, unsigned char *b, int s)
+{
+	__m128i sum = _mm_add_epi64(_mm_sad_epu8(LOAD2(a, s), LOAD2(a+s, s)),
+				    _mm_sad_epu8(_mm_loadl_epi64((const __m128i *)(a+2*s)),
+						 _mm_loadl_epi64((const __m128i *)(a+3*s))));
+	sum = _mm_add_epi64(sum, _mm_srli_si128(sum, 8));
+	return 4*_mm_cvtsi128_si32(sum); /* match comb scaling */
+}
+
+#undef LOAD2
+#endif
+
 #define ABS(a) (((a)^((a)>>31))-((a)>>31))
 
 static int diff_y(unsigned char *a, unsigned char *b, int s)
@@ -786,6 +838,13 @@ void pullup_init_context(struct pullup_context *c)
 			c->var = var_y_mmx;
 		}
 #endif
+#if HAVE_X86_INTRINSICS
+		if (c->cpu & PULLUP_CPU_SSE2) {
+			c->diff = diff_y_sse2;
+			c->comb = licomb_y_sse2;
+			c->var = var_y_sse2;
+		}
+#endif
 #endif
 		/* c->comb = qpcomb_y; */
 		break;
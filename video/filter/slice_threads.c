@@ -0,0 +1,160 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <pthread.h>
+#include <assert.h>
+
+#include "talloc.h"
+
+#include "common/common.h"
+#include "osdep/numcores.h"
+
+#include "slice_threads.h"
+
+// Some filters allocate scratch buffers per slice, so don't go overboard.
+#define MAX_SLICE_THREADS 16
+
+struct mp_slice_threads {
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;      // new work, or termination
+    pthread_cond_t done;        // a slice was finished
+
+    pthread_t *workers;
+    int num_workers;            // the caller of _run is an additional thread
+    bool terminate;
+
+    // Current job (protected by lock)
+    void (*fn)(void *ctx, int slice);
+    void *ctx;
+    int num_slices;
+    int next_slice;
+    int slices_done;
+};
+
+// Take the next unprocessed slice of the current job and run it. Returns false
+// if there was no slice left. Must be called with the lock held.
+static bool run_next_slice(struct mp_slice_threads *st)
+{
+    if (st->next_slice >= st->num_slices)
+        return false;
+    int slice = st->next_slice++;
+    pthread_mutex_unlock(&st->lock);
+    st->fn(st->ctx, slice);
+    pthread_mutex_lock(&st->lock);
+    st->slices_done++;
+    if (st->slices_done == st->num_slices)
+        pthread_cond_broadcast(&st->done);
+    return true;
+}
+
+static void *worker_thread(void *arg)
+{
+    struct mp_slice_threads *st = arg;
+    pthread_mutex_lock(&st->lock);
+    while (!st->terminate) {
+        if (!run_next_slice(st))
+            pthread_cond_wait(&st->wakeup, &st->lock);
+    }
+    pthread_mutex_unlock(&st->lock);
+    return NULL;
+}
+
+static void destroy_slice_threads(void *ptr)
+{
+    struct mp_slice_threads *st = ptr;
+    pthread_mutex_lock(&st->lock);
+    st->terminate = true;
+    pthread_cond_broadcast(&st->wakeup);
+    pthread_mutex_unlock(&st->lock);
+    for (int n = 0; n < st->num_workers; n++)
+        pthread_join(st->workers[n], NULL);
+    pthread_cond_destroy(&st->done);
+    pthread_cond_destroy(&st->wakeup);
+    pthread_mutex_destroy(&st->lock);
+}
+
+// Create a thread pool with num_threads threads in total (including the thread
+// calling mp_slice_threads_run()). If num_threads is <= 0, use the number of
+// CPU cores. Freeing the returned object with talloc_free() stops the threads.
+struct mp_slice_threads *mp_slice_threads_create(void *ta_parent,
+                                                 int num_threads)
+{
+    if (num_threads <= 0)
+        num_threads = default_thread_count();
+    num_threads = MPCLAMP(num_threads, 1, MAX_SLICE_THREADS);
+
+    struct mp_slice_threads *st = talloc_zero(ta_parent, struct mp_slice_threads);
+    pthread_mutex_init(&st->lock, NULL);
+    pthread_cond_init(&st->wakeup, NULL);
+    pthread_cond_init(&st->done, NULL);
+    talloc_set_destructor(st, destroy_slice_threads);
+
+    st->workers = talloc_array(st, pthread_t, num_threads - 1);
+    for (int n = 0; n < num_threads - 1; n++) {
+        if (pthread_create(&st->workers[st->num_workers], NULL, worker_thread, st))
+            break;
+        st->num_workers++;
+    }
+    return st;
+}
+
+// Number of slices that can be processed concurrently. Filters should usually
+// split planes into this many slices.
+int mp_slice_threads_num(struct mp_slice_threads *st)
+{
+    return st->num_workers + 1;
+}
+
+// Call fn(ctx, slice) for each slice in [0, num_slices), distributed over all
+// threads, and return after all calls have finished. The calls for different
+// slices can run concurrently, and in any order.
+void mp_slice_threads_run(struct mp_slice_threads *st, int num_slices,
+                          void (*fn)(void *ctx, int slice), void *ctx)
+{
+    if (!st->num_workers || num_slices < 2) {
+        for (int n = 0; n < num_slices; n++)
+            fn(ctx, n);
+        return;
+    }
+
+    pthread_mutex_lock(&st->lock);
+    assert(st->next_slice >= st->num_slices); // not reentrant
+    st->fn = fn;
+    st->ctx = ctx;
+    st->num_slices = num_slices;
+    st->next_slice = 0;
+    st->slices_done = 0;
+    pthread_cond_broadcast(&st->wakeup);
+    while (run_next_slice(st)) {}
+    while (st->slices_done < st->num_slices)
+        pthread_cond_wait(&st->done, &st->lock);
+    pthread_mutex_unlock(&st->lock);
+}
+
+// Return the range of lines [*y0, *y1) covered by the given slice, if height
+// lines are split into num_slices slices. Slice boundaries are aligned to
+// multiples of align (a power of 2; useful for chroma subsampling, or filters
+// which process pairs of lines). Slices at the bottom can be empty.
+void mp_slice_get_range(int height, int num_slices, int slice, int align,
+                        int *y0, int *y1)
+{
+    int lines = (height + num_slices - 1) / num_slices;
+    lines = MP_ALIGN_UP(lines, align);
+    *y0 = MPMIN(lines * slice, height);
+    *y1 = MPMIN(lines * (slice + 1), height);
+}
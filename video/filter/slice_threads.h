@@ -0,0 +1,35 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MP_SLICE_THREADS_H_
+#define MP_SLICE_THREADS_H_
+
+// Helper for filters which process image planes in horizontal bands (slices)
+// on multiple threads.
+struct mp_slice_threads;
+
+struct mp_slice_threads *mp_slice_threads_create(void *ta_parent,
+                                                 int num_threads);
+int mp_slice_threads_num(struct mp_slice_threads *st);
+void mp_slice_threads_run(struct mp_slice_threads *st, int num_slices,
+                          void (*fn)(void *ctx, int slice), void *ctx);
+
+void mp_slice_get_range(int height, int num_slices, int slice, int align,
+                        int *y0, int *y1);
+
+#endif
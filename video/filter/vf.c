@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <libavutil/common.h>
 #include <libavutil/mem.h>
@@ -138,20 +139,6 @@ const struct m_obj_list vf_obj_list = {
     .description = "video filters",
 };
 
-// Try the cmd on each filter (starting with the first), and stop at the first
-// filter which does not return CONTROL_UNKNOWN for it.
-int vf_control_any(struct vf_chain *c, int cmd, void *arg)
-{
-    for (struct vf_instance *cur = c->first; cur; cur = cur->next) {
-        if (cur->control) {
-            int r = cur->control(cur, cmd, arg);
-            if (r != CONTROL_UNKNOWN)
-                return r;
-        }
-    }
-    return CONTROL_UNKNOWN;
-}
-
 static void vf_fix_img_params(struct mp_image *img, struct mp_image_params *p)
 {
     // Filters must absolutely set these correctly.
@@ -334,6 +321,303 @@ static int vf_do_filter(struct vf_instance *vf, struct mp_image *img)
     }
 }
 
+static void vf_forget_frames(struct vf_instance *vf)
+{
+    for (int n = 0; n < vf->num_out_queued; n++)
+        talloc_free(vf->out_queued[n]);
+    vf->num_out_queued = 0;
+}
+
+//============================================================================
+// Pipelined filter execution (--vf-pipeline)
+//
+// Each real filter runs on its own thread. The filters are connected by small
+// FIFOs; a stage takes its input from its own queue, and appends its output to
+// the queue of the next stage (or the chain output queue for the last stage).
+// Frame order is preserved, because each stage processes its frames strictly
+// in order, and the queues are FIFOs.
+
+// Soft limit for the number of frames waiting in each queue. A filter call
+// can produce multiple output frames, so this can be exceeded temporarily.
+#define PIPELINE_QUEUE_SIZE 2
+
+struct vf_pipeline_stage {
+    struct vf_pipeline *p;
+    struct vf_instance *vf;
+    pthread_t thread;
+    bool thread_valid;
+
+    // Serializes filter callbacks running on the stage thread with control
+    // requests coming from the thread owning the filter chain.
+    pthread_mutex_t filter_lock;
+
+    // Protected by vf_pipeline.lock.
+    struct mp_image **queue;
+    int num_queue;
+    bool busy;              // filter is processing a frame
+};
+
+struct vf_pipeline {
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+
+    struct vf_pipeline_stage *stages;
+    int num_stages;
+
+    // All following fields are protected by lock.
+    struct mp_image **out;  // output of the last stage
+    int num_out;
+    int64_t generation;     // incremented on seek resets
+    bool terminate;
+};
+
+static int *stage_next_queue_count(struct vf_pipeline_stage *s)
+{
+    struct vf_pipeline *p = s->p;
+    int index = s - p->stages;
+    if (index + 1 < p->num_stages)
+        return &p->stages[index + 1].num_queue;
+    return &p->num_out;
+}
+
+static void stage_append_output(struct vf_pipeline_stage *s,
+                                struct mp_image *img)
+{
+    struct vf_pipeline *p = s->p;
+    int index = s - p->stages;
+    if (index + 1 < p->num_stages) {
+        struct vf_pipeline_stage *next = &p->stages[index + 1];
+        MP_TARRAY_APPEND(p, next->queue, next->num_queue, img);
+    } else {
+        MP_TARRAY_APPEND(p, p->out, p->num_out, img);
+    }
+}
+
+static void *stage_thread(void *arg)
+{
+    struct vf_pipeline_stage *s = arg;
+    struct vf_pipeline *p = s->p;
+
+    pthread_mutex_lock(&p->lock);
+    while (!p->terminate) {
+        if (!s->num_queue ||
+            *stage_next_queue_count(s) >= PIPELINE_QUEUE_SIZE)
+        {
+            pthread_cond_wait(&p->wakeup, &p->lock);
+            continue;
+        }
+        struct mp_image *img = s->queue[0];
+        MP_TARRAY_REMOVE_AT(s->queue, s->num_queue, 0);
+        int64_t generation = p->generation;
+        s->busy = true;
+        pthread_cond_broadcast(&p->wakeup);
+        pthread_mutex_unlock(&p->lock);
+
+        pthread_mutex_lock(&s->filter_lock);
+        vf_do_filter(s->vf, img);
+        pthread_mutex_unlock(&s->filter_lock);
+
+        pthread_mutex_lock(&p->lock);
+        // The output queue of the filter is accessed by this thread only
+        // (and by the chain owner when no stage is busy).
+        for (int n = 0; n < s->vf->num_out_queued; n++) {
+            struct mp_image *out = s->vf->out_queued[n];
+            if (generation == p->generation) {
+                stage_append_output(s, out);
+            } else {
+                talloc_free(out);
+            }
+        }
+        s->vf->num_out_queued = 0;
+        s->busy = false;
+        pthread_cond_broadcast(&p->wakeup);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+static bool pipeline_is_idle(struct vf_pipeline *p)
+{
+    for (int n = 0; n < p->num_stages; n++) {
+        if (p->stages[n].num_queue || p->stages[n].busy)
+            return false;
+    }
+    return true;
+}
+
+// Free all frames queued between the stages. Locking is up to the caller.
+static void pipeline_flush(struct vf_pipeline *p)
+{
+    for (int n = 0; n < p->num_stages; n++) {
+        struct vf_pipeline_stage *s = &p->stages[n];
+        for (int i = 0; i < s->num_queue; i++)
+            talloc_free(s->queue[i]);
+        s->num_queue = 0;
+    }
+    for (int n = 0; n < p->num_out; n++)
+        talloc_free(p->out[n]);
+    p->num_out = 0;
+}
+
+static void pipeline_destroy(struct vf_chain *c)
+{
+    struct vf_pipeline *p = c->pipeline;
+    if (!p)
+        return;
+    pthread_mutex_lock(&p->lock);
+    p->terminate = true;
+    pthread_cond_broadcast(&p->wakeup);
+    pthread_mutex_unlock(&p->lock);
+    for (int n = 0; n < p->num_stages; n++) {
+        struct vf_pipeline_stage *s = &p->stages[n];
+        if (s->thread_valid)
+            pthread_join(s->thread, NULL);
+        pthread_mutex_destroy(&s->filter_lock);
+        vf_forget_frames(s->vf);
+    }
+    pipeline_flush(p);
+    pthread_cond_destroy(&p->wakeup);
+    pthread_mutex_destroy(&p->lock);
+    talloc_free(p);
+    c->pipeline = NULL;
+}
+
+static bool pipeline_can_run(struct vf_chain *c)
+{
+    if (!c->opts->vf_pipeline || c->first->next == c->last)
+        return false;
+    if (IMGFMT_IS_HWACCEL(c->first->fmt_in.imgfmt))
+        return false;
+    for (struct vf_instance *vf = c->first->next; vf != c->last; vf = vf->next)
+    {
+        if (vf->no_pipeline) {
+            MP_VERBOSE(c, "Filter '%s' can't be pipelined.\n", vf->info->name);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Create the stage threads for the current (configured) filter chain.
+static void pipeline_create(struct vf_chain *c)
+{
+    assert(!c->pipeline);
+    struct vf_pipeline *p = talloc_zero(NULL, struct vf_pipeline);
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wakeup, NULL);
+    for (struct vf_instance *vf = c->first->next; vf != c->last; vf = vf->next)
+        p->num_stages++;
+    p->stages = talloc_zero_array(p, struct vf_pipeline_stage, p->num_stages);
+    struct vf_instance *vf = c->first->next;
+    for (int n = 0; n < p->num_stages; n++) {
+        struct vf_pipeline_stage *s = &p->stages[n];
+        s->p = p;
+        s->vf = vf;
+        pthread_mutex_init(&s->filter_lock, NULL);
+        vf = vf->next;
+    }
+    c->pipeline = p;
+    for (int n = 0; n < p->num_stages; n++) {
+        struct vf_pipeline_stage *s = &p->stages[n];
+        if (pthread_create(&s->thread, NULL, stage_thread, s)) {
+            MP_ERR(c, "Could not create filter thread, disabling "
+                   "pipelining.\n");
+            pipeline_destroy(c);
+            return;
+        }
+        s->thread_valid = true;
+    }
+    MP_VERBOSE(c, "Running filter chain with %d threads.\n", p->num_stages);
+}
+
+static struct vf_pipeline_stage *pipeline_find_stage(struct vf_chain *c,
+                                                     struct vf_instance *vf)
+{
+    struct vf_pipeline *p = c->pipeline;
+    for (int n = 0; p && n < p->num_stages; n++) {
+        if (p->stages[n].vf == vf)
+            return &p->stages[n];
+    }
+    return NULL;
+}
+
+static void pipeline_filter_frame(struct vf_chain *c, struct mp_image *img)
+{
+    struct vf_pipeline *p = c->pipeline;
+    struct vf_pipeline_stage *first = &p->stages[0];
+    pthread_mutex_lock(&p->lock);
+    // Waiting is done only if there is no output, because the caller is the
+    // only one who can drain the output queue.
+    while (first->num_queue >= PIPELINE_QUEUE_SIZE && !p->num_out)
+        pthread_cond_wait(&p->wakeup, &p->lock);
+    MP_TARRAY_APPEND(p, first->queue, first->num_queue, img);
+    pthread_cond_broadcast(&p->wakeup);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static struct mp_image *pipeline_output_frame(struct vf_chain *c)
+{
+    struct vf_pipeline *p = c->pipeline;
+    struct mp_image *img = NULL;
+    pthread_mutex_lock(&p->lock);
+    if (p->num_out) {
+        img = p->out[0];
+        MP_TARRAY_REMOVE_AT(p->out, p->num_out, 0);
+        pthread_cond_broadcast(&p->wakeup);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return img;
+}
+
+static void pipeline_seek_reset(struct vf_chain *c)
+{
+    struct vf_pipeline *p = c->pipeline;
+    pthread_mutex_lock(&p->lock);
+    p->generation++;
+    pipeline_flush(p);
+    pthread_cond_broadcast(&p->wakeup);
+    // Frames which are being filtered right now will be discarded, but make
+    // sure they are not fed into the filter after it has been reset.
+    while (!pipeline_is_idle(p))
+        pthread_cond_wait(&p->wakeup, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Block until the filter chain has either output a frame, or all frames passed
+// to vf_filter_frame() have been fully processed. This is needed on EOF to
+// drain the filter threads. Does nothing if pipelining is not enabled.
+void vf_wait_queued_frame(struct vf_chain *c)
+{
+    struct vf_pipeline *p = c->pipeline;
+    if (!p)
+        return;
+    pthread_mutex_lock(&p->lock);
+    while (!p->num_out && !pipeline_is_idle(p))
+        pthread_cond_wait(&p->wakeup, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+}
+
+//============================================================================
+
+// Try the cmd on each filter (starting with the first), and stop at the first
+// filter which does not return CONTROL_UNKNOWN for it.
+int vf_control_any(struct vf_chain *c, int cmd, void *arg)
+{
+    for (struct vf_instance *cur = c->first; cur; cur = cur->next) {
+        if (cur->control) {
+            struct vf_pipeline_stage *s = pipeline_find_stage(c, cur);
+            if (s)
+                pthread_mutex_lock(&s->filter_lock);
+            int r = cur->control(cur, cmd, arg);
+            if (s)
+                pthread_mutex_unlock(&s->filter_lock);
+            if (r != CONTROL_UNKNOWN)
+                return r;
+        }
+    }
+    return CONTROL_UNKNOWN;
+}
+
 // Input a frame into the filter chain. Ownership of img is transferred.
 // Return >= 0 on success, < 0 on failure (even if output frames were produced)
 int vf_filter_frame(struct vf_chain *c, struct mp_image *img)
@@ -342,6 +626,19 @@ int vf_filter_frame(struct vf_chain *c, struct mp_image *img)
         talloc_free(img);
         return -1;
     }
+    if (!c->pipeline_checked) {
+        c->pipeline_checked = true;
+        if (pipeline_can_run(c))
+            pipeline_create(c);
+    }
+    if (c->pipeline) {
+        // Let the "in" pseudo-filter apply the image params.
+        vf_do_filter(c->first, img);
+        img = vf_dequeue_output_frame(c->first);
+        if (img)
+            pipeline_filter_frame(c, img);
+        return 0;
+    }
     return vf_do_filter(c->first, img);
 }
 
@@ -350,6 +647,13 @@ struct mp_image *vf_output_queued_frame(struct vf_chain *c)
 {
     if (c->initialized < 1)
         return NULL;
+    if (c->pipeline) {
+        struct mp_image *img = pipeline_output_frame(c);
+        if (!img)
+            return NULL;
+        vf_do_filter(c->last, img);
+        return vf_dequeue_output_frame(c->last);
+    }
     while (1) {
         struct vf_instance *last = NULL;
         for (struct vf_instance * cur = c->first; cur; cur = cur->next) {
@@ -365,15 +669,10 @@ struct mp_image *vf_output_queued_frame(struct vf_chain *c)
     }
 }
 
-static void vf_forget_frames(struct vf_instance *vf)
-{
-    for (int n = 0; n < vf->num_out_queued; n++)
-        talloc_free(vf->out_queued[n]);
-    vf->num_out_queued = 0;
-}
-
 void vf_seek_reset(struct vf_chain *c)
 {
+    if (c->pipeline)
+        pipeline_seek_reset(c);
     for (struct vf_instance *cur = c->first; cur; cur = cur->next) {
         if (cur->control)
             cur->control(cur, VFCTRL_SEEK_RESET, NULL);
@@ -492,6 +791,8 @@ int vf_reconfig(struct vf_chain *c, const struct mp_image_params *params)
 {
     struct mp_image_params cur = *params;
     int r = 0;
+    pipeline_destroy(c);
+    c->pipeline_checked = false;
     c->first->fmt_in = *params;
     uint8_t unused[IMGFMT_END - IMGFMT_START];
     update_formats(c, c->first, unused);
@@ -562,12 +863,13 @@ struct vf_chain *vf_new(struct mpv_global *global)
         .query_format = input_query_format,
     };
     static const struct vf_info out = { .name = "out" };
-    c->first->next = talloc(c, struct vf_instance);
-    *c->first->next = (struct vf_instance) {
+    c->last = talloc(c, struct vf_instance);
+    *c->last = (struct vf_instance) {
         .info = &out,
         .query_format = output_query_format,
         .priv = (void *)c,
     };
+    c->first->next = c->last;
     return c;
 }
 
@@ -575,6 +877,7 @@ void vf_destroy(struct vf_chain *c)
 {
     if (!c)
         return;
+    pipeline_destroy(c);
     while (c->first) {
         vf_instance_t *vf = c->first;
         c->first = vf->next;
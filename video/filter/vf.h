@@ -29,6 +29,7 @@
 struct MPOpts;
 struct mpv_global;
 struct vf_instance;
+struct vf_pipeline;
 struct vf_priv_s;
 struct m_obj_settings;
 
@@ -86,6 +87,11 @@ typedef struct vf_instance {
     struct mp_image **out_queued;
     int num_out_queued;
 
+    // Set by filters which access state shared with the player (like the
+    // OSD), and thus must run on the thread calling vf_filter_frame().
+    // This disables --vf-pipeline for the whole chain.
+    bool no_pipeline;
+
     // Caches valid output formats.
     uint8_t last_outfmts[IMGFMT_END - IMGFMT_START];
 
@@ -105,6 +111,11 @@ struct vf_chain {
     struct MPOpts *opts;
     struct mpv_global *global;
     struct mp_hwdec_info *hwdec;
+
+    // Worker threads if --vf-pipeline is active, NULL otherwise.
+    struct vf_pipeline *pipeline;
+    // Whether pipelining was already tried for the current configuration.
+    bool pipeline_checked;
 };
 
 typedef struct vf_seteq {
@@ -131,6 +142,7 @@ int vf_reconfig(struct vf_chain *c, const struct mp_image_params *params);
 int vf_control_any(struct vf_chain *c, int cmd, void *arg);
 int vf_filter_frame(struct vf_chain *c, struct mp_image *img);
 struct mp_image *vf_output_queued_frame(struct vf_chain *c);
+void vf_wait_queued_frame(struct vf_chain *c);
 void vf_seek_reset(struct vf_chain *c);
 struct vf_instance *vf_append_filter(struct vf_chain *c, const char *name,
                                      char **args);
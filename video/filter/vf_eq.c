@@ -37,6 +37,7 @@
 #include "video/img_format.h"
 #include "video/mp_image.h"
 #include "vf.h"
+#include "slice_threads.h"
 
 #define LUT16
 
@@ -75,6 +76,8 @@ typedef struct vf_priv_s {
   unsigned      buf_h[3];
   unsigned char *buf[3];
 
+  struct mp_slice_threads *threads;
+
   int gamma_i, contrast_i, brightness_i, saturation_i;
 
   double   par[8];
@@ -244,6 +247,30 @@ void apply_lut (eq2_param_t *par, unsigned char *dst, unsigned char *src,
   }
 }
 
+struct filter_job {
+  vf_eq2_t *eq2;
+  struct mp_image *src, *dst;
+  int num_slices;
+};
+
+static
+void filter_slice (void *ctx, int slice)
+{
+  struct filter_job *job = ctx;
+  vf_eq2_t *eq2 = job->eq2;
+
+  for (int i = 0; i < ((job->src->num_planes>1)?3:1); i++) {
+    eq2_param_t *par = &eq2->param[i];
+    if (par->adjust != NULL) {
+      int y0, y1;
+      mp_slice_get_range (eq2->buf_h[i], job->num_slices, slice, 1, &y0, &y1);
+      par->adjust (par, job->dst->planes[i] + y0 * job->dst->stride[i],
+        job->src->planes[i] + y0 * job->src->stride[i],
+        eq2->buf_w[i], y1 - y0, job->dst->stride[i], job->src->stride[i]);
+    }
+  }
+}
+
 static struct mp_image *filter(struct vf_instance *vf, struct mp_image *src)
 {
   vf_eq2_t      *eq2;
@@ -280,11 +307,20 @@ static struct mp_image *filter(struct vf_instance *vf, struct mp_image *src)
       dst.planes[i] = eq2->buf[i];
       dst.stride[i] = eq2->buf_w[i];
 
-      eq2->param[i].adjust (&eq2->param[i], dst.planes[i], src->planes[i],
-        eq2->buf_w[i], eq2->buf_h[i], dst.stride[i], src->stride[i]);
+      // Must not be done concurrently by the slice threads.
+      if (!eq2->param[i].lut_clean)
+        create_lut (&eq2->param[i]);
     }
   }
 
+  struct filter_job job = {
+    .eq2 = eq2,
+    .src = src,
+    .dst = &dst,
+    .num_slices = mp_slice_threads_num (eq2->threads),
+  };
+  mp_slice_threads_run (eq2->threads, job.num_slices, filter_slice, &job);
+
   struct mp_image *new = vf_alloc_out_image(vf);
   mp_image_copy(new, &dst);
   mp_image_copy_attributes(new, &dst);
@@ -472,6 +508,7 @@ int vf_open(vf_instance_t *vf)
   vf->priv = malloc (sizeof (vf_eq2_t));
   eq2 = vf->priv;
   eq2->log = vf->log;
+  eq2->threads = mp_slice_threads_create (vf, 0);
 
   for (i = 0; i < 3; i++) {
     eq2->buf[i] = NULL;
@@ -40,6 +40,7 @@
 #include "video/img_format.h"
 #include "video/mp_image.h"
 #include "vf.h"
+#include "slice_threads.h"
 #include "video/memcpy_pic.h"
 #include "compat/x86_cpu.h"
 
@@ -53,7 +54,12 @@ struct vf_priv_s {
     float cfg_size;
     int thresh;
     int radius;
-    uint16_t *buf;
+    void *buf;              // scratch buffer for each slice
+    size_t buf_size;        // number of elements per slice in buf (uint16_t,
+                            // or uint32_t for >8 bit input)
+    int depth;
+    struct mp_slice_threads *threads;
+    int num_slices;
     void (*filter_line)(uint8_t *dst, uint8_t *src, uint16_t *dc,
                         int width, int thresh, const uint16_t *dithers);
     void (*blur_line)(uint16_t *dc, uint16_t *buf, uint16_t *buf1,
@@ -247,19 +253,36 @@ static void blur_line_sse2(uint16_t *dc, uint16_t *buf, uint16_t *buf1,
 }
 #endif // HAVE_6REGS && HAVE_SSE2
 
-static void filter_plane(struct vf_priv_s *ctx, uint8_t *dst, uint8_t *src,
-                         int width, int height, int dstride, int sstride, int r)
+// Filter the lines [y0, y1). y0 must be either 0, or an even number in the
+// range [r, height - r). The blur ring buffer is primed with the r line pairs
+// preceding y0, so the result is the same as when filtering the whole plane.
+static void filter_plane(struct vf_priv_s *ctx, uint16_t *scratch,
+                         uint8_t *dst, uint8_t *src,
+                         int width, int height, int dstride, int sstride, int r,
+                         int y0, int y1)
 {
     int bstride = ((width+15)&~15)/2;
     int y;
     uint32_t dc_factor = (1<<21)/(r*r);
-    uint16_t *dc = ctx->buf+16;
-    uint16_t *buf = ctx->buf+bstride+32;
+    uint16_t *dc = scratch+16;
+    uint16_t *buf = scratch+bstride+32;
     int thresh = ctx->thresh;
 
     memset(dc, 0, (bstride+16)*sizeof(*buf));
-    for (y=0; y<r; y++)
-        ctx->blur_line(dc, buf+y*bstride, buf+(y-1)*bstride, src+2*y*sstride, sstride, width/2);
+    if (y0 == 0) {
+        for (y=0; y<r; y++)
+            ctx->blur_line(dc, buf+y*bstride, buf+(y-1)*bstride, src+2*y*sstride, sstride, width/2);
+    } else {
+        // Same ring buffer indexing as the main loop below: the line pair
+        // starting at line l goes to slot (l/2)%r.
+        for (y=0; y<r; y++) {
+            int l = y0 - r + 2*y;
+            int mod = (l/2)%r;
+            uint16_t *buf1 = y ? buf+(mod?mod-1:r-1)*bstride : buf-bstride;
+            ctx->blur_line(dc, buf+mod*bstride, buf1, src+l*sstride, sstride, width/2);
+        }
+        y = y0;
+    }
     for (;;) {
         if (y < height-r) {
             int mod = ((y+r)/2)%r;
@@ -283,16 +306,159 @@ static void filter_plane(struct vf_priv_s *ctx, uint8_t *dst, uint8_t *src,
                 ctx->filter_line(dst+y*dstride, src+y*sstride, dc-r/2, width, thresh, dither[y&7]);
         }
         ctx->filter_line(dst+y*dstride, src+y*sstride, dc-r/2, width, thresh, dither[y&7]);
-        if (++y >= height) break;
+        if (++y >= y1) break;
         ctx->filter_line(dst+y*dstride, src+y*sstride, dc-r/2, width, thresh, dither[y&7]);
-        if (++y >= height) break;
+        if (++y >= y1) break;
+    }
+}
+
+// 9-16 bit versions of the functions above. The threshold is specified in
+// 8 bit units, so it's scaled by the extra bits. The blur sums don't fit into
+// 16 bits anymore, so 32 bit scratch buffers are used.
+static void filter_line_16(uint16_t *dst, uint16_t *src, uint32_t *dc,
+                           int width, int thresh, const uint16_t *dithers,
+                           int depth)
+{
+    int x;
+    int shift = depth - 8;
+    int maxval = (1 << depth) - 1;
+    for (x=0; x<width; x++, dc+=x&1) {
+        int pix = src[x]<<7;
+        int delta = (int)dc[0] - pix;
+        int m = (abs(delta) >> shift) * thresh >> 16;
+        m = FFMAX(0, 127-m);
+        pix += (int)((int64_t)(m*m) * delta >> 14) + dithers[x&7];
+        dst[x] = av_clip(pix>>7, 0, maxval);
+    }
+}
+
+static void blur_line_16(uint32_t *dc, uint32_t *buf, uint32_t *buf1,
+                         uint16_t *src, int sstride, int width)
+{
+    uint16_t *src2 = (uint16_t *)((uint8_t *)src + sstride);
+    int x;
+    uint32_t v, old;
+    for (x=0; x<width; x++) {
+        v = buf1[x] + src[2*x] + src[2*x+1] + src2[2*x] + src2[2*x+1];
+        old = buf[x];
+        buf[x] = v;
+        dc[x] = v - old;
+    }
+}
+
+// Same as filter_plane(), for 9-16 bit samples.
+static void filter_plane_16(struct vf_priv_s *ctx, uint32_t *scratch,
+                            uint8_t *dst, uint8_t *src,
+                            int width, int height, int dstride, int sstride,
+                            int r, int y0, int y1)
+{
+    int bstride = ((width+15)&~15)/2;
+    int y;
+    uint32_t dc_factor = (1<<21)/(r*r);
+    uint32_t *dc = scratch+16;
+    uint32_t *buf = scratch+bstride+32;
+    int thresh = ctx->thresh;
+    int depth = ctx->depth;
+
+#define LINE(p, stride, y) ((uint16_t *)((p) + (y)*(stride)))
+    memset(dc, 0, (bstride+16)*sizeof(*buf));
+    if (y0 == 0) {
+        for (y=0; y<r; y++)
+            blur_line_16(dc, buf+y*bstride, buf+(y-1)*bstride, LINE(src, sstride, 2*y), sstride, width/2);
+    } else {
+        for (y=0; y<r; y++) {
+            int l = y0 - r + 2*y;
+            int mod = (l/2)%r;
+            uint32_t *buf1 = y ? buf+(mod?mod-1:r-1)*bstride : buf-bstride;
+            blur_line_16(dc, buf+mod*bstride, buf1, LINE(src, sstride, l), sstride, width/2);
+        }
+        y = y0;
+    }
+    for (;;) {
+        if (y < height-r) {
+            int mod = ((y+r)/2)%r;
+            uint32_t *buf0 = buf+mod*bstride;
+            uint32_t *buf1 = buf+(mod?mod-1:r-1)*bstride;
+            int x;
+            uint32_t v;
+            blur_line_16(dc, buf0, buf1, LINE(src, sstride, y+r), sstride, width/2);
+            for (x=v=0; x<r; x++)
+                v += dc[x];
+            for (; x<width/2; x++) {
+                v += dc[x] - dc[x-r];
+                dc[x-r] = (uint64_t)v * dc_factor >> 16;
+            }
+            for (; x<(width+r+1)/2; x++)
+                dc[x-r] = (uint64_t)v * dc_factor >> 16;
+            for (x=-r/2; x<0; x++)
+                dc[x] = dc[0];
+        }
+        if (y == r) {
+            for (y=0; y<r; y++)
+                filter_line_16(LINE(dst, dstride, y), LINE(src, sstride, y), dc-r/2, width, thresh, dither[y&7], depth);
+        }
+        filter_line_16(LINE(dst, dstride, y), LINE(src, sstride, y), dc-r/2, width, thresh, dither[y&7], depth);
+        if (++y >= y1) break;
+        filter_line_16(LINE(dst, dstride, y), LINE(src, sstride, y), dc-r/2, width, thresh, dither[y&7], depth);
+        if (++y >= y1) break;
+    }
+#undef LINE
+}
+
+struct filter_job {
+    struct vf_priv_s *p;
+    struct mp_image *src, *dst;
+    int plane, w, h, r;
+    int num_slices;
+};
+
+static void get_slice_range(struct filter_job *job, int slice, int *y0, int *y1)
+{
+    // Skip the first r lines, which are handled by the first slice as special
+    // case, and the last r lines, for which the blur is not updated anymore.
+    int r = job->r;
+    int lines = job->h - 2*r;
+    if (lines <= 0) {
+        // Too small to split; the first slice does everything.
+        *y0 = 0;
+        *y1 = slice ? 0 : job->h;
+        return;
+    }
+    mp_slice_get_range(lines, job->num_slices, slice, 2, y0, y1);
+    if (*y0 >= *y1) {
+        // Trailing slices can be empty; don't map them to the last r lines.
+        *y0 = *y1 = 0;
+        return;
+    }
+    *y0 = *y0 ? *y0 + r : 0;
+    *y1 = *y1 == lines ? job->h : *y1 + r;
+}
+
+static void filter_slice(void *ctx, int slice)
+{
+    struct filter_job *job = ctx;
+    struct vf_priv_s *p = job->p;
+    int n = job->plane;
+    int y0, y1;
+    get_slice_range(job, slice, &y0, &y1);
+    if (y0 >= y1)
+        return;
+    if (p->depth > 8) {
+        filter_plane_16(p, (uint32_t *)p->buf + slice * p->buf_size,
+                        job->dst->planes[n], job->src->planes[n], job->w, job->h,
+                        job->dst->stride[n], job->src->stride[n], job->r, y0, y1);
+    } else {
+        filter_plane(p, (uint16_t *)p->buf + slice * p->buf_size,
+                     job->dst->planes[n], job->src->planes[n], job->w, job->h,
+                     job->dst->stride[n], job->src->stride[n], job->r, y0, y1);
     }
 }
 
 static struct mp_image *filter(struct vf_instance *vf, struct mp_image *mpi)
 {
     struct mp_image *dmpi = mpi;
-    if (!mp_image_is_writeable(mpi)) {
+    // In-place filtering reads lines which other slices might have written.
+    if (!mp_image_is_writeable(mpi) || vf->priv->num_slices > 1) {
         dmpi = vf_alloc_out_image(vf);
         mp_image_copy_attributes(dmpi, mpi);
     }
@@ -307,12 +473,24 @@ static struct mp_image *filter(struct vf_instance *vf, struct mp_image *mpi)
             r = ((r>>mpi->chroma_x_shift) + (r>>mpi->chroma_y_shift)) / 2;
             r = av_clip((r+1)&~1,4,32);
         }
-        if (FFMIN(w,h) > 2*r)
-            filter_plane(vf->priv, dmpi->planes[p], mpi->planes[p], w, h,
-                                   dmpi->stride[p], mpi->stride[p], r);
-        else if (dmpi->planes[p] != mpi->planes[p])
-            memcpy_pic(dmpi->planes[p], mpi->planes[p], w, h,
-                       dmpi->stride[p], mpi->stride[p]);
+        if (FFMIN(w,h) > 2*r) {
+            struct filter_job job = {
+                .p = vf->priv,
+                .src = mpi,
+                .dst = dmpi,
+                .plane = p,
+                .w = w,
+                .h = h,
+                .r = r,
+                // Don't bother with slices that are smaller than the blur.
+                .num_slices = av_clip((h - 2*r) / (2*r), 1, vf->priv->num_slices),
+            };
+            mp_slice_threads_run(vf->priv->threads, job.num_slices,
+                                 filter_slice, &job);
+        } else if (dmpi->planes[p] != mpi->planes[p]) {
+            memcpy_pic(dmpi->planes[p], mpi->planes[p], w * mpi->fmt.bytes[p],
+                       h, dmpi->stride[p], mpi->stride[p]);
+        }
     }
 
     if (dmpi != mpi)
@@ -322,16 +500,12 @@ static struct mp_image *filter(struct vf_instance *vf, struct mp_image *mpi)
 
 static int query_format(struct vf_instance *vf, unsigned int fmt)
 {
-    switch (fmt){
-    case IMGFMT_Y8:
-    case IMGFMT_444P:
-    case IMGFMT_422P:
-    case IMGFMT_440P:
-    case IMGFMT_420P:
-    case IMGFMT_411P:
-    case IMGFMT_410P:
+    // Gray or planar YUV, 8 bit or 9-16 bit native endian
+    struct mp_imgfmt_desc desc = mp_imgfmt_get_desc(fmt);
+    if ((desc.flags & MP_IMGFLAG_YUV_P) && (desc.flags & MP_IMGFLAG_NE) &&
+        (desc.num_planes == 1 || desc.num_planes == 3) &&
+        desc.plane_bits >= 8 && desc.plane_bits <= 16)
         return vf_next_query_format(vf,fmt);
-    }
     return 0;
 }
 
@@ -339,14 +513,20 @@ static int config(struct vf_instance *vf,
                   int width, int height, int d_width, int d_height,
                   unsigned int flags, unsigned int outfmt)
 {
-    free(vf->priv->buf);
+    av_free(vf->priv->buf);
+    vf->priv->depth = mp_imgfmt_get_desc(outfmt).plane_bits;
     vf->priv->radius = vf->priv->cfg_radius;
     if (vf->priv->cfg_size > -1) {
         vf->priv->radius = (vf->priv->cfg_size / 100.0f)
                            * sqrtf(width * width + height * height);
     }
     vf->priv->radius = av_clip((vf->priv->radius+1)&~1, 4, 32);
-    vf->priv->buf = av_mallocz((((width+15)&~15)*(vf->priv->radius+1)/2+32)*sizeof(uint16_t));
+    vf->priv->num_slices = mp_slice_threads_num(vf->priv->threads);
+    // Keep the slice buffers 16 byte aligned.
+    vf->priv->buf_size = FFALIGN(((width+15)&~15)*(vf->priv->radius+1)/2+32, 8);
+    vf->priv->buf = av_mallocz(vf->priv->buf_size * vf->priv->num_slices
+                               * (vf->priv->depth > 8 ? sizeof(uint32_t)
+                                                      : sizeof(uint16_t)));
     return vf_next_config(vf,width,height,d_width,d_height,flags,outfmt);
 }
 
@@ -411,6 +591,8 @@ static int vf_open(vf_instance_t *vf)
         vf->priv->filter_line = filter_line_ssse3;
 #endif
 
+    vf->priv->threads = mp_slice_threads_create(vf, 0);
+
     return 1;
 }
 
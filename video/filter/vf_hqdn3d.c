@@ -24,11 +24,14 @@
 #include <inttypes.h>
 #include <math.h>
 
+#include <libavutil/common.h>
+
 #include "common/msg.h"
 #include "options/m_option.h"
 #include "video/img_format.h"
 #include "video/mp_image.h"
 #include "vf.h"
+#include "slice_threads.h"
 
 #include "vf_lavfi.h"
 
@@ -40,10 +43,11 @@
 
 struct vf_priv_s {
         int Coefs[4][512*16];
-        unsigned int *Line;
+        unsigned int *Line[3];
 	unsigned short *Frame[3];
         double strength[4];
         struct vf_lw_opts *lw_opts;
+        struct mp_slice_threads *threads;
 };
 
 
@@ -51,15 +55,12 @@ struct vf_priv_s {
 
 static void uninit(struct vf_instance *vf)
 {
-	free(vf->priv->Line);
-	free(vf->priv->Frame[0]);
-	free(vf->priv->Frame[1]);
-	free(vf->priv->Frame[2]);
-
-	vf->priv->Line     = NULL;
-	vf->priv->Frame[0] = NULL;
-	vf->priv->Frame[1] = NULL;
-	vf->priv->Frame[2] = NULL;
+	for (int n = 0; n < 3; n++) {
+	    free(vf->priv->Line[n]);
+	    free(vf->priv->Frame[n]);
+	    vf->priv->Line[n]  = NULL;
+	    vf->priv->Frame[n] = NULL;
+	}
 }
 
 static int config(struct vf_instance *vf,
@@ -67,7 +68,10 @@ static int config(struct vf_instance *vf,
 	unsigned int flags, unsigned int outfmt){
 
 	uninit(vf);
-        vf->priv->Line = malloc(width*sizeof(unsigned int));
+        // Each plane has its own line buffer, so that planes can be filtered
+        // concurrently.
+        for (int n = 0; n < 3; n++)
+            vf->priv->Line[n] = malloc(width*sizeof(unsigned int));
 
 	return vf_next_config(vf,width,height,d_width,d_height,flags,outfmt);
 }
@@ -79,21 +83,33 @@ static inline unsigned int LowPassMul(unsigned int PrevMul, unsigned int CurrMul
     return CurrMul + Coef[d];
 }
 
-static void deNoiseTemporal(
-                    unsigned char *Frame,        // mpi->planes[x]
-                    unsigned char *FrameDest,    // dmpi->planes[x]
+// Samples are 8 bit, or 9-16 bit stored in native endian uint16_t. Internally,
+// all depths use the 8.16 fixed point range the coefficients are computed for.
+#define LOAD(p, x)  (depth > 8 ? (unsigned int)((uint16_t *)(p))[x] << (24 - depth) \
+                               : (unsigned int)((uint8_t *)(p))[x] << 16)
+#define STORE(p, x, v) do {                                                     \
+    if (depth > 8)                                                              \
+        ((uint16_t *)(p))[x] = av_clip_uintp2(((int)(v) + (1 << (23 - depth)) - 1) \
+                                              >> (24 - depth), depth);          \
+    else                                                                        \
+        ((uint8_t *)(p))[x] = ((v)+0x10007FFF)>>16;                             \
+} while (0)
+
+static av_always_inline void deNoiseTemporal(
+                    uint8_t *Frame,              // mpi->planes[x]
+                    uint8_t *FrameDest,          // dmpi->planes[x]
                     unsigned short *FrameAnt,
                     int W, int H, int sStride, int dStride,
-                    int *Temporal)
+                    int *Temporal, int depth)
 {
     long X, Y;
     unsigned int PixelDst;
 
     for (Y = 0; Y < H; Y++){
         for (X = 0; X < W; X++){
-            PixelDst = LowPassMul(FrameAnt[X]<<8, Frame[X]<<16, Temporal);
+            PixelDst = LowPassMul(FrameAnt[X]<<8, LOAD(Frame, X), Temporal);
             FrameAnt[X] = ((PixelDst+0x1000007F)>>8);
-            FrameDest[X]= ((PixelDst+0x10007FFF)>>16);
+            STORE(FrameDest, X, PixelDst);
         }
         Frame += sStride;
         FrameDest += dStride;
@@ -101,53 +117,52 @@ static void deNoiseTemporal(
     }
 }
 
-static void deNoiseSpacial(
-                    unsigned char *Frame,        // mpi->planes[x]
-                    unsigned char *FrameDest,    // dmpi->planes[x]
+static av_always_inline void deNoiseSpacial(
+                    uint8_t *Frame,              // mpi->planes[x]
+                    uint8_t *FrameDest,          // dmpi->planes[x]
                     unsigned int *LineAnt,       // vf->priv->Line (width bytes)
                     int W, int H, int sStride, int dStride,
-                    int *Horizontal, int *Vertical)
+                    int *Horizontal, int *Vertical, int depth)
 {
     long X, Y;
-    long sLineOffs = 0, dLineOffs = 0;
     unsigned int PixelAnt;
     unsigned int PixelDst;
 
     /* First pixel has no left nor top neighbor. */
-    PixelDst = LineAnt[0] = PixelAnt = Frame[0]<<16;
-    FrameDest[0]= ((PixelDst+0x10007FFF)>>16);
+    PixelDst = LineAnt[0] = PixelAnt = LOAD(Frame, 0);
+    STORE(FrameDest, 0, PixelDst);
 
     /* First line has no top neighbor, only left. */
     for (X = 1; X < W; X++){
-        PixelDst = LineAnt[X] = LowPassMul(PixelAnt, Frame[X]<<16, Horizontal);
-        FrameDest[X]= ((PixelDst+0x10007FFF)>>16);
+        PixelDst = LineAnt[X] = LowPassMul(PixelAnt, LOAD(Frame, X), Horizontal);
+        STORE(FrameDest, X, PixelDst);
     }
 
     for (Y = 1; Y < H; Y++){
-	sLineOffs += sStride, dLineOffs += dStride;
+	Frame += sStride, FrameDest += dStride;
         /* First pixel on each line doesn't have previous pixel */
-        PixelAnt = Frame[sLineOffs]<<16;
+        PixelAnt = LOAD(Frame, 0);
         PixelDst = LineAnt[0] = LowPassMul(LineAnt[0], PixelAnt, Vertical);
-        FrameDest[dLineOffs]= ((PixelDst+0x10007FFF)>>16);
+        STORE(FrameDest, 0, PixelDst);
 
         for (X = 1; X < W; X++){
             /* The rest are normal */
-            PixelAnt = LowPassMul(PixelAnt, Frame[sLineOffs+X]<<16, Horizontal);
+            PixelAnt = LowPassMul(PixelAnt, LOAD(Frame, X), Horizontal);
             PixelDst = LineAnt[X] = LowPassMul(LineAnt[X], PixelAnt, Vertical);
-            FrameDest[dLineOffs+X]= ((PixelDst+0x10007FFF)>>16);
+            STORE(FrameDest, X, PixelDst);
         }
     }
 }
 
-static void deNoise(unsigned char *Frame,        // mpi->planes[x]
-                    unsigned char *FrameDest,    // dmpi->planes[x]
+static av_always_inline void deNoise(
+                    uint8_t *Frame,              // mpi->planes[x]
+                    uint8_t *FrameDest,          // dmpi->planes[x]
                     unsigned int *LineAnt,      // vf->priv->Line (width bytes)
 		    unsigned short **FrameAntPtr,
                     int W, int H, int sStride, int dStride,
-                    int *Horizontal, int *Vertical, int *Temporal)
+                    int *Horizontal, int *Vertical, int *Temporal, int depth)
 {
     long X, Y;
-    long sLineOffs = 0, dLineOffs = 0;
     unsigned int PixelAnt;
     unsigned int PixelDst;
     unsigned short* FrameAnt=(*FrameAntPtr);
@@ -156,86 +171,114 @@ static void deNoise(unsigned char *Frame,        // mpi->planes[x]
 	(*FrameAntPtr)=FrameAnt=malloc(W*H*sizeof(unsigned short));
 	for (Y = 0; Y < H; Y++){
 	    unsigned short* dst=&FrameAnt[Y*W];
-	    unsigned char* src=Frame+Y*sStride;
-	    for (X = 0; X < W; X++) dst[X]=src[X]<<8;
+	    uint8_t* src=Frame+Y*sStride;
+	    for (X = 0; X < W; X++) dst[X]=LOAD(src, X)>>8;
 	}
     }
 
     if(!Horizontal[0] && !Vertical[0]){
         deNoiseTemporal(Frame, FrameDest, FrameAnt,
-                        W, H, sStride, dStride, Temporal);
+                        W, H, sStride, dStride, Temporal, depth);
         return;
     }
     if(!Temporal[0]){
         deNoiseSpacial(Frame, FrameDest, LineAnt,
-                       W, H, sStride, dStride, Horizontal, Vertical);
+                       W, H, sStride, dStride, Horizontal, Vertical, depth);
         return;
     }
 
     /* First pixel has no left nor top neighbor. Only previous frame */
-    LineAnt[0] = PixelAnt = Frame[0]<<16;
+    LineAnt[0] = PixelAnt = LOAD(Frame, 0);
     PixelDst = LowPassMul(FrameAnt[0]<<8, PixelAnt, Temporal);
     FrameAnt[0] = ((PixelDst+0x1000007F)>>8);
-    FrameDest[0]= ((PixelDst+0x10007FFF)>>16);
+    STORE(FrameDest, 0, PixelDst);
 
     /* First line has no top neighbor. Only left one for each pixel and
      * last frame */
     for (X = 1; X < W; X++){
-        LineAnt[X] = PixelAnt = LowPassMul(PixelAnt, Frame[X]<<16, Horizontal);
+        LineAnt[X] = PixelAnt = LowPassMul(PixelAnt, LOAD(Frame, X), Horizontal);
         PixelDst = LowPassMul(FrameAnt[X]<<8, PixelAnt, Temporal);
         FrameAnt[X] = ((PixelDst+0x1000007F)>>8);
-        FrameDest[X]= ((PixelDst+0x10007FFF)>>16);
+        STORE(FrameDest, X, PixelDst);
     }
 
     for (Y = 1; Y < H; Y++){
 	unsigned short* LinePrev=&FrameAnt[Y*W];
-	sLineOffs += sStride, dLineOffs += dStride;
+	Frame += sStride, FrameDest += dStride;
         /* First pixel on each line doesn't have previous pixel */
-        PixelAnt = Frame[sLineOffs]<<16;
+        PixelAnt = LOAD(Frame, 0);
         LineAnt[0] = LowPassMul(LineAnt[0], PixelAnt, Vertical);
 	PixelDst = LowPassMul(LinePrev[0]<<8, LineAnt[0], Temporal);
         LinePrev[0] = ((PixelDst+0x1000007F)>>8);
-        FrameDest[dLineOffs]= ((PixelDst+0x10007FFF)>>16);
+        STORE(FrameDest, 0, PixelDst);
 
         for (X = 1; X < W; X++){
             /* The rest are normal */
-            PixelAnt = LowPassMul(PixelAnt, Frame[sLineOffs+X]<<16, Horizontal);
+            PixelAnt = LowPassMul(PixelAnt, LOAD(Frame, X), Horizontal);
             LineAnt[X] = LowPassMul(LineAnt[X], PixelAnt, Vertical);
 	    PixelDst = LowPassMul(LinePrev[X]<<8, LineAnt[X], Temporal);
             LinePrev[X] = ((PixelDst+0x1000007F)>>8);
-            FrameDest[dLineOffs+X]= ((PixelDst+0x10007FFF)>>16);
+            STORE(FrameDest, X, PixelDst);
         }
     }
 }
 
+#undef LOAD
+#undef STORE
 
-static struct mp_image *filter(struct vf_instance *vf, struct mp_image *mpi)
+static void deNoise_8(uint8_t *Frame, uint8_t *FrameDest, unsigned int *LineAnt,
+                      unsigned short **FrameAntPtr, int W, int H,
+                      int sStride, int dStride,
+                      int *Horizontal, int *Vertical, int *Temporal, int depth)
 {
-	int cw= mpi->w >> mpi->chroma_x_shift;
-	int ch= mpi->h >> mpi->chroma_y_shift;
-        int W = mpi->w, H = mpi->h;
+    deNoise(Frame, FrameDest, LineAnt, FrameAntPtr, W, H, sStride, dStride,
+            Horizontal, Vertical, Temporal, 8);
+}
 
+static void deNoise_16(uint8_t *Frame, uint8_t *FrameDest, unsigned int *LineAnt,
+                       unsigned short **FrameAntPtr, int W, int H,
+                       int sStride, int dStride,
+                       int *Horizontal, int *Vertical, int *Temporal, int depth)
+{
+    deNoise(Frame, FrameDest, LineAnt, FrameAntPtr, W, H, sStride, dStride,
+            Horizontal, Vertical, Temporal, depth);
+}
+
+
+struct filter_job {
+        struct vf_priv_s *p;
+        struct mp_image *src, *dst;
+};
+
+// The filter is recursive in both directions, so planes can't be split into
+// independent slices. Filter the 3 planes concurrently instead.
+static void filter_plane(void *ctx, int plane)
+{
+        struct filter_job *job = ctx;
+        struct vf_priv_s *p = job->p;
+        struct mp_image *mpi = job->src;
+        int c = plane ? 2 : 0;
+        int w = plane ? mpi->w >> mpi->chroma_x_shift : mpi->w;
+        int h = plane ? mpi->h >> mpi->chroma_y_shift : mpi->h;
+
+        int depth = mpi->fmt.plane_bits;
+
+        (depth > 8 ? deNoise_16 : deNoise_8)(
+                mpi->planes[plane], job->dst->planes[plane],
+                p->Line[plane], &p->Frame[plane], w, h,
+                mpi->stride[plane], job->dst->stride[plane],
+                p->Coefs[c],
+                p->Coefs[c],
+                p->Coefs[c + 1], depth);
+}
+
+static struct mp_image *filter(struct vf_instance *vf, struct mp_image *mpi)
+{
         struct mp_image *dmpi = vf_alloc_out_image(vf);
         mp_image_copy_attributes(dmpi, mpi);
 
-        deNoise(mpi->planes[0], dmpi->planes[0],
-		vf->priv->Line, &vf->priv->Frame[0], W, H,
-                mpi->stride[0], dmpi->stride[0],
-                vf->priv->Coefs[0],
-                vf->priv->Coefs[0],
-                vf->priv->Coefs[1]);
-        deNoise(mpi->planes[1], dmpi->planes[1],
-		vf->priv->Line, &vf->priv->Frame[1], cw, ch,
-                mpi->stride[1], dmpi->stride[1],
-                vf->priv->Coefs[2],
-                vf->priv->Coefs[2],
-                vf->priv->Coefs[3]);
-        deNoise(mpi->planes[2], dmpi->planes[2],
-		vf->priv->Line, &vf->priv->Frame[2], cw, ch,
-                mpi->stride[2], dmpi->stride[2],
-                vf->priv->Coefs[2],
-                vf->priv->Coefs[2],
-                vf->priv->Coefs[3]);
+        struct filter_job job = { vf->priv, mpi, dmpi };
+        mp_slice_threads_run(vf->priv->threads, 3, filter_plane, &job);
 
         talloc_free(mpi);
         return dmpi;
@@ -244,16 +287,12 @@ static struct mp_image *filter(struct vf_instance *vf, struct mp_image *mpi)
 //===========================================================================//
 
 static int query_format(struct vf_instance *vf, unsigned int fmt){
-        switch(fmt)
-	{
-        case IMGFMT_444P:
-        case IMGFMT_422P:
-        case IMGFMT_440P:
-        case IMGFMT_420P:
-        case IMGFMT_411P:
-        case IMGFMT_410P:
+        // 8 bit and 9-16 bit native endian planar YUV
+        struct mp_imgfmt_desc desc = mp_imgfmt_get_desc(fmt);
+        if ((desc.flags & MP_IMGFLAG_YUV_P) && (desc.flags & MP_IMGFLAG_NE) &&
+            desc.num_planes == 3 && desc.plane_bits >= 8 &&
+            desc.plane_bits <= 16)
 		return vf_next_query_format(vf, fmt);
-	}
 	return 0;
 }
 
@@ -309,6 +348,8 @@ static int vf_open(vf_instance_t *vf){
         for (int n = 0; n < 4; n++)
             PrecalcCoefs(vf->priv->Coefs[n], s->strength[n]);
 
+        s->threads = mp_slice_threads_create(vf, 3);
+
 	return 1;
 }
 
@@ -84,6 +84,7 @@ struct vf_priv_s {
     char *cfg_graph;
     int64_t cfg_sws_flags;
     char *cfg_avopts;
+    int cfg_persistent;
 };
 
 static const struct vf_priv_s vf_priv_dflt = {
@@ -258,7 +259,7 @@ static int query_format(struct vf_instance *vf, unsigned int fmt)
 static AVFrame *mp_to_av(struct vf_instance *vf, struct mp_image *img)
 {
     struct vf_priv_s *p = vf->priv;
-    uint64_t pts = img->pts == MP_NOPTS_VALUE ?
+    int64_t pts = img->pts == MP_NOPTS_VALUE ?
                    AV_NOPTS_VALUE : img->pts * av_q2d(av_inv_q(p->timebase_in));
     AVFrame *frame = mp_image_to_av_frame_and_unref(img);
     frame->pts = pts;
@@ -303,10 +304,28 @@ static int filter_ext(struct vf_instance *vf, struct mp_image *mpi)
     return 0;
 }
 
+// Discard the frames the graph has already output, but which weren't read yet.
+static void drain_graph(struct vf_instance *vf)
+{
+    struct vf_priv_s *p = vf->priv;
+    AVFrame *frame = av_frame_alloc();
+    if (!frame)
+        return;
+    while (av_buffersink_get_frame(p->out, frame) >= 0)
+        av_frame_unref(frame);
+    av_frame_free(&frame);
+}
+
 static void reset(vf_instance_t *vf)
 {
     struct vf_priv_s *p = vf->priv;
     struct mp_image_params *f = &vf->fmt_in;
+    if (p->graph && p->cfg_persistent) {
+        // Keep the graph; filters with internal frame queues or temporal
+        // state might still return a few frames from before the seek.
+        drain_graph(vf);
+        return;
+    }
     if (p->graph && f->imgfmt)
         recreate_graph(vf, f->w, f->h, f->d_w, f->d_h, f->imgfmt);
 }
@@ -383,6 +402,7 @@ static const m_option_t vf_opts_fields[] = {
     OPT_STRING("graph", cfg_graph, M_OPT_MIN, .min = 1),
     OPT_INT64("sws-flags", cfg_sws_flags, 0),
     OPT_STRING("o", cfg_avopts, 0),
+    OPT_FLAG("persistent", cfg_persistent, 0),
     {0}
 };
 
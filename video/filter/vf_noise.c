@@ -32,6 +32,7 @@
 #include "video/img_format.h"
 #include "video/mp_image.h"
 #include "vf.h"
+#include "slice_threads.h"
 #include "video/memcpy_pic.h"
 #include "libavutil/mem.h"
 
@@ -71,6 +72,8 @@ struct vf_priv_s {
         int uniform;
         int hq;
         struct vf_lw_opts *lw_opts;
+        struct mp_slice_threads *threads;
+        int line_shift[MAX_RES];
 };
 
 static int nonTempRandShift_init;
@@ -282,34 +285,122 @@ static inline void lineNoiseAvg_C(uint8_t *dst, uint8_t *src, int len, int8_t **
 
 /***************************************************************************/
 
-static void donoise(uint8_t *dst, uint8_t *src, int dstStride, int srcStride, int width, int height, FilterParam *fp){
+#if HAVE_X86_INTRINSICS
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+static void lineNoise_SSE2(uint8_t *dst, uint8_t *src, int8_t *noise, int len, int shift){
+	int sse_len= len&(~15);
+	int stream= !((uintptr_t)dst & 15);
+	const __m128i sign= _mm_set1_epi8(-128);
+	int i;
+	noise+=shift;
+
+	for(i=0; i<sse_len; i+=16)
+	{
+		__m128i v= _mm_loadu_si128((const __m128i *)(src+i));
+		__m128i n= _mm_loadu_si128((const __m128i *)(noise+i));
+		v= _mm_xor_si128(_mm_adds_epi8(_mm_xor_si128(v, sign), n), sign);
+		if (stream)	_mm_stream_si128((__m128i *)(dst+i), v);
+		else		_mm_storeu_si128((__m128i *)(dst+i), v);
+	}
+	if(sse_len!=len)
+		lineNoise_C(dst+sse_len, src+sse_len, noise+sse_len, len-sse_len, 0);
+}
+
+__attribute__((target("avx2")))
+static void lineNoise_AVX2(uint8_t *dst, uint8_t *src, int8_t *noise, int len, int shift){
+	int avx_len= len&(~31);
+	int stream= !((uintptr_t)dst & 31);
+	const __m256i sign= _mm256_set1_epi8(-128);
+	int i;
+	noise+=shift;
+
+	for(i=0; i<avx_len; i+=32)
+	{
+		__m256i v= _mm256_loadu_si256((const __m256i *)(src+i));
+		__m256i n= _mm256_loadu_si256((const __m256i *)(noise+i));
+		v= _mm256_xor_si256(_mm256_adds_epi8(_mm256_xor_si256(v, sign), n), sign);
+		if (stream)	_mm256_stream_si256((__m256i *)(dst+i), v);
+		else		_mm256_storeu_si256((__m256i *)(dst+i), v);
+	}
+	if(avx_len!=len)
+		lineNoise_C(dst+avx_len, src+avx_len, noise+avx_len, len-avx_len, 0);
+}
+
+// Sign-extend the low or high 8 bytes of v to 16 bit.
+__attribute__((target("sse2")))
+static inline __m128i sext_lo_SSE2(__m128i v){
+	return _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i sext_hi_SSE2(__m128i v){
+	return _mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8);
+}
+
+// Same results as lineNoiseAvg_C, 16 pixels at a time. Like the C code, this
+// reads src as signed, sums the noise without wrapping, and keeps the low 8
+// bits of the result. n*src needs 17 bits, so the shift by 7 is done on the
+// full 32 bit product (only the low 16 bits of the quotient are needed).
+__attribute__((target("sse2")))
+static void lineNoiseAvg_SSE2(uint8_t *dst, uint8_t *src, int len, int8_t **shift){
+	int sse_len= len&(~15);
+	const __m128i mask= _mm_set1_epi16(0xFF);
+	int i, k;
+
+	for(i=0; i<sse_len; i+=16)
+	{
+		__m128i s= _mm_loadu_si128((const __m128i *)(src+i));
+		__m128i n0= _mm_loadu_si128((const __m128i *)(shift[0]+i));
+		__m128i n1= _mm_loadu_si128((const __m128i *)(shift[1]+i));
+		__m128i n2= _mm_loadu_si128((const __m128i *)(shift[2]+i));
+		__m128i res[2];
+		for(k=0; k<2; k++)
+		{
+			__m128i s16= k ? sext_hi_SSE2(s) : sext_lo_SSE2(s);
+			__m128i n16= k ? _mm_add_epi16(_mm_add_epi16(sext_hi_SSE2(n0),
+			                                             sext_hi_SSE2(n1)),
+			                               sext_hi_SSE2(n2))
+			               : _mm_add_epi16(_mm_add_epi16(sext_lo_SSE2(n0),
+			                                             sext_lo_SSE2(n1)),
+			                               sext_lo_SSE2(n2));
+			__m128i lo= _mm_mullo_epi16(n16, s16);
+			__m128i hi= _mm_mulhi_epi16(n16, s16);
+			__m128i v= _mm_or_si128(_mm_slli_epi16(hi, 9), _mm_srli_epi16(lo, 7));
+			res[k]= _mm_and_si128(_mm_add_epi16(v, s16), mask);
+		}
+		_mm_storeu_si128((__m128i *)(dst+i), _mm_packus_epi16(res[0], res[1]));
+	}
+
+	if(sse_len!=len){
+		int8_t *shift2[3]={shift[0]+sse_len, shift[1]+sse_len, shift[2]+sse_len};
+		lineNoiseAvg_C(dst+sse_len, src+sse_len, len-sse_len, shift2);
+	}
+}
+#endif /* HAVE_X86_INTRINSICS */
+
+/***************************************************************************/
+
+// Process lines [y0, y1). line_shift[] contains the noise offset for each line.
+static void donoise(uint8_t *dst, uint8_t *src, int dstStride, int srcStride, int width, int y0, int y1, int *line_shift, FilterParam *fp){
 	int8_t *noise= fp->noise;
 	int y;
-	int shift=0;
+
+	dst+= y0*dstStride;
+	src+= y0*srcStride;
 
 	if(!noise)
 	{
 		if(src==dst) return;
 
-		if(dstStride==srcStride) memcpy(dst, src, srcStride*height);
-		else
-		{
-			for(y=0; y<height; y++)
-			{
-				memcpy(dst, src, width);
-				dst+= dstStride;
-				src+= srcStride;
-			}
-		}
+		memcpy_pic(dst, src, width, y1-y0, dstStride, srcStride);
 		return;
 	}
 
-	for(y=0; y<height; y++)
+	for(y=y0; y<y1; y++)
 	{
-		if(fp->temporal)	shift=  rand()&(MAX_SHIFT  -1);
-		else			shift= nonTempRandShift[y];
-
-		if(fp->quality==0) shift&= ~7;
+		int shift= line_shift[y];
 		if (fp->averaged) {
 		    lineNoiseAvg(dst, src, width, fp->prev_shift[y]);
 		    fp->prev_shift[y][fp->shiftptr] = noise + shift;
@@ -319,28 +410,75 @@ static void donoise(uint8_t *dst, uint8_t *src, int dstStride, int srcStride, in
 		dst+= dstStride;
 		src+= srcStride;
 	}
-	fp->shiftptr++;
-	if (fp->shiftptr == 3) fp->shiftptr = 0;
+
+#if HAVE_MMX
+	if(gCpuCaps.hasMMX) __asm__ volatile ("emms\n\t");
+#endif
+#if HAVE_MMX2
+	if(gCpuCaps.hasMMX2) __asm__ volatile ("sfence\n\t");
+#endif
+}
+
+// The random numbers are drawn on the calling thread, so the output does not
+// depend on how the lines are distributed over threads.
+static void init_line_shifts(int *line_shift, int height, FilterParam *fp){
+	for(int y=0; y<height; y++)
+	{
+		int shift;
+		if(fp->temporal)	shift=  rand()&(MAX_SHIFT  -1);
+		else			shift= nonTempRandShift[y];
+
+		if(fp->quality==0) shift&= ~7;
+		line_shift[y]= shift;
+	}
+}
+
+struct filter_job {
+        struct vf_priv_s *p;
+        struct mp_image *src, *dst;
+        int plane, w, h, num_slices;
+        FilterParam *fp;
+};
+
+static void filter_slice(void *ctx, int slice)
+{
+        struct filter_job *job = ctx;
+        int n = job->plane;
+        int y0, y1;
+        mp_slice_get_range(job->h, job->num_slices, slice, 1, &y0, &y1);
+        donoise(job->dst->planes[n], job->src->planes[n],
+                job->dst->stride[n], job->src->stride[n], job->w, y0, y1,
+                job->p->line_shift, job->fp);
 }
 
 static struct mp_image *filter(struct vf_instance *vf, struct mp_image *mpi)
 {
+        struct vf_priv_s *p = vf->priv;
         struct mp_image *dmpi = mpi;
         if (!mp_image_is_writeable(mpi)) {
             dmpi = vf_alloc_out_image(vf);
             mp_image_copy_attributes(dmpi, mpi);
         }
 
-	donoise(dmpi->planes[0], mpi->planes[0], dmpi->stride[0], mpi->stride[0], mpi->w, mpi->h, &vf->priv->lumaParam);
-	donoise(dmpi->planes[1], mpi->planes[1], dmpi->stride[1], mpi->stride[1], mpi->w/2, mpi->h/2, &vf->priv->chromaParam);
-	donoise(dmpi->planes[2], mpi->planes[2], dmpi->stride[2], mpi->stride[2], mpi->w/2, mpi->h/2, &vf->priv->chromaParam);
-
-#if HAVE_MMX
-	if(gCpuCaps.hasMMX) __asm__ volatile ("emms\n\t");
-#endif
-#if HAVE_MMX2
-	if(gCpuCaps.hasMMX2) __asm__ volatile ("sfence\n\t");
-#endif
+        for (int n = 0; n < 3; n++) {
+            struct filter_job job = {
+                .p = p,
+                .src = mpi,
+                .dst = dmpi,
+                .plane = n,
+                .w = n ? mpi->w/2 : mpi->w,
+                .h = n ? mpi->h/2 : mpi->h,
+                .num_slices = mp_slice_threads_num(p->threads),
+                .fp = n ? &p->chromaParam : &p->lumaParam,
+            };
+            if (job.fp->noise)
+                init_line_shifts(p->line_shift, job.h, job.fp);
+            mp_slice_threads_run(p->threads, job.num_slices, filter_slice, &job);
+            if (job.fp->noise) {
+                job.fp->shiftptr++;
+                if (job.fp->shiftptr == 3) job.fp->shiftptr = 0;
+            }
+        }
 
         if (dmpi != mpi)
             talloc_free(mpi);
@@ -396,6 +534,8 @@ static int vf_open(vf_instance_t *vf){
     parse(&vf->priv->lumaParam, vf->priv);
     parse(&vf->priv->chromaParam, vf->priv);
 
+    vf->priv->threads = mp_slice_threads_create(vf, 0);
+
 #if HAVE_MMX
     if(gCpuCaps.hasMMX){
         lineNoise= lineNoise_MMX;
@@ -405,6 +545,13 @@ static int vf_open(vf_instance_t *vf){
 #if HAVE_MMX2
     if(gCpuCaps.hasMMX2) lineNoise= lineNoise_MMX2;
 //    if(gCpuCaps.hasMMX) lineNoiseAvg= lineNoiseAvg_MMX2;
+#endif
+#if HAVE_X86_INTRINSICS
+    if(gCpuCaps.hasSSE2){
+        lineNoise= lineNoise_SSE2;
+        lineNoiseAvg= lineNoiseAvg_SSE2;
+    }
+    if(gCpuCaps.hasAVX2) lineNoise= lineNoise_AVX2;
 #endif
 
     return 1;
@@ -34,14 +34,28 @@
 #include "video/img_format.h"
 #include "video/mp_image.h"
 #include "vf.h"
+#include "slice_threads.h"
 #include "sub/osd.h"
 #include "sub/dec_sub.h"
+#include "sub/draw_bmp.h"
+#include "sub/img_convert.h"
 
 #include "video/sws_utils.h"
 #include "video/memcpy_pic.h"
+#include "video/mp_image_pool.h"
 
 #include "options/m_option.h"
 
+// Subtitles are blended in horizontal bands, one per thread. Each band has its
+// own draw cache, which caches data relative to the band.
+struct band {
+    struct mp_draw_sub_cache *cache;
+    // Band position last used for each OSD part. If it changes, the cached
+    // positions are invalid; this is signaled by changing bitmap_pos_id.
+    int y0[MAX_OSD_PARTS], y1[MAX_OSD_PARTS];
+    int pos_id_offset[MAX_OSD_PARTS];
+};
+
 struct vf_priv_s {
     int opt_top_margin, opt_bottom_margin;
 
@@ -49,6 +63,10 @@ struct vf_priv_s {
 
     struct osd_state *osd;
     struct mp_osd_res dim;
+
+    struct mp_slice_threads *threads;
+    struct band *bands;
+    int num_bands;
 };
 
 static int config(struct vf_instance *vf,
@@ -89,6 +107,83 @@ static void prepare_image(struct vf_instance *vf, struct mp_image *dmpi,
     mp_image_clear(dmpi, 0, y2, dmpi->w, vf->priv->outh);
 }
 
+struct draw_job {
+    struct vf_priv_s *priv;
+    struct mp_image *img;
+    struct mp_image_pool *pool;
+    struct sub_bitmaps *imgs;
+    int y0, y1;         // area covered by the sub-bitmaps
+    int align;
+    int num_bands;
+};
+
+static void draw_band(void *ctx, int slice)
+{
+    struct draw_job *job = ctx;
+    struct band *band = &job->priv->bands[slice];
+    struct sub_bitmaps *imgs = job->imgs;
+    int index = imgs->render_index;
+
+    int y0, y1;
+    mp_slice_get_range(job->y1 - job->y0, job->num_bands, slice, job->align,
+                       &y0, &y1);
+    y0 += job->y0;
+    y1 += job->y0;
+    if (y0 >= y1)
+        return;
+
+    if (band->y0[index] != y0 || band->y1[index] != y1) {
+        band->y0[index] = y0;
+        band->y1[index] = y1;
+        band->pos_id_offset[index]++;
+    }
+
+    struct mp_image img = *job->img;
+    mp_image_crop(&img, 0, y0, img.w, y1);
+
+    // Pass all sub-bitmaps (the draw cache relies on stable indexes), moved
+    // into band coordinates. Parts outside of the band are clipped away.
+    struct sub_bitmaps b = *imgs;
+    b.bitmap_pos_id += band->pos_id_offset[index];
+    b.parts = talloc_array(NULL, struct sub_bitmap, imgs->num_parts);
+    for (int n = 0; n < imgs->num_parts; n++) {
+        b.parts[n] = imgs->parts[n];
+        b.parts[n].y -= y0;
+    }
+
+    mp_draw_sub_bitmaps(&band->cache, &img, &b);
+
+    talloc_free(b.parts);
+}
+
+static void draw_sub(void *ctx, struct sub_bitmaps *imgs)
+{
+    struct draw_job *job = ctx;
+    struct vf_priv_s *priv = job->priv;
+    struct mp_image *img = job->img;
+
+    struct mp_rect bb;
+    if (!mp_sub_bitmaps_bb(imgs, &bb))
+        return;
+    job->imgs = imgs;
+    job->align = img->fmt.align_y;
+    job->y0 = MP_ALIGN_DOWN(MPCLAMP(bb.y0, 0, img->h), job->align);
+    job->y1 = MPMIN(MP_ALIGN_UP(MPCLAMP(bb.y1, 0, img->h), job->align), img->h);
+    if (job->y0 >= job->y1)
+        return;
+
+    mp_image_pool_make_writeable(job->pool, img);
+
+    // Don't bother with bands of only a few lines.
+    int max_bands = MPMAX((job->y1 - job->y0) / 16, 1);
+    job->num_bands = MPMIN(priv->num_bands, max_bands);
+    mp_slice_threads_run(priv->threads, job->num_bands, draw_band, job);
+
+    // The caches are allocated by mp_draw_sub_bitmaps() on the band threads.
+    for (int n = 0; n < job->num_bands; n++)
+        talloc_steal(priv, priv->bands[n].cache);
+}
+
 static struct mp_image *filter(struct vf_instance *vf, struct mp_image *mpi)
 {
     struct vf_priv_s *priv = vf->priv;
@@ -102,8 +197,13 @@ static struct mp_image *filter(struct vf_instance *vf, struct mp_image *mpi)
         mpi = dmpi;
     }
 
-    osd_draw_on_image_p(osd, priv->dim, mpi->pts, OSD_DRAW_SUB_FILTER,
-                        vf->out_pool, mpi);
+    struct draw_job job = {
+        .priv = priv,
+        .img = mpi,
+        .pool = vf->out_pool,
+    };
+    osd_draw(osd, priv->dim, mpi->pts, OSD_DRAW_SUB_FILTER, mp_draw_sub_formats,
+             draw_sub, &job);
 
     return mpi;
 }
@@ -133,6 +233,11 @@ static int vf_open(vf_instance_t *vf)
     vf->query_format = query_format;
     vf->control   = control;
     vf->filter    = filter;
+    // Accesses the OSD state, which is owned by the playloop.
+    vf->no_pipeline = true;
+    vf->priv->threads = mp_slice_threads_create(vf, 0);
+    vf->priv->num_bands = mp_slice_threads_num(vf->priv->threads);
+    vf->priv->bands = talloc_zero_array(vf, struct band, vf->priv->num_bands);
     return 1;
 }
 
@@ -32,6 +32,7 @@
 #include "video/img_format.h"
 #include "video/mp_image.h"
 #include "vf.h"
+#include "slice_threads.h"
 #include "video/memcpy_pic.h"
 #include "libavutil/common.h"
 
@@ -45,13 +46,18 @@
 typedef struct FilterParam {
     int msizeX, msizeY;
     double amount;
-    uint32_t *SC[MAX_MATRIX_SIZE-1];
+    // Scratch buffers, one set for each slice (uint32_t for 8 bit input,
+    // uint64_t for 9-16 bit input)
+    void **SC;
 } FilterParam;
 
 struct vf_priv_s {
     FilterParam lumaParam;
     FilterParam chromaParam;
     struct vf_lw_opts *lw_opts;
+    struct mp_slice_threads *threads;
+    int num_slices;
+    int depth;
 };
 
 
@@ -67,11 +73,13 @@ Originally published Boston, Nov 98
 
 */
 
-static void unsharp( uint8_t *dst, uint8_t *src, int dstStride, int srcStride, int width, int height, FilterParam *fp ) {
+// Filter the lines [y0, y1) of the plane. The lines outside of this range are
+// read as context, so slices can be filtered concurrently (if dst != src).
+static void unsharp( uint8_t *dst, uint8_t *src, int dstStride, int srcStride, int width, int height, int y0, int y1, void **SCbuf, FilterParam *fp ) {
 
-    uint32_t **SC = fp->SC;
     uint32_t SR[MAX_MATRIX_SIZE-1], Tmp1, Tmp2;
-    uint8_t* src2 = src; // avoid gcc warning
+    uint32_t *SC[MAX_MATRIX_SIZE-1];
+    uint8_t* src2;
 
     int32_t res;
     int x, y, z;
@@ -84,19 +92,19 @@ static void unsharp( uint8_t *dst, uint8_t *src, int dstStride, int srcStride, i
     if( !fp->amount ) {
 	if( src == dst )
 	    return;
-	if( dstStride == srcStride )
-	    memcpy( dst, src, srcStride*height );
-	else
-	    for( y=0; y<height; y++, dst+=dstStride, src+=srcStride )
-		memcpy( dst, src, width );
+	memcpy_pic( dst + y0*dstStride, src + y0*srcStride, width, y1 - y0,
+		    dstStride, srcStride );
 	return;
     }
 
-    for( y=0; y<2*stepsY; y++ )
+    for( y=0; y<2*stepsY; y++ ) {
+	SC[y] = SCbuf[y];
 	memset( SC[y], 0, sizeof(SC[y][0]) * (width+2*stepsX) );
+    }
 
-    for( y=-stepsY; y<height+stepsY; y++ ) {
-	if( y < height ) src2 = src;
+    for( y=y0-stepsY; y<y1+stepsY; y++ ) {
+	// Lines outside of the image repeat the first/last line.
+	src2 = src + av_clip(y, 0, height-1)*srcStride;
 	memset( SR, 0, sizeof(SR[0]) * (2*stepsX-1) );
 	for( x=-stepsX; x<width+stepsX; x++ ) {
 	    Tmp1 = x<=0 ? src2[0] : x>=width ? src2[width-1] : src2[x];
@@ -108,102 +116,176 @@ static void unsharp( uint8_t *dst, uint8_t *src, int dstStride, int srcStride, i
 		Tmp2 = SC[z+0][x+stepsX] + Tmp1; SC[z+0][x+stepsX] = Tmp1;
 		Tmp1 = SC[z+1][x+stepsX] + Tmp2; SC[z+1][x+stepsX] = Tmp2;
 	    }
-	    if( x>=stepsX && y>=stepsY ) {
-		uint8_t* srx = src - stepsY*srcStride + x - stepsX;
-		uint8_t* dsx = dst - stepsY*dstStride + x - stepsX;
+	    if( x>=stepsX && y>=y0+stepsY ) {
+		uint8_t* srx = src + (y-stepsY)*srcStride + x - stepsX;
+		uint8_t* dsx = dst + (y-stepsY)*dstStride + x - stepsX;
 
 		res = (int32_t)*srx + ( ( ( (int32_t)*srx - (int32_t)((Tmp1+halfscale) >> scalebits) ) * amount ) >> 16 );
 		*dsx = res>255 ? 255 : res<0 ? 0 : (uint8_t)res;
 	    }
 	}
-	if( y >= 0 ) {
-	    dst += dstStride;
-	    src += srcStride;
+    }
+}
+
+// Same as unsharp(), for 9-16 bit samples. The accumulators need 64 bits,
+// because the filter gain is up to 2^(2*stepsX+2*stepsY).
+static void unsharp16( uint8_t *dst, uint8_t *src, int dstStride, int srcStride, int width, int height, int y0, int y1, void **SCbuf, FilterParam *fp, int depth ) {
+
+    uint64_t SR[MAX_MATRIX_SIZE-1], Tmp1, Tmp2;
+    uint64_t *SC[MAX_MATRIX_SIZE-1];
+    uint16_t* src2;
+
+    int64_t res;
+    int x, y, z;
+    int amount = fp->amount * 65536.0;
+    int stepsX = fp->msizeX/2;
+    int stepsY = fp->msizeY/2;
+    int scalebits = (stepsX+stepsY)*2;
+    int64_t halfscale = 1LL << ((stepsX+stepsY)*2-1);
+    int maxval = (1 << depth) - 1;
+
+    if( !fp->amount ) {
+	if( src == dst )
+	    return;
+	memcpy_pic( dst + y0*dstStride, src + y0*srcStride, width*2, y1 - y0,
+		    dstStride, srcStride );
+	return;
+    }
+
+    for( y=0; y<2*stepsY; y++ ) {
+	SC[y] = SCbuf[y];
+	memset( SC[y], 0, sizeof(SC[y][0]) * (width+2*stepsX) );
+    }
+
+    for( y=y0-stepsY; y<y1+stepsY; y++ ) {
+	src2 = (uint16_t *)(src + av_clip(y, 0, height-1)*srcStride);
+	memset( SR, 0, sizeof(SR[0]) * (2*stepsX-1) );
+	for( x=-stepsX; x<width+stepsX; x++ ) {
+	    Tmp1 = x<=0 ? src2[0] : x>=width ? src2[width-1] : src2[x];
+	    for( z=0; z<stepsX*2; z+=2 ) {
+		Tmp2 = SR[z+0] + Tmp1; SR[z+0] = Tmp1;
+		Tmp1 = SR[z+1] + Tmp2; SR[z+1] = Tmp2;
+	    }
+	    for( z=0; z<stepsY*2; z+=2 ) {
+		Tmp2 = SC[z+0][x+stepsX] + Tmp1; SC[z+0][x+stepsX] = Tmp1;
+		Tmp1 = SC[z+1][x+stepsX] + Tmp2; SC[z+1][x+stepsX] = Tmp2;
+	    }
+	    if( x>=stepsX && y>=y0+stepsY ) {
+		uint16_t* srx = (uint16_t *)(src + (y-stepsY)*srcStride) + x - stepsX;
+		uint16_t* dsx = (uint16_t *)(dst + (y-stepsY)*dstStride) + x - stepsX;
+
+		res = (int64_t)*srx + ( ( ( (int64_t)*srx - (int64_t)((Tmp1+halfscale) >> scalebits) ) * amount ) >> 16 );
+		*dsx = res>maxval ? maxval : res<0 ? 0 : (uint16_t)res;
+	    }
 	}
     }
 }
 
 //===========================================================================//
 
+static void uninit( struct vf_instance *vf );
+
+static void alloc_scratch( FilterParam *fp, int num_slices, int width, size_t elem_size ) {
+    int stepsX = fp->msizeX/2;
+    int stepsY = fp->msizeY/2;
+    fp->SC = av_mallocz(sizeof(fp->SC[0]) * num_slices * (MAX_MATRIX_SIZE-1));
+    for( int n=0; n<num_slices; n++ ) {
+	for( int z=0; z<2*stepsY; z++ ) {
+	    fp->SC[n*(MAX_MATRIX_SIZE-1) + z] =
+		av_malloc(elem_size * (width+2*stepsX));
+	}
+    }
+}
+
 static int config( struct vf_instance *vf,
 		   int width, int height, int d_width, int d_height,
 		   unsigned int flags, unsigned int outfmt ) {
 
-    int z, stepsX, stepsY;
-    FilterParam *fp;
+    uninit( vf );
 
     // allocate buffers
-
-    fp = &vf->priv->lumaParam;
-    memset( fp->SC, 0, sizeof( fp->SC ) );
-    stepsX = fp->msizeX/2;
-    stepsY = fp->msizeY/2;
-    for( z=0; z<2*stepsY; z++ )
-	fp->SC[z] = av_malloc(sizeof(*(fp->SC[z])) * (width+2*stepsX));
-
-    fp = &vf->priv->chromaParam;
-    memset( fp->SC, 0, sizeof( fp->SC ) );
-    stepsX = fp->msizeX/2;
-    stepsY = fp->msizeY/2;
-    for( z=0; z<2*stepsY; z++ )
-	fp->SC[z] = av_malloc(sizeof(*(fp->SC[z])) * (width+2*stepsX));
+    struct mp_imgfmt_desc desc = mp_imgfmt_get_desc( outfmt );
+    size_t elem_size = desc.plane_bits > 8 ? sizeof(uint64_t) : sizeof(uint32_t);
+    vf->priv->depth = desc.plane_bits;
+    vf->priv->num_slices = mp_slice_threads_num( vf->priv->threads );
+    alloc_scratch( &vf->priv->lumaParam, vf->priv->num_slices, width, elem_size );
+    alloc_scratch( &vf->priv->chromaParam, vf->priv->num_slices, width, elem_size );
 
     return vf_next_config( vf, width, height, d_width, d_height, flags, outfmt );
 }
 
 //===========================================================================//
 
+struct filter_job {
+    struct vf_priv_s *p;
+    struct mp_image *src, *dst;
+};
+
+static void filter_slice(void *ctx, int slice)
+{
+    struct filter_job *job = ctx;
+    struct vf_priv_s *p = job->p;
+    struct mp_image *mpi = job->src, *dmpi = job->dst;
+
+    for (int n = 0; n < 3; n++) {
+        FilterParam *fp = n ? &p->chromaParam : &p->lumaParam;
+        int w = n ? mpi->w >> mpi->chroma_x_shift : mpi->w;
+        int h = n ? mpi->h >> mpi->chroma_y_shift : mpi->h;
+        void **SC = &fp->SC[slice*(MAX_MATRIX_SIZE-1)];
+        int y0, y1;
+        mp_slice_get_range(h, p->num_slices, slice, 1, &y0, &y1);
+        if (y0 >= y1)
+            continue;
+        if (p->depth > 8) {
+            unsharp16( dmpi->planes[n], mpi->planes[n], dmpi->stride[n], mpi->stride[n],
+                       w, h, y0, y1, SC, fp, p->depth );
+        } else {
+            unsharp( dmpi->planes[n], mpi->planes[n], dmpi->stride[n], mpi->stride[n],
+                     w, h, y0, y1, SC, fp );
+        }
+    }
+}
+
 static struct mp_image *filter(struct vf_instance *vf, struct mp_image *mpi)
 {
     struct mp_image *dmpi = mpi;
-    if (!mp_image_is_writeable(mpi)) {
+    // Filtering in-place reads already filtered lines of neighbouring slices.
+    if (!mp_image_is_writeable(mpi) || vf->priv->num_slices > 1) {
         dmpi = vf_alloc_out_image(vf);
         mp_image_copy_attributes(dmpi, mpi);
     }
 
-    unsharp( dmpi->planes[0], mpi->planes[0], dmpi->stride[0], mpi->stride[0], mpi->w,   mpi->h,   &vf->priv->lumaParam );
-    unsharp( dmpi->planes[1], mpi->planes[1], dmpi->stride[1], mpi->stride[1], mpi->w/2, mpi->h/2, &vf->priv->chromaParam );
-    unsharp( dmpi->planes[2], mpi->planes[2], dmpi->stride[2], mpi->stride[2], mpi->w/2, mpi->h/2, &vf->priv->chromaParam );
-
-#if HAVE_MMX
-    if(gCpuCaps.hasMMX)
-	__asm__ volatile ("emms\n\t");
-#endif
-#if HAVE_MMX2
-    if(gCpuCaps.hasMMX2)
-	__asm__ volatile ("sfence\n\t");
-#endif
+    struct filter_job job = { vf->priv, mpi, dmpi };
+    mp_slice_threads_run(vf->priv->threads, vf->priv->num_slices,
+                         filter_slice, &job);
 
     if (dmpi != mpi)
         talloc_free(mpi);
     return dmpi;
 }
 
-static void uninit( struct vf_instance *vf ) {
-    unsigned int z;
-    FilterParam *fp;
+static void free_scratch( FilterParam *fp, int num_slices ) {
+    if( !fp->SC ) return;
+    for( int z=0; z<num_slices*(MAX_MATRIX_SIZE-1); z++ )
+	av_free( fp->SC[z] );
+    av_freep( &fp->SC );
+}
 
+static void uninit( struct vf_instance *vf ) {
     if( !vf->priv ) return;
 
-    fp = &vf->priv->lumaParam;
-    for( z=0; z<sizeof(fp->SC)/sizeof(fp->SC[0]); z++ ) {
-	av_free( fp->SC[z] );
-	fp->SC[z] = NULL;
-    }
-    fp = &vf->priv->chromaParam;
-    for( z=0; z<sizeof(fp->SC)/sizeof(fp->SC[0]); z++ ) {
-	av_free( fp->SC[z] );
-	fp->SC[z] = NULL;
-    }
+    free_scratch( &vf->priv->lumaParam, vf->priv->num_slices );
+    free_scratch( &vf->priv->chromaParam, vf->priv->num_slices );
 }
 
 //===========================================================================//
 
 static int query_format( struct vf_instance *vf, unsigned int fmt ) {
-    switch(fmt) {
-    case IMGFMT_420P:
-	return vf_next_query_format( vf, IMGFMT_420P );
-    }
+    // 8 bit and 9-16 bit native endian planar YUV
+    struct mp_imgfmt_desc desc = mp_imgfmt_get_desc( fmt );
+    if( (desc.flags & MP_IMGFLAG_YUV_P) && (desc.flags & MP_IMGFLAG_NE) &&
+        desc.num_planes == 3 && desc.plane_bits >= 8 && desc.plane_bits <= 16 )
+	return vf_next_query_format( vf, fmt );
     return 0;
 }
 
@@ -227,6 +309,8 @@ static int vf_open( vf_instance_t *vf) {
         return 1;
     }
 
+    p->threads = mp_slice_threads_create(vf, 0);
+
     return 1;
 }
 
@@ -358,6 +358,187 @@ static void filter_line_c(struct vf_priv_s *p, uint8_t *dst, uint8_t *prev, uint
     }
 }
 
+#if HAVE_X86_INTRINSICS
+#include <immintrin.h>
+
+// The SIMD versions compute the same thing as filter_line_c() on 16 bit
+// lanes, 8 (SSE2) or 16 (AVX2) pixels at a time. The tail of the line is
+// left to the C version, so nothing is written past w.
+
+#define LOAD8(p) _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p)), zero)
+#define ABS8(a, b) _mm_max_epi16(_mm_sub_epi16(a, b), _mm_sub_epi16(b, a))
+#define ABSDIFF8(a, b) ABS8(LOAD8(a), LOAD8(b))
+#define SCORE8(j) \
+    _mm_add_epi16(_mm_add_epi16(ABSDIFF8(&cur[-refs-1+(j)], &cur[+refs-1-(j)]), \
+                                ABSDIFF8(&cur[-refs  +(j)], &cur[+refs  -(j)])), \
+                                ABSDIFF8(&cur[-refs+1+(j)], &cur[+refs+1-(j)]))
+#define PRED8(j) \
+    _mm_srli_epi16(_mm_add_epi16(LOAD8(&cur[-refs+(j)]), LOAD8(&cur[+refs-(j)])), 1)
+#define BLEND8(mask, a, b) \
+    _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b))
+
+__attribute__((target("sse2")))
+static void filter_line_sse2(struct vf_priv_s *p, uint8_t *dst, uint8_t *prev, uint8_t *cur, uint8_t *next, int w, int refs, int parity){
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+    uint8_t *prev2= parity ? prev : cur ;
+    uint8_t *next2= parity ? cur  : next;
+    int x;
+
+    for(x=0; x+8<=w; x+=8){
+        __m128i c= LOAD8(&cur[-refs]);
+        __m128i e= LOAD8(&cur[+refs]);
+        __m128i p2= LOAD8(prev2);
+        __m128i n2= LOAD8(next2);
+        __m128i d= _mm_srli_epi16(_mm_add_epi16(p2, n2), 1);
+        __m128i temporal_diff0= ABS8(p2, n2);
+        __m128i temporal_diff1= _mm_srli_epi16(_mm_add_epi16(ABS8(LOAD8(&prev[-refs]), c),
+                                                             ABS8(LOAD8(&prev[+refs]), e)), 1);
+        __m128i temporal_diff2= _mm_srli_epi16(_mm_add_epi16(ABS8(LOAD8(&next[-refs]), c),
+                                                             ABS8(LOAD8(&next[+refs]), e)), 1);
+        __m128i diff= _mm_max_epi16(_mm_max_epi16(_mm_srli_epi16(temporal_diff0, 1),
+                                                  temporal_diff1), temporal_diff2);
+        __m128i spatial_pred= _mm_srli_epi16(_mm_add_epi16(c, e), 1);
+        __m128i spatial_score= _mm_sub_epi16(SCORE8(0), one);
+        __m128i score, better, better2;
+
+        score= SCORE8(-1);
+        better= _mm_cmplt_epi16(score, spatial_score);
+        spatial_score= _mm_min_epi16(score, spatial_score);
+        spatial_pred= BLEND8(better, PRED8(-1), spatial_pred);
+        score= SCORE8(-2);
+        better2= _mm_and_si128(better, _mm_cmplt_epi16(score, spatial_score));
+        spatial_score= BLEND8(better2, score, spatial_score);
+        spatial_pred= BLEND8(better2, PRED8(-2), spatial_pred);
+
+        score= SCORE8(1);
+        better= _mm_cmplt_epi16(score, spatial_score);
+        spatial_score= _mm_min_epi16(score, spatial_score);
+        spatial_pred= BLEND8(better, PRED8(1), spatial_pred);
+        score= SCORE8(2);
+        better2= _mm_and_si128(better, _mm_cmplt_epi16(score, spatial_score));
+        spatial_pred= BLEND8(better2, PRED8(2), spatial_pred);
+
+        if(p->mode<2){
+            __m128i b= _mm_srli_epi16(_mm_add_epi16(LOAD8(&prev2[-2*refs]), LOAD8(&next2[-2*refs])), 1);
+            __m128i f= _mm_srli_epi16(_mm_add_epi16(LOAD8(&prev2[+2*refs]), LOAD8(&next2[+2*refs])), 1);
+            __m128i dc= _mm_sub_epi16(d, c), de= _mm_sub_epi16(d, e);
+            __m128i bc= _mm_sub_epi16(b, c), fe= _mm_sub_epi16(f, e);
+            __m128i max= _mm_max_epi16(_mm_max_epi16(de, dc), _mm_min_epi16(bc, fe));
+            __m128i min= _mm_min_epi16(_mm_min_epi16(de, dc), _mm_max_epi16(bc, fe));
+            diff= _mm_max_epi16(_mm_max_epi16(diff, min), _mm_sub_epi16(zero, max));
+        }
+
+        spatial_pred= _mm_min_epi16(_mm_max_epi16(spatial_pred, _mm_sub_epi16(d, diff)),
+                                    _mm_add_epi16(d, diff));
+        _mm_storel_epi64((__m128i *)dst, _mm_packus_epi16(spatial_pred, spatial_pred));
+
+        dst  += 8;
+        cur  += 8;
+        prev += 8;
+        next += 8;
+        prev2+= 8;
+        next2+= 8;
+    }
+    if(x < w)
+        filter_line_c(p, dst, prev, cur, next, w - x, refs, parity);
+}
+
+#undef LOAD8
+#undef ABS8
+#undef ABSDIFF8
+#undef SCORE8
+#undef PRED8
+#undef BLEND8
+
+#define LOAD16(p) _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(p)))
+#define ABSDIFF16(a, b) _mm256_abs_epi16(_mm256_sub_epi16(LOAD16(a), LOAD16(b)))
+#define SCORE16(j) \
+    _mm256_add_epi16(_mm256_add_epi16(ABSDIFF16(&cur[-refs-1+(j)], &cur[+refs-1-(j)]), \
+                                      ABSDIFF16(&cur[-refs  +(j)], &cur[+refs  -(j)])), \
+                                      ABSDIFF16(&cur[-refs+1+(j)], &cur[+refs+1-(j)]))
+#define PRED16(j) \
+    _mm256_srli_epi16(_mm256_add_epi16(LOAD16(&cur[-refs+(j)]), LOAD16(&cur[+refs-(j)])), 1)
+
+__attribute__((target("avx2")))
+static void filter_line_avx2(struct vf_priv_s *p, uint8_t *dst, uint8_t *prev, uint8_t *cur, uint8_t *next, int w, int refs, int parity){
+    const __m256i one = _mm256_set1_epi16(1);
+    uint8_t *prev2= parity ? prev : cur ;
+    uint8_t *next2= parity ? cur  : next;
+    int x;
+
+    for(x=0; x+16<=w; x+=16){
+        __m256i c= LOAD16(&cur[-refs]);
+        __m256i e= LOAD16(&cur[+refs]);
+        __m256i p2= LOAD16(prev2);
+        __m256i n2= LOAD16(next2);
+        __m256i d= _mm256_srli_epi16(_mm256_add_epi16(p2, n2), 1);
+        __m256i temporal_diff0= _mm256_abs_epi16(_mm256_sub_epi16(p2, n2));
+        __m256i temporal_diff1= _mm256_srli_epi16(_mm256_add_epi16(
+            _mm256_abs_epi16(_mm256_sub_epi16(LOAD16(&prev[-refs]), c)),
+            _mm256_abs_epi16(_mm256_sub_epi16(LOAD16(&prev[+refs]), e))), 1);
+        __m256i temporal_diff2= _mm256_srli_epi16(_mm256_add_epi16(
+            _mm256_abs_epi16(_mm256_sub_epi16(LOAD16(&next[-refs]), c)),
+            _mm256_abs_epi16(_mm256_sub_epi16(LOAD16(&next[+refs]), e))), 1);
+        __m256i diff= _mm256_max_epi16(_mm256_max_epi16(_mm256_srli_epi16(temporal_diff0, 1),
+                                                        temporal_diff1), temporal_diff2);
+        __m256i spatial_pred= _mm256_srli_epi16(_mm256_add_epi16(c, e), 1);
+        __m256i spatial_score= _mm256_sub_epi16(SCORE16(0), one);
+        __m256i score, better, better2;
+        __m128i res;
+
+        score= SCORE16(-1);
+        better= _mm256_cmpgt_epi16(spatial_score, score);
+        spatial_score= _mm256_min_epi16(score, spatial_score);
+        spatial_pred= _mm256_blendv_epi8(spatial_pred, PRED16(-1), better);
+        score= SCORE16(-2);
+        better2= _mm256_and_si256(better, _mm256_cmpgt_epi16(spatial_score, score));
+        spatial_score= _mm256_blendv_epi8(spatial_score, score, better2);
+        spatial_pred= _mm256_blendv_epi8(spatial_pred, PRED16(-2), better2);
+
+        score= SCORE16(1);
+        better= _mm256_cmpgt_epi16(spatial_score, score);
+        spatial_score= _mm256_min_epi16(score, spatial_score);
+        spatial_pred= _mm256_blendv_epi8(spatial_pred, PRED16(1), better);
+        score= SCORE16(2);
+        better2= _mm256_and_si256(better, _mm256_cmpgt_epi16(spatial_score, score));
+        spatial_pred= _mm256_blendv_epi8(spatial_pred, PRED16(2), better2);
+
+        if(p->mode<2){
+            __m256i b= _mm256_srli_epi16(_mm256_add_epi16(LOAD16(&prev2[-2*refs]), LOAD16(&next2[-2*refs])), 1);
+            __m256i f= _mm256_srli_epi16(_mm256_add_epi16(LOAD16(&prev2[+2*refs]), LOAD16(&next2[+2*refs])), 1);
+            __m256i dc= _mm256_sub_epi16(d, c), de= _mm256_sub_epi16(d, e);
+            __m256i bc= _mm256_sub_epi16(b, c), fe= _mm256_sub_epi16(f, e);
+            __m256i max= _mm256_max_epi16(_mm256_max_epi16(de, dc), _mm256_min_epi16(bc, fe));
+            __m256i min= _mm256_min_epi16(_mm256_min_epi16(de, dc), _mm256_max_epi16(bc, fe));
+            diff= _mm256_max_epi16(_mm256_max_epi16(diff, min),
+                                   _mm256_sub_epi16(_mm256_setzero_si256(), max));
+        }
+
+        spatial_pred= _mm256_min_epi16(_mm256_max_epi16(spatial_pred, _mm256_sub_epi16(d, diff)),
+                                       _mm256_add_epi16(d, diff));
+        res= _mm_packus_epi16(_mm256_castsi256_si128(spatial_pred),
+                              _mm256_extracti128_si256(spatial_pred, 1));
+        _mm_storeu_si128((__m128i *)dst, res);
+
+        dst  += 16;
+        cur  += 16;
+        prev += 16;
+        next += 16;
+        prev2+= 16;
+        next2+= 16;
+    }
+    if(x < w)
+        filter_line_c(p, dst, prev, cur, next, w - x, refs, parity);
+}
+
+#undef LOAD16
+#undef ABSDIFF16
+#undef SCORE16
+#undef PRED16
+
+#endif /* HAVE_X86_INTRINSICS */
+
 static void filter(struct vf_priv_s *p, uint8_t *dst[3], int dst_stride[3], int width, int height, int parity, int tff){
     int y, i;
 
@@ -516,6 +697,10 @@ static int vf_open(vf_instance_t *vf){
 #if HAVE_MMX
     if(gCpuCaps.hasMMX2) filter_line = filter_line_mmx2;
 #endif
+#if HAVE_X86_INTRINSICS
+    if(gCpuCaps.hasSSE2) filter_line = filter_line_sse2;
+    if(gCpuCaps.hasAVX2) filter_line = filter_line_avx2;
+#endif
 
     return 1;
 }
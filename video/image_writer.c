@@ -19,6 +19,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <setjmp.h>
+#include <assert.h>
+#include <pthread.h>
 
 #include <libavcodec/avcodec.h>
 #include <libavutil/mem.h>
@@ -32,9 +34,11 @@
 #endif
 
 #include "osdep/io.h"
+#include "osdep/numcores.h"
 
 #include "image_writer.h"
 #include "talloc.h"
+#include "common/common.h"
 #include "video/img_format.h"
 #include "video/mp_image.h"
 #include "video/fmt-conversion.h"
@@ -84,8 +88,24 @@ struct img_writer {
     int (*write)(struct image_writer_ctx *ctx, mp_image_t *image, FILE *fp);
     int *pixfmts;
     int lavc_codec;
+    bool any_format;    // write the image in its own pixel format
 };
 
+// Planes in their own pixel format, each packed without padding, and no
+// header. The fastest option, but the reader must know format and size.
+static int write_raw(struct image_writer_ctx *ctx, mp_image_t *image, FILE *fp)
+{
+    for (int n = 0; n < image->num_planes; n++) {
+        size_t line = (image->plane_w[n] * (size_t)image->fmt.bpp[n] + 7) / 8;
+        for (int y = 0; y < image->plane_h[n]; y++) {
+            uint8_t *src = image->planes[n] + y * (ptrdiff_t)image->stride[n];
+            if (fwrite(src, line, 1, fp) != 1)
+                return 0;
+        }
+    }
+    return 1;
+}
+
 static int write_lavc(struct image_writer_ctx *ctx, mp_image_t *image, FILE *fp)
 {
     int success = 0;
@@ -235,6 +255,7 @@ static const struct img_writer img_writers[] = {
     { "jpg", write_jpeg },
     { "jpeg", write_jpeg },
 #endif
+    { "raw", write_raw, .any_format = true },
 };
 
 static const struct img_writer *get_writer(const struct image_writer_opts *opts)
@@ -276,7 +297,11 @@ int write_image(struct mp_image *image, const struct image_writer_opts *opts,
     struct image_writer_ctx ctx = { log, opts, writer };
     int destfmt = IMGFMT_RGB24;
 
-    if (writer->pixfmts) {
+    if (writer->any_format) {
+        // Written as stored, without scaling to the display size either.
+        destfmt = image->imgfmt;
+        is_anamorphic = false;
+    } else if (writer->pixfmts) {
         destfmt = writer->pixfmts[0];   // default to first pixel format
         for (int *fmt = writer->pixfmts; *fmt; fmt++) {
             if (*fmt == image->imgfmt) {
@@ -320,3 +345,163 @@ void dump_png(struct mp_image *image, const char *filename, struct mp_log *log)
     opts.format = "png";
     write_image(image, &opts, filename, log);
 }
+
+struct image_writer_job {
+    struct mp_image *image;
+    struct image_writer_opts opts;
+    char *filename;
+    bool busy;
+};
+
+struct image_writer_queue {
+    struct mp_log *log;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;      // new job, or termination
+    pthread_cond_t done;        // a job was finished
+
+    pthread_t *workers;
+    int num_workers;
+    bool terminate;
+
+    // Queued and busy jobs, in submission order (protected by lock)
+    struct image_writer_job **jobs;
+    int num_jobs;
+    int max_jobs;
+};
+
+static struct image_writer_job *next_job(struct image_writer_queue *q)
+{
+    for (int n = 0; n < q->num_jobs; n++) {
+        if (!q->jobs[n]->busy)
+            return q->jobs[n];
+    }
+    return NULL;
+}
+
+static void *queue_thread(void *arg)
+{
+    struct image_writer_queue *q = arg;
+    pthread_mutex_lock(&q->lock);
+    while (1) {
+        struct image_writer_job *job = next_job(q);
+        if (!job) {
+            if (q->terminate)
+                break;
+            pthread_cond_wait(&q->wakeup, &q->lock);
+            continue;
+        }
+        job->busy = true;
+        pthread_mutex_unlock(&q->lock);
+        write_image(job->image, &job->opts, job->filename, q->log);
+        pthread_mutex_lock(&q->lock);
+        for (int n = 0; n < q->num_jobs; n++) {
+            if (q->jobs[n] == job) {
+                MP_TARRAY_REMOVE_AT(q->jobs, q->num_jobs, n);
+                break;
+            }
+        }
+        talloc_free(job);
+        pthread_cond_broadcast(&q->done);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+static void destroy_queue(void *ptr)
+{
+    struct image_writer_queue *q = ptr;
+    // The workers write all remaining images before exiting.
+    pthread_mutex_lock(&q->lock);
+    q->terminate = true;
+    pthread_cond_broadcast(&q->wakeup);
+    pthread_mutex_unlock(&q->lock);
+    for (int n = 0; n < q->num_workers; n++)
+        pthread_join(q->workers[n], NULL);
+    for (int n = 0; n < q->num_jobs; n++)
+        talloc_free(q->jobs[n]);
+    pthread_cond_destroy(&q->done);
+    pthread_cond_destroy(&q->wakeup);
+    pthread_mutex_destroy(&q->lock);
+}
+
+// Create a queue that writes images with num_threads worker threads (number of
+// CPU cores if <= 0). At most max_pending images are buffered. Freeing the
+// returned object with talloc_free() waits until all images are written.
+struct image_writer_queue *image_writer_queue_create(void *ta_parent,
+                                                     struct mp_log *log,
+                                                     int num_threads,
+                                                     int max_pending)
+{
+    if (num_threads <= 0)
+        num_threads = default_thread_count();
+    num_threads = MPMAX(num_threads, 1);
+
+    struct image_writer_queue *q =
+        talloc_zero(ta_parent, struct image_writer_queue);
+    q->log = log;
+    q->max_jobs = MPMAX(max_pending, 1);
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->wakeup, NULL);
+    pthread_cond_init(&q->done, NULL);
+    talloc_set_destructor(q, destroy_queue);
+
+    q->workers = talloc_array(q, pthread_t, num_threads);
+    for (int n = 0; n < num_threads; n++) {
+        if (pthread_create(&q->workers[q->num_workers], NULL, queue_thread, q))
+            break;
+        q->num_workers++;
+    }
+    return q;
+}
+
+// Like write_image(), but write the image on a worker thread. This takes
+// ownership of the image, which must not be written to anymore. Blocks while
+// the queue is full. Errors are only logged.
+void image_writer_queue_add(struct image_writer_queue *q,
+                            struct mp_image *image,
+                            const struct image_writer_opts *opts,
+                            const char *filename)
+{
+    if (!q->num_workers) {
+        write_image(image, opts, filename, q->log);
+        talloc_free(image);
+        return;
+    }
+
+    struct image_writer_job *job = talloc_ptrtype(NULL, job);
+    *job = (struct image_writer_job) {
+        .image = talloc_steal(job, image),
+        .opts = opts ? *opts : image_writer_opts_defaults,
+        .filename = talloc_strdup(job, filename),
+    };
+    job->opts.format = talloc_strdup(job, job->opts.format);
+
+    pthread_mutex_lock(&q->lock);
+    while (q->num_jobs >= q->max_jobs)
+        pthread_cond_wait(&q->done, &q->lock);
+    MP_TARRAY_APPEND(q, q->jobs, q->num_jobs, job);
+    pthread_cond_signal(&q->wakeup);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// Return whether an image for this filename is queued or being written.
+bool image_writer_queue_has_file(struct image_writer_queue *q,
+                                 const char *filename)
+{
+    bool found = false;
+    pthread_mutex_lock(&q->lock);
+    for (int n = 0; n < q->num_jobs; n++)
+        found |= strcmp(q->jobs[n]->filename, filename) == 0;
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
+// Block until all queued images have been written.
+void image_writer_queue_flush(struct image_writer_queue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->num_jobs)
+        pthread_cond_wait(&q->done, &q->lock);
+    pthread_mutex_unlock(&q->lock);
+}
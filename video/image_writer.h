@@ -15,6 +15,8 @@
  * with mplayer.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdbool.h>
+
 struct mp_image;
 struct mp_log;
 
@@ -52,3 +54,18 @@ int write_image(struct mp_image *image, const struct image_writer_opts *opts,
 
 // Debugging helper.
 void dump_png(struct mp_image *image, const char *filename, struct mp_log *log);
+
+// Writes images on background threads, see image_writer.c.
+struct image_writer_queue;
+
+struct image_writer_queue *image_writer_queue_create(void *ta_parent,
+                                                     struct mp_log *log,
+                                                     int num_threads,
+                                                     int max_pending);
+void image_writer_queue_add(struct image_writer_queue *q,
+                            struct mp_image *image,
+                            const struct image_writer_opts *opts,
+                            const char *filename);
+bool image_writer_queue_has_file(struct image_writer_queue *q,
+                                 const char *filename);
+void image_writer_queue_flush(struct image_writer_queue *q);
@@ -0,0 +1,225 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "config.h"
+#include "common/common.h"
+#include "common/cpudetect.h"
+#include "video/filter/slice_threads.h"
+
+#include "memcpy_pic.h"
+
+// Below this, streaming stores and threads aren't worth the setup costs.
+#define MIN_STREAM_BYTES (64 * 1024)
+#define MIN_THREADS_BYTES (4 * 1024 * 1024)
+
+#if HAVE_X86_INTRINSICS
+#include <immintrin.h>
+
+// Copy with non-temporal stores, which bypass the cache. Only the destination
+// has to be aligned, and memcpy() deals with the unaligned head and tail.
+__attribute__((target("sse2")))
+static void memcpy_stream_sse2(uint8_t *dst, const uint8_t *src, size_t size)
+{
+    size_t head = MPMIN((16 - ((uintptr_t)dst & 15)) & 15, size);
+    memcpy(dst, src, head);
+    size_t x = head;
+    for (; x + 64 <= size; x += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + x));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + x + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(src + x + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *)(src + x + 48));
+        _mm_stream_si128((__m128i *)(dst + x), a);
+        _mm_stream_si128((__m128i *)(dst + x + 16), b);
+        _mm_stream_si128((__m128i *)(dst + x + 32), c);
+        _mm_stream_si128((__m128i *)(dst + x + 48), d);
+    }
+    for (; x + 16 <= size; x += 16) {
+        _mm_stream_si128((__m128i *)(dst + x),
+                         _mm_loadu_si128((const __m128i *)(src + x)));
+    }
+    memcpy(dst + x, src + x, size - x);
+}
+
+__attribute__((target("sse2")))
+static void memset_stream_sse2(uint8_t *dst, int fill, size_t size)
+{
+    size_t head = MPMIN((16 - ((uintptr_t)dst & 15)) & 15, size);
+    memset(dst, fill, head);
+    __m128i v = _mm_set1_epi8(fill);
+    size_t x = head;
+    for (; x + 16 <= size; x += 16)
+        _mm_stream_si128((__m128i *)(dst + x), v);
+    memset(dst + x, fill, size - x);
+}
+
+__attribute__((target("sse2")))
+static void stream_fence(void)
+{
+    _mm_sfence();
+}
+#endif
+
+static bool use_stream(int flags, size_t size)
+{
+#if HAVE_X86_INTRINSICS
+    return (flags & MP_COPY_STREAM) && size >= MIN_STREAM_BYTES &&
+           gCpuCaps.hasSSE2;
+#else
+    return false;
+#endif
+}
+
+static void copy_lines(uint8_t *dst, const uint8_t *src, int bytes, int height,
+                       int dst_stride, int src_stride, bool stream)
+{
+#if HAVE_X86_INTRINSICS
+    if (stream) {
+        if (bytes == dst_stride && dst_stride == src_stride) {
+            memcpy_stream_sse2(dst, src, (size_t)bytes * height);
+        } else {
+            for (int y = 0; y < height; y++) {
+                memcpy_stream_sse2(dst + y * (ptrdiff_t)dst_stride,
+                                   src + y * (ptrdiff_t)src_stride, bytes);
+            }
+        }
+        return;
+    }
+#endif
+    memcpy_pic(dst, src, bytes, height, dst_stride, src_stride);
+}
+
+static void set_lines(uint8_t *dst, int fill, int bytes, int height,
+                      int stride, bool stream)
+{
+#if HAVE_X86_INTRINSICS
+    if (stream) {
+        if (bytes == stride) {
+            memset_stream_sse2(dst, fill, (size_t)bytes * height);
+        } else {
+            for (int y = 0; y < height; y++)
+                memset_stream_sse2(dst + y * (ptrdiff_t)stride, fill, bytes);
+        }
+        return;
+    }
+#endif
+    memset_pic(dst, fill, bytes, height, stride);
+}
+
+// Shared by all users. Used only if no other copy is running on it at the
+// same time (mp_slice_threads_run() is not reentrant); otherwise the copy is
+// done on the calling thread.
+static pthread_once_t threads_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct mp_slice_threads *copy_threads;
+
+static void init_copy_threads(void)
+{
+    copy_threads = mp_slice_threads_create(NULL, 0);
+}
+
+struct pic_job {
+    uint8_t *dst;
+    const uint8_t *src;
+    int fill;
+    int bytes, height;
+    int dst_stride, src_stride;
+    bool stream;
+    int num_slices;
+};
+
+static void copy_slice(void *ctx, int slice)
+{
+    struct pic_job *job = ctx;
+    int y0, y1;
+    mp_slice_get_range(job->height, job->num_slices, slice, 1, &y0, &y1);
+    uint8_t *dst = job->dst + y0 * (ptrdiff_t)job->dst_stride;
+    if (job->src) {
+        copy_lines(dst, job->src + y0 * (ptrdiff_t)job->src_stride, job->bytes,
+                   y1 - y0, job->dst_stride, job->src_stride, job->stream);
+    } else {
+        set_lines(dst, job->fill, job->bytes, y1 - y0, job->dst_stride,
+                  job->stream);
+    }
+#if HAVE_X86_INTRINSICS
+    if (job->stream)
+        stream_fence();
+#endif
+}
+
+// Run the job split into horizontal slices on the shared threads. Returns
+// false if that is not possible or not worth it.
+static bool run_threaded(struct pic_job *job, int flags)
+{
+    if (!(flags & MP_COPY_THREADS) ||
+        (size_t)job->bytes * job->height < MIN_THREADS_BYTES)
+        return false;
+    pthread_once(&threads_once, init_copy_threads);
+    if (!copy_threads || pthread_mutex_trylock(&threads_lock))
+        return false;
+    job->num_slices = MPMIN(mp_slice_threads_num(copy_threads), job->height);
+    mp_slice_threads_run(copy_threads, job->num_slices, copy_slice, job);
+    pthread_mutex_unlock(&threads_lock);
+    return true;
+}
+
+// Like memcpy_pic(), but with MP_COPY_* flags.
+void memcpy_pic_ex(void *dst, const void *src, int bytesPerLine, int height,
+                   int dstStride, int srcStride, int flags)
+{
+    struct pic_job job = {
+        .dst = dst,
+        .src = src,
+        .bytes = bytesPerLine,
+        .height = height,
+        .dst_stride = dstStride,
+        .src_stride = srcStride,
+        .stream = use_stream(flags, (size_t)bytesPerLine * height),
+    };
+    if (!run_threaded(&job, flags)) {
+        copy_lines(dst, src, bytesPerLine, height, dstStride, srcStride,
+                   job.stream);
+    }
+#if HAVE_X86_INTRINSICS
+    // Make the non-temporal stores visible to other threads/devices.
+    if (job.stream)
+        stream_fence();
+#endif
+}
+
+// Like memset_pic(), but with MP_COPY_* flags.
+void memset_pic_ex(void *dst, int fill, int bytesPerLine, int height,
+                   int stride, int flags)
+{
+    struct pic_job job = {
+        .dst = dst,
+        .fill = fill,
+        .bytes = bytesPerLine,
+        .height = height,
+        .dst_stride = stride,
+        .stream = use_stream(flags, (size_t)bytesPerLine * height),
+    };
+    if (!run_threaded(&job, flags))
+        set_lines(dst, fill, bytesPerLine, height, stride, job.stream);
+#if HAVE_X86_INTRINSICS
+    if (job.stream)
+        stream_fence();
+#endif
+}
@@ -76,4 +76,16 @@ static inline void memset16_pic(void *dst, int fill, int unitsPerLine,
     }
 }
 
+// Flags for memcpy_pic_ex() and memset_pic_ex(). They affect only large images.
+// The destination won't be read by the CPU soon (e.g. it's mapped GPU memory):
+// use non-temporal stores, which don't evict other data from the caches.
+#define MP_COPY_STREAM 1
+// Split the operation across multiple threads.
+#define MP_COPY_THREADS 2
+
+void memcpy_pic_ex(void *dst, const void *src, int bytesPerLine, int height,
+                   int dstStride, int srcStride, int flags);
+void memset_pic_ex(void *dst, int fill, int bytesPerLine, int height,
+                   int stride, int flags);
+
 #endif /* MPLAYER_FASTMEMCPY_H */
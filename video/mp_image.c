@@ -320,20 +320,52 @@ void mp_image_unrefp(struct mp_image **p_img)
     *p_img = NULL;
 }
 
-void mp_image_copy(struct mp_image *dst, struct mp_image *src)
+// If all planes of the image directly follow each other in memory, without
+// any padding, return the total size. Otherwise return 0.
+static size_t get_contiguous_size(struct mp_image *img)
+{
+    size_t size = 0;
+    for (int n = 0; n < img->num_planes; n++) {
+        int line_bytes = (img->plane_w[n] * img->fmt.bpp[n] + 7) / 8;
+        if (line_bytes != img->stride[n] || img->planes[n] != img->planes[0] + size)
+            return 0;
+        size += (size_t)img->stride[n] * img->plane_h[n];
+    }
+    return size;
+}
+
+// flags: MP_COPY_* flags from memcpy_pic.h
+void mp_image_copy_ex(struct mp_image *dst, struct mp_image *src, int flags)
 {
     assert(dst->imgfmt == src->imgfmt);
     assert(dst->w == src->w && dst->h == src->h);
     assert(mp_image_is_writeable(dst));
-    for (int n = 0; n < dst->num_planes; n++) {
-        int line_bytes = (dst->plane_w[n] * dst->fmt.bpp[n] + 7) / 8;
-        memcpy_pic(dst->planes[n], src->planes[n], line_bytes, dst->plane_h[n],
-                   dst->stride[n], src->stride[n]);
+    size_t size = get_contiguous_size(dst);
+    if (size && size == get_contiguous_size(src)) {
+        // Copy all planes at once. Split into fixed size "lines", so that
+        // large copies can still be sliced for threading.
+        const int chunk = 64 * 1024;
+        size_t rest = size % chunk;
+        memcpy_pic_ex(dst->planes[0], src->planes[0], chunk, size / chunk,
+                      chunk, chunk, flags);
+        memcpy(dst->planes[0] + size - rest, src->planes[0] + size - rest, rest);
+    } else {
+        for (int n = 0; n < dst->num_planes; n++) {
+            int line_bytes = (dst->plane_w[n] * dst->fmt.bpp[n] + 7) / 8;
+            memcpy_pic_ex(dst->planes[n], src->planes[n], line_bytes,
+                          dst->plane_h[n], dst->stride[n], src->stride[n],
+                          flags);
+        }
     }
     if (dst->fmt.flags & MP_IMGFLAG_PAL)
         memcpy(dst->planes[1], src->planes[1], MP_PALETTE_SIZE);
 }
 
+void mp_image_copy(struct mp_image *dst, struct mp_image *src)
+{
+    mp_image_copy_ex(dst, src, MP_COPY_THREADS);
+}
+
 void mp_image_copy_attributes(struct mp_image *dst, struct mp_image *src)
 {
     dst->pict_type = src->pict_type;
@@ -410,8 +442,8 @@ void mp_image_clear(struct mp_image *img, int x0, int y0, int x1, int y1)
         int bpp = area.fmt.bpp[p];
         int bytes = (area.plane_w[p] * bpp + 7) / 8;
         if (bpp <= 8) {
-            memset_pic(area.planes[p], plane_clear[p], bytes,
-                       area.plane_h[p], area.stride[p]);
+            memset_pic_ex(area.planes[p], plane_clear[p], bytes,
+                          area.plane_h[p], area.stride[p], MP_COPY_THREADS);
         } else {
             memset16_pic(area.planes[p], plane_clear[p], (bytes + 1) / 2,
                          area.plane_h[p], area.stride[p]);
@@ -628,6 +660,23 @@ static void free_img(void *opaque, uint8_t *data)
     talloc_free(img);
 }
 
+// If img wraps an AVFrame (see mp_image_from_av_frame()), add references to
+// the AVFrame's buffers to frame. Returns false if this is not possible.
+static bool ref_av_frame_buffers(struct AVFrame *frame, struct mp_image *img)
+{
+    if (!img->refcount || img->refcount->free != frame_free)
+        return false;
+    AVFrame *src = img->refcount->arg;
+    if (!src->buf[0] || src->nb_extended_buf)
+        return false;
+    for (int n = 0; n < AV_NUM_DATA_POINTERS && src->buf[n]; n++) {
+        frame->buf[n] = av_buffer_ref(src->buf[n]);
+        if (!frame->buf[n])
+            abort(); // OOM
+    }
+    return true;
+}
+
 // Convert the mp_image reference to a AVFrame reference.
 // Warning: img is unreferenced (i.e. free'd). This is asymmetric to
 //          mp_image_from_av_frame(). It's done this way to allow marking the
@@ -638,7 +687,15 @@ struct AVFrame *mp_image_to_av_frame_and_unref(struct mp_image *img)
     struct mp_image *new_ref = mp_image_new_ref(img); // ensure it's refcounted
     talloc_free(img);
     AVFrame *frame = av_frame_alloc();
+    if (!frame)
+        abort(); // OOM
     mp_image_copy_fields_to_av_frame(frame, new_ref);
+    // Images coming from libavcodec or libavfilter: share the buffers directly.
+    // The AVFrame is writeable as soon as all other references are gone.
+    if (ref_av_frame_buffers(frame, new_ref)) {
+        talloc_free(new_ref);
+        return frame;
+    }
     // Caveat: if img has shared references, and all other references disappear
     //         at a later point, the AVFrame will still be read-only.
     int flags = 0;
@@ -648,9 +705,17 @@ struct AVFrame *mp_image_to_av_frame_and_unref(struct mp_image *img)
         // Make it so that the actual image data is freed only if _all_ buffers
         // are unreferenced.
         struct mp_image *dummy_ref = mp_image_new_ref(new_ref);
-        void *ptr = new_ref->planes[n];
-        size_t size = new_ref->stride[n] * new_ref->h;
+        uint8_t *ptr = new_ref->planes[n];
+        int stride = new_ref->stride[n];
+        int h = new_ref->plane_h[n];
+        // The buffer must start at the lowest address, even with negative
+        // strides.
+        if (stride < 0)
+            ptr += stride * (h - 1);
+        size_t size = (size_t)abs(stride) * h;
         frame->buf[n] = av_buffer_create(ptr, size, free_img, dummy_ref, flags);
+        if (!frame->buf[n])
+            abort(); // OOM
     }
     talloc_free(new_ref);
     return frame;
@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
+#include <limits.h>
 
 #include <libavutil/common.h>
 
@@ -225,3 +226,93 @@ void packer_copy_subbitmaps(struct bitmap_packer *packer, struct sub_bitmaps *b,
                    stride, s->stride);
     }
 }
+
+static void add_free_rect(struct bitmap_atlas *atlas, struct atlas_rect r)
+{
+    if (r.x0 < r.x1 && r.y0 < r.y1)
+        MP_TARRAY_APPEND(atlas, atlas->free_rects, atlas->num_free_rects, r);
+}
+
+void atlas_reset(struct bitmap_atlas *atlas, int w, int h)
+{
+    atlas->w = w;
+    atlas->h = h;
+    atlas->count = 0;
+    atlas->num_free_rects = 0;
+    add_free_rect(atlas, (struct atlas_rect){0, 0, w, h});
+}
+
+bool atlas_insert(struct bitmap_atlas *atlas, int w, int h, struct pos *out)
+{
+    if (w <= 0 || h <= 0) {
+        *out = (struct pos){0, 0};
+        return true;
+    }
+    // Best short side fit: use the free area which leaves the least space
+    // along one of the axes.
+    int best = -1, best_short = INT_MAX, best_long = INT_MAX;
+    for (int n = 0; n < atlas->num_free_rects; n++) {
+        struct atlas_rect *r = &atlas->free_rects[n];
+        int lw = r->x1 - r->x0 - w, lh = r->y1 - r->y0 - h;
+        if (lw < 0 || lh < 0)
+            continue;
+        int s = FFMIN(lw, lh), l = FFMAX(lw, lh);
+        if (s < best_short || (s == best_short && l < best_long)) {
+            best = n;
+            best_short = s;
+            best_long = l;
+        }
+    }
+    if (best < 0)
+        return false;
+    struct atlas_rect r = atlas->free_rects[best];
+    MP_TARRAY_REMOVE_AT(atlas->free_rects, atlas->num_free_rects, best);
+    *out = (struct pos){r.x0, r.y0};
+    atlas->count++;
+    // Split the rest of the area along the shorter leftover axis, so that the
+    // larger of the two remaining pieces stays as big as possible.
+    if (r.x1 - r.x0 - w < r.y1 - r.y0 - h) {
+        add_free_rect(atlas, (struct atlas_rect){r.x0 + w, r.y0, r.x1, r.y0 + h});
+        add_free_rect(atlas, (struct atlas_rect){r.x0, r.y0 + h, r.x1, r.y1});
+    } else {
+        add_free_rect(atlas, (struct atlas_rect){r.x0 + w, r.y0, r.x1, r.y1});
+        add_free_rect(atlas, (struct atlas_rect){r.x0, r.y0 + h, r.x0 + w, r.y1});
+    }
+    return true;
+}
+
+static bool merge_rects(struct atlas_rect *a, struct atlas_rect *b)
+{
+    if (a->y0 == b->y0 && a->y1 == b->y1 && (a->x1 == b->x0 || b->x1 == a->x0)) {
+        a->x0 = FFMIN(a->x0, b->x0);
+        a->x1 = FFMAX(a->x1, b->x1);
+        return true;
+    }
+    if (a->x0 == b->x0 && a->x1 == b->x1 && (a->y1 == b->y0 || b->y1 == a->y0)) {
+        a->y0 = FFMIN(a->y0, b->y0);
+        a->y1 = FFMAX(a->y1, b->y1);
+        return true;
+    }
+    return false;
+}
+
+void atlas_remove(struct bitmap_atlas *atlas, struct pos pos, int w, int h)
+{
+    if (w <= 0 || h <= 0)
+        return;
+    assert(atlas->count > 0);
+    if (--atlas->count == 0) {
+        // Merging can't always undo all splits, so avoid fragmentation.
+        atlas_reset(atlas, atlas->w, atlas->h);
+        return;
+    }
+    struct atlas_rect r = {pos.x, pos.y, pos.x + w, pos.y + h};
+    // Merge with adjacent free areas sharing a full edge, as long as possible.
+    for (int n = 0; n < atlas->num_free_rects; n++) {
+        if (merge_rects(&r, &atlas->free_rects[n])) {
+            MP_TARRAY_REMOVE_AT(atlas->free_rects, atlas->num_free_rects, n);
+            n = -1;
+        }
+    }
+    add_free_rect(atlas, r);
+}
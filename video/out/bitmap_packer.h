@@ -1,6 +1,8 @@
 #ifndef MPLAYER_PACK_RECTANGLES_H
 #define MPLAYER_PACK_RECTANGLES_H
 
+#include <stdbool.h>
+
 struct pos {
     int x;
     int y;
@@ -65,4 +67,37 @@ int packer_pack_from_subbitmaps(struct bitmap_packer *packer,
 void packer_copy_subbitmaps(struct bitmap_packer *packer, struct sub_bitmaps *b,
                             void *data, int pixel_stride, int stride);
 
+/* Persistent packing, for surfaces that are updated incrementally. Unlike
+ * with packer_pack(), rectangles are added and removed one at a time, and
+ * keep their position for as long as they exist. Freed space is reused by
+ * later insertions (guillotine packing with merging of free areas).
+ * Set w_max and h_max, then call atlas_reset() to set the surface size.
+ */
+struct atlas_rect {
+    int x0, y0, x1, y1;
+};
+
+struct bitmap_atlas {
+    int w;
+    int h;
+    int w_max;
+    int h_max;
+    int count;      // number of allocated rectangles
+
+    // internal
+    struct atlas_rect *free_rects;
+    int num_free_rects;
+};
+
+// Forget all rectangles, and make the whole w * h area available.
+void atlas_reset(struct bitmap_atlas *atlas, int w, int h);
+
+// Allocate a w * h area. On success, its position is written to out, and
+// true is returned. Empty rectangles are always placed at (0, 0).
+// Returns false if there is no free area large enough.
+bool atlas_insert(struct bitmap_atlas *atlas, int w, int h, struct pos *out);
+
+// Free an area previously returned by atlas_insert() (with the same size).
+void atlas_remove(struct bitmap_atlas *atlas, struct pos pos, int w, int h);
+
 #endif
@@ -115,6 +115,8 @@ static const struct feature features[] = {
     {MPGL_CAP_SRGB_FB,          "sRGB framebuffers"},
     {MPGL_CAP_FLOAT_TEX,        "Float textures"},
     {MPGL_CAP_TEX_RG,           "RG textures"},
+    {MPGL_CAP_SYNC,             "Sync objects"},
+    {MPGL_CAP_PROGRAM_BINARY,   "Program binaries"},
     {MPGL_CAP_NO_SW,            "NO_SW"},
     {0},
 };
@@ -295,6 +297,7 @@ struct gl_functions gl_functions[] = {
             DEF_FN(DeleteFramebuffers),
             DEF_FN(CheckFramebufferStatus),
             DEF_FN(FramebufferTexture2D),
+            DEF_FN(BlitFramebuffer),
             {0}
         },
     },
@@ -352,6 +355,30 @@ struct gl_functions gl_functions[] = {
         .provides = MPGL_CAP_TEX_RG,
         .functions = (struct gl_function[]) {{0}},
     },
+    // Sync objects, extension in GL 2.x/3.0/3.1, core in GL 3.2.
+    {
+        .ver_core = MPGL_VER(3, 2),
+        .extension = "GL_ARB_sync",
+        .provides = MPGL_CAP_SYNC,
+        .functions = (struct gl_function[]) {
+            DEF_FN(FenceSync),
+            DEF_FN(ClientWaitSync),
+            DEF_FN(DeleteSync),
+            {0}
+        },
+    },
+    // Program binaries, extension in GL 3.x/4.0, core in GL 4.1.
+    {
+        .ver_core = MPGL_VER(4, 1),
+        .extension = "GL_ARB_get_program_binary",
+        .provides = MPGL_CAP_PROGRAM_BINARY,
+        .functions = (struct gl_function[]) {
+            DEF_FN(GetProgramBinary),
+            DEF_FN(ProgramBinary),
+            DEF_FN(ProgramParameteri),
+            {0}
+        },
+    },
     // Swap control, always an OS specific extension
     {
         .extension = "_swap_control",
@@ -855,6 +882,13 @@ void glDisable3D(GL *gl, int type)
 }
 
 mp_image_t *glGetWindowScreenshot(GL *gl)
+{
+    return glReadViewport(gl, GL_FRONT);
+}
+
+// Read the contents of the viewport from the given buffer of the current
+// framebuffer (GL_FRONT or GL_BACK) into a newly allocated RGB24 image.
+mp_image_t *glReadViewport(GL *gl, GLenum buffer)
 {
     GLint vp[4]; //x, y, w, h
     gl->GetIntegerv(GL_VIEWPORT, vp);
@@ -862,7 +896,7 @@ mp_image_t *glGetWindowScreenshot(GL *gl)
     gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
     gl->PixelStorei(GL_PACK_ALIGNMENT, 1);
     gl->PixelStorei(GL_PACK_ROW_LENGTH, 0);
-    gl->ReadBuffer(GL_FRONT);
+    gl->ReadBuffer(buffer);
     //flip image while reading (and also avoid stride-related trouble)
     for (int y = 0; y < vp[3]; y++) {
         gl->ReadPixels(vp[0], vp[1] + vp[3] - y - 1, vp[2], 1,
@@ -877,6 +911,7 @@ typedef void (*MPGLSetBackendFn)(MPGLContext *ctx);
 struct backend {
     const char *name;
     MPGLSetBackendFn init;
+    bool no_autoprobe;  // only used if explicitly selected
 };
 
 static struct backend backends[] = {
@@ -893,6 +928,9 @@ static struct backend backends[] = {
 #endif
 #if HAVE_GL_X11
     {"x11", mpgl_set_backend_x11},
+#endif
+#if HAVE_GL_HEADLESS
+    {"headless", mpgl_set_backend_headless, .no_autoprobe = true},
 #endif
     {0}
 };
@@ -947,6 +985,8 @@ MPGLContext *mpgl_init(struct vo *vo, const char *backend_name)
     int index = mpgl_find_backend(backend_name);
     if (index == -1) {
         for (const struct backend *entry = backends; entry->name; entry++) {
+            if (entry->no_autoprobe)
+                continue;
             ctx = init_backend(vo, entry->init, true);
             if (ctx)
                 break;
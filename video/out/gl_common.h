@@ -66,6 +66,7 @@ void glDownloadTex(GL *gl, GLenum target, GLenum format, GLenum type,
                    void *dataptr, int stride);
 void glCheckError(GL *gl, struct mp_log *log, const char *info);
 mp_image_t *glGetWindowScreenshot(GL *gl);
+mp_image_t *glReadViewport(GL *gl, GLenum buffer);
 
 #define GL_3D_RED_CYAN        1
 #define GL_3D_GREEN_MAGENTA   2
@@ -89,6 +90,8 @@ enum {
     MPGL_CAP_TEX_RG             = (1 << 10),    // GL_ARB_texture_rg / GL 3.x
     MPGL_CAP_VDPAU              = (1 << 11),    // GL_NV_vdpau_interop
     MPGL_CAP_APPLE_RGB_422      = (1 << 12),    // GL_APPLE_rgb_422
+    MPGL_CAP_SYNC               = (1 << 13),    // GL_ARB_sync / GL 3.2
+    MPGL_CAP_PROGRAM_BINARY     = (1 << 14),    // GL_ARB_get_program_binary
     MPGL_CAP_NO_SW              = (1 << 30),    // used to block sw. renderers
 };
 
@@ -109,6 +112,10 @@ typedef struct MPGLContext {
     // (Might be different from the actual version in gl->version.)
     int requested_gl_version;
 
+    // Set by the backend if the default framebuffer is never shown anywhere.
+    // It has no front buffer, and the last frame stays in the back buffer.
+    bool offscreen;
+
     void (*swapGlBuffers)(struct MPGLContext *);
     int (*vo_init)(struct vo *vo);
     void (*vo_uninit)(struct vo *vo);
@@ -164,6 +171,7 @@ void mpgl_set_backend_cocoa(MPGLContext *ctx);
 void mpgl_set_backend_w32(MPGLContext *ctx);
 void mpgl_set_backend_x11(MPGLContext *ctx);
 void mpgl_set_backend_wayland(MPGLContext *ctx);
+void mpgl_set_backend_headless(MPGLContext *ctx);
 
 struct mp_hwdec_info;
 
@@ -351,6 +359,8 @@ struct GL {
     GLenum (GLAPIENTRY *CheckFramebufferStatus)(GLenum);
     void (GLAPIENTRY *FramebufferTexture2D)(GLenum, GLenum, GLenum, GLuint,
                                             GLint);
+    void (GLAPIENTRY *BlitFramebuffer)(GLint, GLint, GLint, GLint, GLint,
+                                       GLint, GLint, GLint, GLbitfield, GLenum);
 
     void (GLAPIENTRY *Uniform1f)(GLint, GLfloat);
     void (GLAPIENTRY *Uniform2f)(GLint, GLfloat, GLfloat);
@@ -364,6 +374,15 @@ struct GL {
     void (GLAPIENTRY *UniformMatrix4x3fv)(GLint, GLsizei, GLboolean,
                                           const GLfloat *);
 
+    GLsync (GLAPIENTRY *FenceSync)(GLenum, GLbitfield);
+    GLenum (GLAPIENTRY *ClientWaitSync)(GLsync, GLbitfield, GLuint64);
+    void (GLAPIENTRY *DeleteSync)(GLsync);
+
+    void (GLAPIENTRY *GetProgramBinary)(GLuint, GLsizei, GLsizei *, GLenum *,
+                                        void *);
+    void (GLAPIENTRY *ProgramBinary)(GLuint, GLenum, const void *, GLsizei);
+    void (GLAPIENTRY *ProgramParameteri)(GLuint, GLenum, GLint);
+
     void (GLAPIENTRY *VDPAUInitNV)(const GLvoid *, const GLvoid *);
     void (GLAPIENTRY *VDPAUFiniNV)(void);
     GLvdpauSurfaceNV (GLAPIENTRY *VDPAURegisterOutputSurfaceNV)
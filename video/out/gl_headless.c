@@ -0,0 +1,250 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "talloc.h"
+#include "common/common.h"
+#include "vo.h"
+#include "gl_common.h"
+
+// Renders into an EGL pbuffer, without any window system. The pbuffer is used
+// as default framebuffer, so the renderer doesn't need to know about it.
+struct priv {
+    EGLDisplay dpy;
+    EGLContext ctx;
+    EGLConfig conf;
+    EGLSurface surface;
+    int w, h;
+};
+
+// The pbuffer size is limited by the driver only, so pretend to have a screen
+// large enough that --geometry and --autofit can still be used to select the
+// output size.
+#define FAKE_SCREEN_SIZE 16384
+
+static bool resize_surface(MPGLContext *ctx, int w, int h)
+{
+    struct priv *p = ctx->priv;
+
+    w = MPMAX(w, 1);
+    h = MPMAX(h, 1);
+    if (p->surface != EGL_NO_SURFACE && p->w == w && p->h == h)
+        return true;
+
+    EGLint attribs[] = {
+        EGL_WIDTH, w,
+        EGL_HEIGHT, h,
+        EGL_NONE
+    };
+
+    EGLSurface surface = eglCreatePbufferSurface(p->dpy, p->conf, attribs);
+    if (surface == EGL_NO_SURFACE) {
+        MP_ERR(ctx->vo, "Could not create %dx%d pbuffer.\n", w, h);
+        return false;
+    }
+
+    if (eglMakeCurrent(p->dpy, surface, surface, p->ctx) != EGL_TRUE) {
+        MP_ERR(ctx->vo, "Could not make EGL context current.\n");
+        eglDestroySurface(p->dpy, surface);
+        return false;
+    }
+    if (p->surface != EGL_NO_SURFACE)
+        eglDestroySurface(p->dpy, p->surface);
+    p->surface = surface;
+    p->w = w;
+    p->h = h;
+
+    MP_VERBOSE(ctx->vo, "Rendering to %dx%d pbuffer.\n", w, h);
+    return true;
+}
+
+static bool create_context(MPGLContext *ctx, bool enable_alpha)
+{
+    struct priv *p = ctx->priv;
+    GL *gl = ctx->gl;
+    EGLint major, minor, n;
+
+    p->dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (p->dpy == EGL_NO_DISPLAY) {
+        MP_ERR(ctx->vo, "Could not get EGL display.\n");
+        return false;
+    }
+
+    if (eglInitialize(p->dpy, &major, &minor) != EGL_TRUE) {
+        MP_ERR(ctx->vo, "Could not initialize EGL.\n");
+        p->dpy = EGL_NO_DISPLAY;
+        return false;
+    }
+
+    MP_VERBOSE(ctx->vo, "EGL version %d.%d\n", major, minor);
+
+    if (eglBindAPI(EGL_OPENGL_API) != EGL_TRUE) {
+        MP_ERR(ctx->vo, "Desktop OpenGL not supported by EGL.\n");
+        goto fail;
+    }
+
+    EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, enable_alpha ? 8 : 0,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+
+    if (eglChooseConfig(p->dpy, config_attribs, &p->conf, 1, &n) != EGL_TRUE
+        || n < 1)
+    {
+        MP_ERR(ctx->vo, "No EGL config with pbuffer support found.\n");
+        goto fail;
+    }
+
+    EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION_KHR,
+        MPGL_VER_GET_MAJOR(ctx->requested_gl_version),
+        EGL_NONE
+    };
+
+    p->ctx = eglCreateContext(p->dpy, p->conf, EGL_NO_CONTEXT, context_attribs);
+    if (!p->ctx) {
+        // fallback to any GL version
+        context_attribs[0] = EGL_NONE;
+        p->ctx = eglCreateContext(p->dpy, p->conf, EGL_NO_CONTEXT,
+                                  context_attribs);
+        if (!p->ctx) {
+            MP_ERR(ctx->vo, "Could not create EGL context.\n");
+            goto fail;
+        }
+    }
+
+    eglGetConfigAttrib(p->dpy, p->conf, EGL_RED_SIZE, &ctx->depth_r);
+    eglGetConfigAttrib(p->dpy, p->conf, EGL_GREEN_SIZE, &ctx->depth_g);
+    eglGetConfigAttrib(p->dpy, p->conf, EGL_BLUE_SIZE, &ctx->depth_b);
+
+    const char *eglstr = eglQueryString(p->dpy, EGL_EXTENSIONS);
+
+    // Loading the functions requires a current context. Make it current
+    // without a surface if the driver allows it, and with a dummy pbuffer
+    // (replaced by the first resize) otherwise.
+    bool current = false;
+    if (eglstr && strstr(eglstr, "EGL_KHR_surfaceless_context")) {
+        current = eglMakeCurrent(p->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                                 p->ctx) == EGL_TRUE;
+    }
+    if (!current && !resize_surface(ctx, 1, 1))
+        goto fail;
+
+    mpgl_load_functions(gl, (void*(*)(const GLubyte*))eglGetProcAddress, eglstr,
+                        ctx->vo->log);
+    if (!gl->BindProgram)
+        mpgl_load_functions(gl, NULL, eglstr, ctx->vo->log);
+
+    return true;
+
+fail:
+    eglMakeCurrent(p->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (p->surface != EGL_NO_SURFACE)
+        eglDestroySurface(p->dpy, p->surface);
+    if (p->ctx)
+        eglDestroyContext(p->dpy, p->ctx);
+    eglTerminate(p->dpy);
+    *p = (struct priv){ .dpy = EGL_NO_DISPLAY, .surface = EGL_NO_SURFACE };
+    return false;
+}
+
+static bool config_window_headless(struct MPGLContext *ctx, uint32_t d_width,
+                                   uint32_t d_height, uint32_t flags)
+{
+    struct priv *p = ctx->priv;
+    struct vo *vo = ctx->vo;
+
+    if (!p->ctx && !create_context(ctx, !!(flags & VOFLAG_ALPHA)))
+        return false;
+
+    if (!resize_surface(ctx, d_width, d_height))
+        return false;
+
+    vo->dwidth = p->w;
+    vo->dheight = p->h;
+    return true;
+}
+
+static void releaseGlContext_headless(MPGLContext *ctx)
+{
+    struct priv *p = ctx->priv;
+
+    if (p->dpy == EGL_NO_DISPLAY)
+        return;
+    if (p->ctx) {
+        ctx->gl->Finish();
+        eglMakeCurrent(p->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(p->dpy, p->ctx);
+    }
+    if (p->surface != EGL_NO_SURFACE)
+        eglDestroySurface(p->dpy, p->surface);
+    eglTerminate(p->dpy);
+    eglReleaseThread();
+    *p = (struct priv){ .dpy = EGL_NO_DISPLAY, .surface = EGL_NO_SURFACE };
+}
+
+static void swapGlBuffers_headless(MPGLContext *ctx)
+{
+    // Swapping has no effect on pbuffers; the rendered frame stays in the back
+    // buffer until the next frame overwrites it.
+    ctx->gl->Flush();
+}
+
+static int vo_init_headless(struct vo *vo)
+{
+    return 1;
+}
+
+static void vo_uninit_headless(struct vo *vo)
+{
+}
+
+static int vo_control_headless(struct vo *vo, int *events, int request,
+                               void *arg)
+{
+    switch (request) {
+    case VOCTRL_UPDATE_SCREENINFO:
+        vo->opts->screenwidth = FAKE_SCREEN_SIZE;
+        vo->opts->screenheight = FAKE_SCREEN_SIZE;
+        return VO_TRUE;
+    }
+    return VO_NOTIMPL;
+}
+
+void mpgl_set_backend_headless(MPGLContext *ctx)
+{
+    struct priv *p = talloc_zero(ctx, struct priv);
+    p->dpy = EGL_NO_DISPLAY;
+    p->surface = EGL_NO_SURFACE;
+    ctx->priv = p;
+    ctx->offscreen = true;
+    ctx->config_window = config_window_headless;
+    ctx->releaseGlContext = releaseGlContext_headless;
+    ctx->swapGlBuffers = swapGlBuffers_headless;
+    ctx->vo_control = vo_control_headless;
+    ctx->vo_init = vo_init_headless;
+    ctx->vo_uninit = vo_uninit_headless;
+}
@@ -16,10 +16,12 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <libavutil/common.h>
 
 #include "bitmap_packer.h"
+#include "video/memcpy_pic.h"
 
 #include "gl_osd.h"
 
@@ -67,6 +69,10 @@ struct mpgl_osd *mpgl_osd_init(GL *gl, struct mp_log *log, bool legacy)
                 .w_max = max_texture_size,
                 .h_max = max_texture_size,
             }),
+            .atlas = talloc_struct(p, struct bitmap_atlas, {
+                .w_max = max_texture_size,
+                .h_max = max_texture_size,
+            }),
         };
         ctx->parts[n] = p;
     }
@@ -90,14 +96,151 @@ void mpgl_osd_destroy(struct mpgl_osd *ctx)
     talloc_free(ctx);
 }
 
+// A sub-bitmap stored in the texture. Entries are kept while unused, so that
+// bitmaps which disappear and reappear (e.g. glyphs of OSD UIs) don't have to
+// be uploaded again. Identical sub-bitmaps share a single entry.
+struct mpgl_osd_entry {
+    struct pos pos;
+    int w, h;
+    uint64_t hash;
+    void *data;     // copy of the bitmap (w * pix_stride bytes per line)
+    int next;       // next entry in the same hash bucket, -1 if none
+    int part;       // first sub-bitmap using it, -1 if currently unused
+    bool dirty;     // texture area must be (re-)uploaded
+};
+
+static uint64_t hash_bitmap(struct sub_bitmap *s, int pix_stride)
+{
+    uint64_t h = 0xcbf29ce484222325ULL ^ s->w ^ ((uint64_t)s->h << 32);
+    size_t len = s->w * pix_stride;
+    for (int y = 0; y < s->h; y++) {
+        uint8_t *p = (uint8_t *)s->bitmap + y * s->stride;
+        size_t x = 0;
+        for (; x + 8 <= len; x += 8) {
+            uint64_t v;
+            memcpy(&v, p + x, 8);
+            h = (h ^ v) * 0x100000001b3ULL;
+            h ^= h >> 29;
+        }
+        for (; x < len; x++)
+            h = (h ^ p[x]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static bool bitmap_equals(struct mpgl_osd_entry *e, struct sub_bitmap *s,
+                          int pix_stride)
+{
+    if (e->w != s->w || e->h != s->h)
+        return false;
+    size_t len = s->w * pix_stride;
+    for (int y = 0; y < s->h; y++) {
+        if (memcmp((uint8_t *)e->data + y * len,
+                   (uint8_t *)s->bitmap + y * s->stride, len) != 0)
+            return false;
+    }
+    return true;
+}
+
+static void link_entry(struct mpgl_osd_part *osd, int n)
+{
+    struct mpgl_osd_entry *e = &osd->entries[n];
+    int *bucket = &osd->buckets[e->hash & (osd->num_buckets - 1)];
+    e->next = *bucket;
+    *bucket = n;
+}
+
+// Rebuild the hash table, after entries were added or removed.
+static void rehash_entries(struct mpgl_osd_part *osd)
+{
+    int size = 64;
+    while (size < osd->num_entries * 2)
+        size *= 2;
+    if (size != osd->num_buckets) {
+        talloc_free(osd->buckets);
+        osd->buckets = talloc_array(osd, int, size);
+        osd->num_buckets = size;
+    }
+    for (int n = 0; n < osd->num_buckets; n++)
+        osd->buckets[n] = -1;
+    for (int n = 0; n < osd->num_entries; n++)
+        link_entry(osd, n);
+}
+
+static int find_entry(struct mpgl_osd_part *osd, struct sub_bitmap *s,
+                      uint64_t hash, int pix_stride)
+{
+    if (!osd->num_buckets)
+        return -1;
+    int n = osd->buckets[hash & (osd->num_buckets - 1)];
+    for (; n >= 0; n = osd->entries[n].next) {
+        struct mpgl_osd_entry *e = &osd->entries[n];
+        if (e->hash == hash && bitmap_equals(e, s, pix_stride))
+            return n;
+    }
+    return -1;
+}
+
+static int add_entry(struct mpgl_osd_part *osd, struct sub_bitmap *s,
+                     uint64_t hash, int pix_stride)
+{
+    size_t len = s->w * pix_stride;
+    struct mpgl_osd_entry e = {
+        .w = s->w,
+        .h = s->h,
+        .hash = hash,
+        .data = talloc_size(osd, len * s->h),
+        .part = -1,
+        .dirty = true,
+    };
+    memcpy_pic(e.data, s->bitmap, len, s->h, len, s->stride);
+    int n = osd->num_entries;
+    MP_TARRAY_APPEND(osd, osd->entries, osd->num_entries, e);
+    if (osd->num_entries * 2 > osd->num_buckets) {
+        rehash_entries(osd);
+    } else {
+        link_entry(osd, n);
+    }
+    return n;
+}
+
+static void clear_entries(struct mpgl_osd_part *osd)
+{
+    for (int n = 0; n < osd->num_entries; n++)
+        talloc_free(osd->entries[n].data);
+    osd->num_entries = 0;
+    rehash_entries(osd);
+}
+
+// Texture area covered by the entry, including its padding border.
+static void get_cell(struct mpgl_osd_part *osd, struct mpgl_osd_entry *e,
+                     struct pos out_rc[2])
+{
+    out_rc[0] = e->pos;
+    out_rc[1] = (struct pos) {
+        FFMIN(e->pos.x + e->w + osd->padding, osd->w),
+        FFMIN(e->pos.y + e->h + osd->padding, osd->h),
+    };
+}
+
+// Which parts of the texture need to be updated.
+struct upload_state {
+    bool full;              // texture was reset; upload all used entries
+    bool evicted;           // unused entries were dropped
+    struct pos (*clear)[2]; // no longer used cells, which must be cleared
+    int num_clear;
+};
+
 static bool upload_pbo(struct mpgl_osd *ctx, struct mpgl_osd_part *osd,
-                       struct sub_bitmaps *imgs)
+                       struct sub_bitmaps *imgs, struct upload_state *st)
 {
     GL *gl = ctx->gl;
     bool success = true;
     struct osd_fmt_entry fmt = ctx->fmt_table[imgs->format];
     int pix_stride = glFmt2bpp(fmt.format, fmt.type);
 
+    // The buffer mirrors the texture. Its contents are not relied upon: every
+    // area uploaded from it is written first.
     if (!osd->buffer) {
         gl->GenBuffers(1, &osd->buffer);
         gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, osd->buffer);
@@ -111,15 +254,51 @@ static bool upload_pbo(struct mpgl_osd *ctx, struct mpgl_osd_part *osd,
     if (!data) {
         success = false;
     } else {
-        struct pos bb[2];
-        packer_get_bb(osd->packer, bb);
         size_t stride = osd->w * pix_stride;
-        packer_copy_subbitmaps(osd->packer, imgs, data, pix_stride, stride);
+        if (st->full && osd->padding)
+            memset_pic(data, 0, stride, osd->h, stride);
+        for (int n = 0; n < st->num_clear; n++) {
+            struct pos *rc = st->clear[n];
+            memset_pic(data + rc[0].y * stride + rc[0].x * pix_stride, 0,
+                       (rc[1].x - rc[0].x) * pix_stride, rc[1].y - rc[0].y,
+                       stride);
+        }
+        for (int n = 0; n < osd->num_entries; n++) {
+            struct mpgl_osd_entry *e = &osd->entries[n];
+            if (!e->dirty)
+                continue;
+            struct sub_bitmap *s = &imgs->parts[e->part];
+            struct pos rc[2];
+            get_cell(osd, e, rc);
+            char *pdata = data + rc[0].y * stride + rc[0].x * pix_stride;
+            if (osd->padding && !st->full) {
+                memset_pic(pdata, 0, (rc[1].x - rc[0].x) * pix_stride,
+                           rc[1].y - rc[0].y, stride);
+            }
+            memcpy_pic(pdata, s->bitmap, s->w * pix_stride, s->h,
+                       stride, s->stride);
+        }
         if (!gl->UnmapBuffer(GL_PIXEL_UNPACK_BUFFER))
             success = false;
-        glUploadTex(gl, GL_TEXTURE_2D, fmt.format, fmt.type, NULL, stride,
-                    bb[0].x, bb[0].y, bb[1].x - bb[0].x, bb[1].y - bb[0].y,
-                    0);
+        if (st->full) {
+            glUploadTex(gl, GL_TEXTURE_2D, fmt.format, fmt.type, NULL, stride,
+                        0, 0, osd->w, osd->h, 0);
+        } else {
+            for (int n = 0; n < st->num_clear + osd->num_entries; n++) {
+                struct pos cell[2], *rc = cell;
+                if (n < st->num_clear) {
+                    rc = st->clear[n];
+                } else if (osd->entries[n - st->num_clear].dirty) {
+                    get_cell(osd, &osd->entries[n - st->num_clear], cell);
+                } else {
+                    continue;
+                }
+                size_t offset = rc[0].y * stride + rc[0].x * pix_stride;
+                glUploadTex(gl, GL_TEXTURE_2D, fmt.format, fmt.type,
+                            (void *)offset, stride, rc[0].x, rc[0].y,
+                            rc[1].x - rc[0].x, rc[1].y - rc[0].y, 0);
+            }
+        }
     }
     gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
@@ -132,23 +311,180 @@ static bool upload_pbo(struct mpgl_osd *ctx, struct mpgl_osd_part *osd,
 }
 
 static void upload_tex(struct mpgl_osd *ctx, struct mpgl_osd_part *osd,
-                       struct sub_bitmaps *imgs)
+                       struct sub_bitmaps *imgs, struct upload_state *st)
 {
     struct osd_fmt_entry fmt = ctx->fmt_table[imgs->format];
-    if (osd->packer->padding) {
-        struct pos bb[2];
-        packer_get_bb(osd->packer, bb);
-        glClearTex(ctx->gl, GL_TEXTURE_2D, fmt.format, fmt.type,
-                   bb[0].x, bb[0].y, bb[1].x - bb[0].y, bb[1].y - bb[0].y,
-                   0, &ctx->scratch);
+    if (osd->padding) {
+        if (st->full) {
+            glClearTex(ctx->gl, GL_TEXTURE_2D, fmt.format, fmt.type,
+                       0, 0, osd->w, osd->h, 0, &ctx->scratch);
+        }
+        for (int n = 0; n < st->num_clear; n++) {
+            struct pos *rc = st->clear[n];
+            glClearTex(ctx->gl, GL_TEXTURE_2D, fmt.format, fmt.type,
+                       rc[0].x, rc[0].y, rc[1].x - rc[0].x, rc[1].y - rc[0].y,
+                       0, &ctx->scratch);
+        }
+    }
+    for (int n = 0; n < osd->num_entries; n++) {
+        struct mpgl_osd_entry *e = &osd->entries[n];
+        if (!e->dirty)
+            continue;
+        struct sub_bitmap *s = &imgs->parts[e->part];
+
+        if (osd->padding && !st->full) {
+            struct pos rc[2];
+            get_cell(osd, e, rc);
+            glClearTex(ctx->gl, GL_TEXTURE_2D, fmt.format, fmt.type,
+                       rc[0].x, rc[0].y, rc[1].x - rc[0].x, rc[1].y - rc[0].y,
+                       0, &ctx->scratch);
+        }
+        glUploadTex(ctx->gl, GL_TEXTURE_2D, fmt.format, fmt.type,
+                    s->bitmap, s->stride, e->pos.x, e->pos.y, s->w, s->h, 0);
+    }
+}
+
+// Free the texture area of all entries not used by the current sub-bitmaps.
+// With padding, the texture must be 0 outside of the used cells, so the freed
+// cells are cleared. The entries are removed by remove_unused() later.
+static void evict_unused(struct mpgl_osd_part *osd, struct upload_state *st)
+{
+    for (int n = 0; n < osd->num_entries; n++) {
+        struct mpgl_osd_entry *e = &osd->entries[n];
+        if (e->part >= 0)
+            continue;
+        if (osd->padding && !st->full) {
+            MP_TARRAY_GROW(osd, st->clear, st->num_clear);
+            get_cell(osd, e, st->clear[st->num_clear++]);
+        }
+        atlas_remove(osd->atlas, e->pos, e->w + osd->padding,
+                     e->h + osd->padding);
+    }
+    st->evicted = true;
+}
+
+static void remove_unused(struct mpgl_osd_part *osd)
+{
+    int count = 0;
+    for (int n = 0; n < osd->num_entries; n++) {
+        if (osd->entries[n].part >= 0) {
+            osd->entries[count++] = osd->entries[n];
+        } else {
+            talloc_free(osd->entries[n].data);
+        }
+    }
+    osd->num_entries = count;
+    rehash_entries(osd);
+}
+
+static int compare_height(const void *pa, const void *pb)
+{
+    const struct mpgl_osd_entry *a = *(struct mpgl_osd_entry **)pa;
+    const struct mpgl_osd_entry *b = *(struct mpgl_osd_entry **)pb;
+    return b->h - a->h;
+}
+
+// Repack all used entries from scratch, growing the atlas if necessary. This
+// is done only if incremental insertion fails, because it requires uploading
+// everything again.
+static bool rebuild_atlas(struct mpgl_osd_part *osd, struct upload_state *st)
+{
+    struct bitmap_atlas *atlas = osd->atlas;
+    struct mpgl_osd_entry **sorted =
+        talloc_array(NULL, struct mpgl_osd_entry *, osd->num_entries);
+    int num_sorted = 0;
+    for (int n = 0; n < osd->num_entries; n++) {
+        if (osd->entries[n].part >= 0)
+            sorted[num_sorted++] = &osd->entries[n];
+    }
+    qsort(sorted, num_sorted, sizeof(sorted[0]), compare_height);
+
+    bool ok = false;
+    int w = FFMAX(atlas->w, 64), h = FFMAX(atlas->h, 64);
+    while (1) {
+        atlas_reset(atlas, FFMIN(w, atlas->w_max), FFMIN(h, atlas->h_max));
+        ok = true;
+        for (int n = 0; n < num_sorted && ok; n++) {
+            struct mpgl_osd_entry *e = sorted[n];
+            ok = atlas_insert(atlas, e->w + osd->padding, e->h + osd->padding,
+                              &e->pos);
+        }
+        if (ok)
+            break;
+        if (w <= h && w < atlas->w_max) {
+            w *= 2;
+        } else if (h < atlas->h_max) {
+            h *= 2;
+        } else {
+            break;
+        }
     }
-    for (int n = 0; n < osd->packer->count; n++) {
+    talloc_free(sorted);
+
+    for (int n = 0; n < osd->num_entries; n++)
+        osd->entries[n].dirty = true;
+    st->full = true;
+    st->num_clear = 0;
+    return ok;
+}
+
+// Assign texture areas to the sub-bitmaps, and write them to the packer
+// results. Sub-bitmaps already in the texture keep their position, and only
+// new ones are marked for upload.
+static bool update_entries(struct mpgl_osd *ctx, struct mpgl_osd_part *osd,
+                           struct sub_bitmaps *imgs, struct upload_state *st)
+{
+    struct bitmap_packer *packer = osd->packer;
+    int pix_stride = glFmt2bpp(ctx->fmt_table[imgs->format].format,
+                               ctx->fmt_table[imgs->format].type);
+
+    for (int n = 0; n < osd->num_entries; n++)
+        osd->entries[n].part = -1;
+
+    int *index = talloc_array(NULL, int, imgs->num_parts);
+    for (int n = 0; n < imgs->num_parts; n++) {
         struct sub_bitmap *s = &imgs->parts[n];
-        struct pos p = osd->packer->result[n];
+        uint64_t hash = hash_bitmap(s, pix_stride);
+        int i = find_entry(osd, s, hash, pix_stride);
+        if (i < 0)
+            i = add_entry(osd, s, hash, pix_stride);
+        if (osd->entries[i].part < 0)
+            osd->entries[i].part = n;
+        index[n] = i;
+    }
 
-        glUploadTex(ctx->gl, GL_TEXTURE_2D, fmt.format, fmt.type,
-                    s->bitmap, s->stride, p.x, p.y, s->w, s->h, 0);
+    bool ok = true;
+    if (st->full) {
+        evict_unused(osd, st);
+        ok = rebuild_atlas(osd, st);
+    } else {
+        for (int n = 0; n < osd->num_entries; n++) {
+            struct mpgl_osd_entry *e = &osd->entries[n];
+            if (!e->dirty)
+                continue;
+            int w = e->w + osd->padding, h = e->h + osd->padding;
+            if (atlas_insert(osd->atlas, w, h, &e->pos))
+                continue;
+            // Make room by dropping the cached entries, and if that isn't
+            // enough, repack (and possibly enlarge) the texture.
+            if (!st->evicted) {
+                evict_unused(osd, st);
+                if (atlas_insert(osd->atlas, w, h, &e->pos))
+                    continue;
+            }
+            ok = rebuild_atlas(osd, st);
+            break;
+        }
     }
+
+    packer_set_size(packer, imgs->num_parts);
+    for (int n = 0; n < imgs->num_parts; n++)
+        packer->result[n] = osd->entries[index[n]].pos;
+    talloc_free(index);
+
+    if (st->evicted)
+        remove_unused(osd);
+    return ok;
 }
 
 static bool upload_osd(struct mpgl_osd *ctx, struct mpgl_osd_part *osd,
@@ -156,29 +492,41 @@ static bool upload_osd(struct mpgl_osd *ctx, struct mpgl_osd_part *osd,
 {
     GL *gl = ctx->gl;
 
+    struct osd_fmt_entry fmt = ctx->fmt_table[imgs->format];
+    assert(fmt.type != 0);
+
+    struct upload_state st = {0};
+
     // assume 2x2 filter on scaling
-    osd->packer->padding = ctx->scaled || imgs->scaled;
-    int r = packer_pack_from_subbitmaps(osd->packer, imgs);
-    if (r < 0) {
+    int padding = ctx->scaled || imgs->scaled;
+    bool realloc = osd->format != imgs->format;
+    // Cached bitmaps of another format can't be compared or reused.
+    if (realloc)
+        clear_entries(osd);
+    if (osd->format != imgs->format || osd->padding != padding) {
+        osd->format = imgs->format;
+        osd->padding = padding;
+        st.full = true;
+    }
+
+    if (!update_entries(ctx, osd, imgs, &st)) {
         MP_ERR(ctx, "OSD bitmaps do not fit on a surface with the maximum "
-               "supported size %dx%d.\n", osd->packer->w_max, osd->packer->h_max);
+               "supported size %dx%d.\n", osd->atlas->w_max, osd->atlas->h_max);
+        // Start from scratch next time.
+        clear_entries(osd);
+        osd->format = SUBBITMAP_EMPTY;
+        talloc_free(st.clear);
         return false;
     }
 
-    struct osd_fmt_entry fmt = ctx->fmt_table[imgs->format];
-    assert(fmt.type != 0);
-
     if (!osd->texture)
         gl->GenTextures(1, &osd->texture);
 
     gl->BindTexture(GL_TEXTURE_2D, osd->texture);
 
-    if (osd->packer->w > osd->w || osd->packer->h > osd->h
-        || osd->format != imgs->format)
-    {
-        osd->format = imgs->format;
-        osd->w = FFMAX(32, osd->packer->w);
-        osd->h = FFMAX(32, osd->packer->h);
+    if (osd->atlas->w != osd->w || osd->atlas->h != osd->h || realloc) {
+        osd->w = osd->atlas->w;
+        osd->h = osd->atlas->h;
 
         gl->TexImage2D(GL_TEXTURE_2D, 0, fmt.internal_format, osd->w, osd->h,
                        0, fmt.format, fmt.type, NULL);
@@ -195,9 +543,13 @@ static bool upload_osd(struct mpgl_osd *ctx, struct mpgl_osd_part *osd,
 
     bool uploaded = false;
     if (ctx->use_pbo)
-        uploaded = upload_pbo(ctx, osd, imgs);
+        uploaded = upload_pbo(ctx, osd, imgs, &st);
     if (!uploaded)
-        upload_tex(ctx, osd, imgs);
+        upload_tex(ctx, osd, imgs, &st);
+
+    for (int n = 0; n < osd->num_entries; n++)
+        osd->entries[n].dirty = false;
+    talloc_free(st.clear);
 
     gl->BindTexture(GL_TEXTURE_2D, 0);
 
@@ -16,7 +16,14 @@ struct mpgl_osd_part {
     GLuint buffer;
     int num_vertices;
     void *vertices;
-    struct bitmap_packer *packer;
+    struct bitmap_packer *packer;   // positions of the current sub-bitmaps
+    // texture contents, for incremental updates
+    struct bitmap_atlas *atlas;
+    struct mpgl_osd_entry *entries;
+    int num_entries;
+    int *buckets;                   // hash table, indexes into entries
+    int num_buckets;
+    int padding;
 };
 
 struct mpgl_osd {
@@ -23,14 +23,20 @@
 #include <assert.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include <assert.h>
 
 #include <libavutil/common.h>
+#include <libavutil/mem.h>
+#include <libavutil/sha.h>
 
 #include "gl_video.h"
 
 #include "bstr/bstr.h"
+#include "options/path.h"
+#include "osdep/io.h"
 #include "gl_common.h"
 #include "gl_osd.h"
 #include "filter_kernels.h"
@@ -47,6 +53,15 @@ static const char vo_opengl_shaders[] =
 // Pixel width of 1D lookup textures.
 #define LOOKUP_TEXTURE_SIZE 256
 
+// The inverse scale factor used for computing scaler LUTs is rounded up to a
+// multiple of 1/LUT_SCALE_STEPS, so that similar window sizes share a LUT.
+#define LUT_SCALE_STEPS 32
+
+// Maximum number of entries in the LUT and shader program caches. Entries
+// currently in use are never evicted.
+#define MAX_CACHED_LUTS 8
+#define MAX_CACHED_PROGRAMS 16
+
 // Texture units 0-3 are used by the video, with unit 0 for free use.
 // Units 4-5 are used for scaler LUTs.
 #define TEXUNIT_SCALERS 4
@@ -99,6 +114,16 @@ struct vertex {
 // (GL_QUAD is deprecated, strips can't be used with OSD image lists)
 #define VERTICES_PER_QUAD 6
 
+// Number of PBOs per plane. While the GPU is still reading from the PBO of
+// the previous frame, the next frame can be written into another one.
+#define NUM_PBOS 3
+
+struct pbo {
+    GLuint buffer;
+    int size;
+    void *ptr;                  // if mapped
+};
+
 struct texplane {
     int w, h;
     int tex_w, tex_h;
@@ -106,15 +131,16 @@ struct texplane {
     GLenum gl_format;
     GLenum gl_type;
     GLuint gl_texture;
-    int gl_buffer;
-    int buffer_size;
-    void *buffer_ptr;
+    struct pbo pbos[NUM_PBOS];
 };
 
 struct video_image {
     struct texplane planes[4];
     bool image_flipped;
     struct mp_image *hwimage;   // if hw decoding is active
+    struct mp_image *mpi;       // uploaded image, if it was refcounted
+    int cur_pbo;                // index into texplane.pbos used next
+    GLsync pbo_fences[NUM_PBOS];// signaled when uploads from the PBOs are done
 };
 
 struct scaler {
@@ -129,6 +155,24 @@ struct scaler {
     struct filter_kernel kernel_storage;
 };
 
+// A scaler LUT texture, as uploaded by get_lut().
+struct lut_cache_entry {
+    const char *kernel;         // filter_kernel.name (static string)
+    float params[2];
+    int size;
+    double inv_scale;
+    GLenum target;
+    GLuint texture;
+    int last_used;
+};
+
+// A linked program, identified by its complete shader source.
+struct program_cache_entry {
+    char *source;
+    GLuint program;
+    int last_used;
+};
+
 struct fbotex {
     GLuint fbo;
     GLuint texture;
@@ -140,6 +184,7 @@ struct gl_video {
     GL *gl;
 
     struct mp_log *log;
+    struct mpv_global *global;
     struct gl_video_opts opts;
     bool gl_debug;
 
@@ -187,9 +232,26 @@ struct gl_video {
     struct fbotex indirect_fbo;         // RGB target
     struct fbotex scale_sep_fbo;        // first pass when doing 2 pass scaling
 
+    // Copy of the scaled video (without OSD) of the last render, for redraws
+    // of the same frame with the same parameters, e.g. OSD changes while
+    // paused. Only filled on the first redraw, so normal playback doesn't
+    // pay for the copy.
+    struct fbotex video_fbo;
+    bool video_fbo_valid;               // video_fbo can be used for redraws
+    bool frame_rendered;                // frame rendered since it changed
+
     // state for luma (0) and chroma (1) scalers
     struct scaler scalers[2];
 
+    // Reused across resizes and option changes, since computing the LUTs and
+    // compiling the shaders can take a while.
+    struct lut_cache_entry lut_cache[MAX_CACHED_LUTS];
+    int num_lut_cache;
+    struct program_cache_entry program_cache[MAX_CACHED_PROGRAMS];
+    int num_program_cache;
+    int cache_counter;          // for last_used
+    char *driver_id;            // identifies program binaries in the disk cache
+
     struct mp_csp_details colorspace;
     struct mp_csp_equalizer video_eq;
     struct mp_image_params image_params;
@@ -349,6 +411,7 @@ const struct m_sub_options gl_video_conf = {
                     {"yes", 1}, {"", 1},
                     {"blend", 2})),
         OPT_FLAG("rectangle-textures", use_rectangle, 0),
+        OPT_STRING("shader-cache-dir", shader_cache_dir, 0),
         {0}
     },
     .size = sizeof(struct gl_video_opts),
@@ -645,6 +708,10 @@ static void update_uniforms(struct gl_video *p, GLuint program)
 
 static void update_all_uniforms(struct gl_video *p)
 {
+    // Anything changing the rendering goes through here.
+    p->video_fbo_valid = false;
+    p->frame_rendered = false;
+
     for (int n = 0; n < SUBBITMAP_COUNT; n++)
         update_uniforms(p, p->osd_programs[n]);
     update_uniforms(p, p->indirect_program);
@@ -745,20 +812,201 @@ static void bind_attrib_locs(GL *gl, GLuint program)
 
 #define PRELUDE_END "// -- prelude end\n"
 
+static bool program_in_use(struct gl_video *p, GLuint prog)
+{
+    for (int n = 0; n < SUBBITMAP_COUNT; n++) {
+        if (p->osd_programs[n] == prog)
+            return true;
+    }
+    return p->indirect_program == prog || p->scale_sep_program == prog ||
+           p->final_program == prog;
+}
+
+// Return a free slot in the program cache, evicting the least recently used
+// program if needed.
+static struct program_cache_entry *alloc_program_entry(struct gl_video *p)
+{
+    if (p->num_program_cache < MAX_CACHED_PROGRAMS)
+        return &p->program_cache[p->num_program_cache++];
+    struct program_cache_entry *best = NULL;
+    for (int n = 0; n < p->num_program_cache; n++) {
+        struct program_cache_entry *e = &p->program_cache[n];
+        if (!program_in_use(p, e->program) &&
+            (!best || e->last_used < best->last_used))
+            best = e;
+    }
+    assert(best);
+    p->gl->DeleteProgram(best->program);
+    talloc_free(best->source);
+    *best = (struct program_cache_entry){0};
+    return best;
+}
+
+#define PROGRAM_BINARY_HEADER "mpv program binary 1\n"
+
+// Return the file the program with the given source is stored in by the
+// on-disk program cache, or NULL if the cache is not enabled.
+static char *program_binary_file(void *talloc_ctx, struct gl_video *p,
+                                 const char *source)
+{
+    if (!p->opts.shader_cache_dir || !p->opts.shader_cache_dir[0] ||
+        !(p->gl->mpgl_caps & MPGL_CAP_PROGRAM_BINARY))
+        return NULL;
+
+    struct AVSHA *sha = av_sha_alloc();
+    if (!sha)
+        return NULL;
+    uint8_t hash[32];
+    av_sha_init(sha, 256);
+    av_sha_update(sha, (const uint8_t *)p->driver_id, strlen(p->driver_id));
+    av_sha_update(sha, (const uint8_t *)source, strlen(source));
+    av_sha_final(sha, hash);
+    av_free(sha);
+
+    char *name = talloc_strdup(talloc_ctx, "");
+    for (int n = 0; n < sizeof(hash); n++)
+        name = talloc_asprintf_append(name, "%02x", hash[n]);
+    name = talloc_strdup_append(name, ".bin");
+
+    char *dir = mp_get_user_path(talloc_ctx, p->global,
+                                 p->opts.shader_cache_dir);
+    return mp_path_join(talloc_ctx, bstr0(dir), bstr0(name));
+}
+
+// Create a program from a binary previously written by save_program_binary().
+// Returns 0 if the file doesn't exist or the driver rejects the binary.
+static GLuint load_program_binary(struct gl_video *p, const char *file)
+{
+    GL *gl = p->gl;
+
+    FILE *f = fopen(file, "rb");
+    if (!f)
+        return 0;
+    void *tmp = talloc_new(NULL);
+    struct bstr data = {0};
+    if (fseek(f, 0, SEEK_END) == 0) {
+        long size = ftell(f);
+        if (size > 0 && fseek(f, 0, SEEK_SET) == 0) {
+            data.start = talloc_size(tmp, size);
+            data.len = fread(data.start, 1, size, f);
+        }
+    }
+    fclose(f);
+
+    GLuint prog = 0;
+    uint32_t format;
+    if (bstr_eatstart(&data, bstr0(PROGRAM_BINARY_HEADER)) &&
+        bstr_eatstart(&data, bstr0(p->driver_id)) &&
+        data.len > sizeof(format))
+    {
+        memcpy(&format, data.start, sizeof(format));
+        data = bstr_cut(data, sizeof(format));
+        prog = gl->CreateProgram();
+        gl->ProgramBinary(prog, format, data.start, data.len);
+        GLint status = 0;
+        gl->GetProgramiv(prog, GL_LINK_STATUS, &status);
+        if (!status) {
+            // E.g. after a driver update. It will be recompiled and replaced.
+            MP_VERBOSE(p, "Cached program binary '%s' rejected.\n", file);
+            gl->DeleteProgram(prog);
+            prog = 0;
+            while (gl->GetError() != GL_NO_ERROR) {}
+        }
+    } else {
+        MP_VERBOSE(p, "Cached program binary '%s' invalid.\n", file);
+    }
+
+    talloc_free(tmp);
+    return prog;
+}
+
+static void save_program_binary(struct gl_video *p, GLuint prog,
+                                const char *file)
+{
+    GL *gl = p->gl;
+
+    GLint status = 0, size = 0;
+    gl->GetProgramiv(prog, GL_LINK_STATUS, &status);
+    gl->GetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &size);
+    if (!status || size <= 0)
+        return;
+
+    void *tmp = talloc_new(NULL);
+    void *data = talloc_size(tmp, size);
+    GLenum format = 0;
+    GLsizei len = 0;
+    gl->GetProgramBinary(prog, size, &len, &format, data);
+    if (len <= 0)
+        goto done;
+
+    char *dir = mp_get_user_path(tmp, p->global, p->opts.shader_cache_dir);
+    mkdir(dir, 0700);
+
+    // Write to a temporary file first, so that other instances never see a
+    // partially written file.
+    char *tmpfile = talloc_asprintf(tmp, "%s.%d.tmp", file, (int)getpid());
+    FILE *out = fopen(tmpfile, "wb");
+    if (!out) {
+        MP_WARN(p, "Can't write program binary to '%s'.\n", tmpfile);
+        goto done;
+    }
+    uint32_t format32 = format;
+    bool ok = fprintf(out, "%s%s", PROGRAM_BINARY_HEADER, p->driver_id) > 0 &&
+              fwrite(&format32, sizeof(format32), 1, out) == 1 &&
+              fwrite(data, len, 1, out) == 1;
+    ok &= fclose(out) == 0;
+    if (ok)
+        ok = rename(tmpfile, file) == 0;
+    if (!ok) {
+        MP_WARN(p, "Can't write program binary to '%s'.\n", file);
+        unlink(tmpfile);
+    }
+
+done:
+    talloc_free(tmp);
+}
+
 static GLuint create_program(struct gl_video *p, const char *name,
                              const char *header, const char *vertex,
                              const char *frag)
 {
     GL *gl = p->gl;
-    MP_VERBOSE(p, "compiling shader program '%s', header:\n", name);
-    const char *real_header = strstr(header, PRELUDE_END);
-    real_header = real_header ? real_header + strlen(PRELUDE_END) : header;
-    mp_log_source(p->log, MSGL_V, real_header);
-    GLuint prog = gl->CreateProgram();
-    prog_create_shader(p, prog, GL_VERTEX_SHADER, header, vertex);
-    prog_create_shader(p, prog, GL_FRAGMENT_SHADER, header, frag);
-    bind_attrib_locs(gl, prog);
-    link_shader(p, prog);
+    char *source = talloc_asprintf(p, "%s%s%s", header, vertex, frag);
+    for (int n = 0; n < p->num_program_cache; n++) {
+        struct program_cache_entry *e = &p->program_cache[n];
+        if (strcmp(e->source, source) == 0) {
+            MP_DBG(p, "using cached shader program '%s'\n", name);
+            e->last_used = ++p->cache_counter;
+            talloc_free(source);
+            return e->program;
+        }
+    }
+    char *file = program_binary_file(NULL, p, source);
+    GLuint prog = file ? load_program_binary(p, file) : 0;
+    if (prog) {
+        MP_VERBOSE(p, "loaded shader program '%s' from '%s'\n", name, file);
+    } else {
+        MP_VERBOSE(p, "compiling shader program '%s', header:\n", name);
+        const char *real_header = strstr(header, PRELUDE_END);
+        real_header = real_header ? real_header + strlen(PRELUDE_END) : header;
+        mp_log_source(p->log, MSGL_V, real_header);
+        prog = gl->CreateProgram();
+        prog_create_shader(p, prog, GL_VERTEX_SHADER, header, vertex);
+        prog_create_shader(p, prog, GL_FRAGMENT_SHADER, header, frag);
+        bind_attrib_locs(gl, prog);
+        if (file)
+            gl->ProgramParameteri(prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, 1);
+        link_shader(p, prog);
+        if (file)
+            save_program_binary(p, prog, file);
+    }
+    talloc_free(file);
+    struct program_cache_entry *e = alloc_program_entry(p);
+    *e = (struct program_cache_entry){
+        .source = source,
+        .program = prog,
+        .last_used = ++p->cache_counter,
+    };
     return prog;
 }
 
@@ -966,21 +1214,29 @@ static void compile_shaders(struct gl_video *p)
     talloc_free(tmp);
 }
 
-static void delete_program(GL *gl, GLuint *prog)
+// The programs themselves stay in the program cache.
+static void delete_shaders(struct gl_video *p)
 {
-    gl->DeleteProgram(*prog);
-    *prog = 0;
+    for (int n = 0; n < SUBBITMAP_COUNT; n++)
+        p->osd_programs[n] = 0;
+    p->indirect_program = 0;
+    p->scale_sep_program = 0;
+    p->final_program = 0;
 }
 
-static void delete_shaders(struct gl_video *p)
+static void clear_caches(struct gl_video *p)
 {
     GL *gl = p->gl;
 
-    for (int n = 0; n < SUBBITMAP_COUNT; n++)
-        delete_program(gl, &p->osd_programs[n]);
-    delete_program(gl, &p->indirect_program);
-    delete_program(gl, &p->scale_sep_program);
-    delete_program(gl, &p->final_program);
+    for (int n = 0; n < p->num_program_cache; n++) {
+        gl->DeleteProgram(p->program_cache[n].program);
+        talloc_free(p->program_cache[n].source);
+    }
+    p->num_program_cache = 0;
+
+    for (int n = 0; n < p->num_lut_cache; n++)
+        gl->DeleteTextures(1, &p->lut_cache[n].texture);
+    p->num_lut_cache = 0;
 }
 
 static double get_scale_factor(struct gl_video *p)
@@ -999,52 +1255,73 @@ static bool update_scale_factor(struct gl_video *p, struct filter_kernel *kernel
     double scale = get_scale_factor(p);
     if (!p->opts.fancy_downscaling && scale < 1.0)
         scale = 1.0;
-    return mp_init_filter(kernel, filter_sizes, FFMAX(1.0, 1.0 / scale));
+    double inv_scale = FFMAX(1.0, 1.0 / scale);
+    // Rounding up only makes the filter slightly wider (no aliasing).
+    inv_scale = ceil(inv_scale * LUT_SCALE_STEPS) / LUT_SCALE_STEPS;
+    return mp_init_filter(kernel, filter_sizes, inv_scale);
 }
 
-static void init_scaler(struct gl_video *p, struct scaler *scaler)
+static bool lut_in_use(struct gl_video *p, GLuint texture)
 {
-    GL *gl = p->gl;
-
-    assert(scaler->name);
-
-    scaler->kernel = NULL;
-
-    const struct filter_kernel *t_kernel = mp_find_filter_kernel(scaler->name);
-    if (!t_kernel)
-        return;
+    return p->scalers[0].gl_lut == texture || p->scalers[1].gl_lut == texture;
+}
 
-    scaler->kernel_storage = *t_kernel;
-    scaler->kernel = &scaler->kernel_storage;
+// Return the LUT texture for the given (initialized) kernel, computing and
+// uploading it only if it's not in the cache. The texture is bound to the
+// current texture unit.
+static struct lut_cache_entry *get_lut(struct gl_video *p,
+                                       struct filter_kernel *kernel)
+{
+    GL *gl = p->gl;
 
-    for (int n = 0; n < 2; n++) {
-        if (!isnan(p->opts.scaler_params[n]))
-            scaler->kernel->params[n] = p->opts.scaler_params[n];
+    for (int n = 0; n < p->num_lut_cache; n++) {
+        struct lut_cache_entry *e = &p->lut_cache[n];
+        if (strcmp(e->kernel, kernel->name) == 0 &&
+            e->params[0] == kernel->params[0] &&
+            e->params[1] == kernel->params[1] &&
+            e->size == kernel->size && e->inv_scale == kernel->inv_scale)
+        {
+            e->last_used = ++p->cache_counter;
+            gl->BindTexture(e->target, e->texture);
+            return e;
+        }
     }
 
-    update_scale_factor(p, scaler->kernel);
+    struct lut_cache_entry *e = NULL;
+    if (p->num_lut_cache < MAX_CACHED_LUTS) {
+        e = &p->lut_cache[p->num_lut_cache++];
+    } else {
+        for (int n = 0; n < p->num_lut_cache; n++) {
+            struct lut_cache_entry *c = &p->lut_cache[n];
+            if (!lut_in_use(p, c->texture) &&
+                (!e || c->last_used < e->last_used))
+                e = c;
+        }
+        assert(e);
+        gl->DeleteTextures(1, &e->texture);
+    }
 
-    int size = scaler->kernel->size;
+    int size = kernel->size;
     assert(size < FF_ARRAY_ELEMS(lut_tex_formats));
     struct lut_tex_format *fmt = &lut_tex_formats[size];
     bool use_2d = fmt->pixels > 1;
-    bool is_luma = scaler->index == 0;
-    scaler->lut_name = use_2d
-                       ? (is_luma ? "lut_l_2d" : "lut_c_2d")
-                       : (is_luma ? "lut_l_1d" : "lut_c_1d");
 
-    gl->ActiveTexture(GL_TEXTURE0 + TEXUNIT_SCALERS + scaler->index);
-    GLenum target = use_2d ? GL_TEXTURE_2D : GL_TEXTURE_1D;
-
-    if (!scaler->gl_lut)
-        gl->GenTextures(1, &scaler->gl_lut);
+    *e = (struct lut_cache_entry){
+        .kernel = kernel->name,
+        .params = {kernel->params[0], kernel->params[1]},
+        .size = size,
+        .inv_scale = kernel->inv_scale,
+        .target = use_2d ? GL_TEXTURE_2D : GL_TEXTURE_1D,
+        .last_used = ++p->cache_counter,
+    };
 
-    gl->BindTexture(target, scaler->gl_lut);
+    gl->GenTextures(1, &e->texture);
+    gl->BindTexture(e->target, e->texture);
     gl->PixelStorei(GL_UNPACK_ALIGNMENT, 4);
     gl->PixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 
     float *weights = talloc_array(NULL, float, LOOKUP_TEXTURE_SIZE * size);
-    mp_compute_lut(scaler->kernel, LOOKUP_TEXTURE_SIZE, weights);
+    mp_compute_lut(kernel, LOOKUP_TEXTURE_SIZE, weights);
     if (use_2d) {
         gl->TexImage2D(GL_TEXTURE_2D, 0, fmt->internal_format, fmt->pixels,
                        LOOKUP_TEXTURE_SIZE, 0, fmt->format, GL_FLOAT,
@@ -1056,13 +1333,48 @@ static void init_scaler(struct gl_video *p, struct scaler *scaler)
     }
     talloc_free(weights);
 
-    gl->TexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    gl->TexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    gl->TexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    gl->TexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    gl->TexParameteri(e->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    gl->TexParameteri(e->target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    gl->TexParameteri(e->target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    gl->TexParameteri(e->target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    return e;
+}
+
+static void init_scaler(struct gl_video *p, struct scaler *scaler)
+{
+    GL *gl = p->gl;
+
+    assert(scaler->name);
 
+    scaler->kernel = NULL;
+    scaler->gl_lut = 0;
+
+    const struct filter_kernel *t_kernel = mp_find_filter_kernel(scaler->name);
+    if (!t_kernel)
+        return;
+
+    scaler->kernel_storage = *t_kernel;
+    scaler->kernel = &scaler->kernel_storage;
+
+    for (int n = 0; n < 2; n++) {
+        if (!isnan(p->opts.scaler_params[n]))
+            scaler->kernel->params[n] = p->opts.scaler_params[n];
+    }
+
+    update_scale_factor(p, scaler->kernel);
+
+    gl->ActiveTexture(GL_TEXTURE0 + TEXUNIT_SCALERS + scaler->index);
+    struct lut_cache_entry *lut = get_lut(p, scaler->kernel);
+    scaler->gl_lut = lut->texture;
     gl->ActiveTexture(GL_TEXTURE0);
 
+    bool use_2d = lut->target == GL_TEXTURE_2D;
+    bool is_luma = scaler->index == 0;
+    scaler->lut_name = use_2d
+                       ? (is_luma ? "lut_l_2d" : "lut_c_2d")
+                       : (is_luma ? "lut_l_1d" : "lut_c_1d");
+
     debug_check_gl(p, "after initializing scaler");
 }
 
@@ -1193,7 +1505,7 @@ static void uninit_rendering(struct gl_video *p)
     delete_shaders(p);
 
     for (int n = 0; n < 2; n++) {
-        gl->DeleteTextures(1, &p->scalers[n].gl_lut);
+        // The texture is owned by the LUT cache.
         p->scalers[n].gl_lut = 0;
         p->scalers[n].lut_name = NULL;
         p->scalers[n].kernel = NULL;
@@ -1366,20 +1678,31 @@ static void uninit_video(struct gl_video *p)
 
     struct video_image *vimg = &p->image;
 
-    for (int n = 0; n < 3; n++) {
+    for (int n = 0; n < MP_ARRAY_SIZE(vimg->planes); n++) {
         struct texplane *plane = &vimg->planes[n];
 
         gl->DeleteTextures(1, &plane->gl_texture);
         plane->gl_texture = 0;
-        gl->DeleteBuffers(1, &plane->gl_buffer);
-        plane->gl_buffer = 0;
-        plane->buffer_ptr = NULL;
-        plane->buffer_size = 0;
+        for (int i = 0; i < NUM_PBOS; i++) {
+            struct pbo *pbo = &plane->pbos[i];
+            gl->DeleteBuffers(1, &pbo->buffer);
+            *pbo = (struct pbo){0};
+        }
     }
+    for (int i = 0; i < NUM_PBOS; i++) {
+        if (vimg->pbo_fences[i])
+            gl->DeleteSync(vimg->pbo_fences[i]);
+        vimg->pbo_fences[i] = NULL;
+    }
+    vimg->cur_pbo = 0;
     mp_image_unrefp(&vimg->hwimage);
+    mp_image_unrefp(&vimg->mpi);
 
     fbotex_uninit(p, &p->indirect_fbo);
     fbotex_uninit(p, &p->scale_sep_fbo);
+    fbotex_uninit(p, &p->video_fbo);
+    p->video_fbo_valid = false;
+    p->frame_rendered = false;
 }
 
 static void change_dither_trafo(struct gl_video *p)
@@ -1438,6 +1761,44 @@ static void handle_pass(struct gl_video *p, struct fbotex *chain,
     *chain = *fbo;
 }
 
+// Copy the viewport area from one framebuffer to another (0 is the window).
+static void blit_viewport(struct gl_video *p, GLuint src, GLuint dst)
+{
+    GL *gl = p->gl;
+
+    int x0 = p->vp_x, y0 = p->vp_y;
+    int x1 = x0 + p->vp_w, y1 = y0 + p->vp_h;
+    gl->BindFramebuffer(GL_READ_FRAMEBUFFER, src);
+    gl->BindFramebuffer(GL_DRAW_FRAMEBUFFER, dst);
+    gl->BlitFramebuffer(x0, y0, x1, y1, x0, y0, x1, y1,
+                        GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    gl->BindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+static bool can_cache_video(struct gl_video *p)
+{
+    // Temporal dithering is supposed to change on every redraw.
+    return p->gl->BlitFramebuffer && (p->gl->mpgl_caps & MPGL_CAP_FB) &&
+           !p->opts.temporal_dither &&
+           p->opts.stereo_mode != GL_3D_QUADBUFFER;
+}
+
+// Store the video just rendered to the target in video_fbo.
+static void cache_video(struct gl_video *p)
+{
+    int w = p->vp_x + p->vp_w, h = p->vp_y + p->vp_h;
+    if (w > p->video_fbo.tex_w || h > p->video_fbo.tex_h) {
+        fbotex_uninit(p, &p->video_fbo);
+        GLenum fmt = p->depth_g > 8 ? GL_RGB10_A2 : GL_RGBA8;
+        if (!fbotex_init(p, &p->video_fbo, w, h, fmt)) {
+            fbotex_uninit(p, &p->video_fbo);
+            return;
+        }
+    }
+    blit_viewport(p, 0, p->video_fbo.fbo);
+    p->video_fbo_valid = true;
+}
+
 void gl_video_render_frame(struct gl_video *p)
 {
     GL *gl = p->gl;
@@ -1448,6 +1809,12 @@ void gl_video_render_frame(struct gl_video *p)
     if (p->opts.temporal_dither)
         change_dither_trafo(p);
 
+    if (p->have_image && p->video_fbo_valid) {
+        blit_viewport(p, p->video_fbo.fbo, 0);
+        debug_check_gl(p, "after redrawing cached video");
+        return;
+    }
+
     if (p->dst_rect.x0 > p->vp_x || p->dst_rect.y0 > p->vp_y
         || p->dst_rect.x1 < p->vp_x + p->vp_w
         || p->dst_rect.y1 < p->vp_y + p->vp_h)
@@ -1534,6 +1901,12 @@ void gl_video_render_frame(struct gl_video *p)
 
     unset_image_textures(p);
 
+    // Rendering the same frame a second time means it's probably a redraw
+    // while paused, and more will follow.
+    if (p->frame_rendered && can_cache_video(p))
+        cache_video(p);
+    p->frame_rendered = true;
+
     p->frames_rendered++;
 
     debug_check_gl(p, "after video rendering");
@@ -1602,12 +1975,30 @@ void gl_video_resize(struct gl_video *p, struct mp_rect *window,
     p->vp_y = window->y0;
     p->vp_w = window->x1 - window->x0;
     p->vp_h = window->y1 - window->y0;
+    p->video_fbo_valid = false;
 
     p->gl->Viewport(p->vp_x, p->vp_y, p->vp_w, p->vp_h);
 
     check_resize(p);
 }
 
+// Wait until the GPU is done with the PBOs in the given ring slot.
+static void wait_pbo_fence(struct gl_video *p, int index)
+{
+    GL *gl = p->gl;
+    GLsync *fence = &p->image.pbo_fences[index];
+    if (!*fence)
+        return;
+    // If this blocks at all, the GPU is more than NUM_PBOS frames behind.
+    // Don't wait forever if the driver is broken; mapping syncs anyway.
+    GLenum res = gl->ClientWaitSync(*fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                    1000 * 1000 * 1000);
+    if (res == GL_TIMEOUT_EXPIRED || res == GL_WAIT_FAILED)
+        MP_WARN(p, "Waiting for PBO upload failed.\n");
+    gl->DeleteSync(*fence);
+    *fence = NULL;
+}
+
 static bool get_image(struct gl_video *p, struct mp_image *mpi)
 {
     GL *gl = p->gl;
@@ -1616,28 +2007,38 @@ static bool get_image(struct gl_video *p, struct mp_image *mpi)
         return false;
 
     struct video_image *vimg = &p->image;
+    bool have_sync = gl->mpgl_caps & MPGL_CAP_SYNC;
 
     // See comments in init_video() about odd video sizes.
     // The normal upload path does this too, but less explicit.
     mp_image_set_size(mpi, vimg->planes[0].w, vimg->planes[0].h);
 
+    if (have_sync)
+        wait_pbo_fence(p, vimg->cur_pbo);
+
     for (int n = 0; n < p->plane_count; n++) {
         struct texplane *plane = &vimg->planes[n];
+        struct pbo *pbo = &plane->pbos[vimg->cur_pbo];
         mpi->stride[n] = mpi->plane_w[n] * p->image_desc.bytes[n];
         int needed_size = mpi->plane_h[n] * mpi->stride[n];
-        if (!plane->gl_buffer)
-            gl->GenBuffers(1, &plane->gl_buffer);
-        gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, plane->gl_buffer);
-        if (needed_size > plane->buffer_size) {
-            plane->buffer_size = needed_size;
-            gl->BufferData(GL_PIXEL_UNPACK_BUFFER, plane->buffer_size,
-                           NULL, GL_DYNAMIC_DRAW);
+        if (!pbo->buffer)
+            gl->GenBuffers(1, &pbo->buffer);
+        gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo->buffer);
+        // Without fences, orphan the buffer instead, so that mapping it
+        // doesn't wait for a pending upload from the old storage.
+        if (needed_size > pbo->size || (!have_sync && !pbo->ptr)) {
+            pbo->size = MPMAX(pbo->size, needed_size);
+            gl->BufferData(GL_PIXEL_UNPACK_BUFFER, pbo->size,
+                           NULL, GL_STREAM_DRAW);
         }
-        if (!plane->buffer_ptr)
-            plane->buffer_ptr = gl->MapBuffer(GL_PIXEL_UNPACK_BUFFER,
-                                              GL_WRITE_ONLY);
-        mpi->planes[n] = plane->buffer_ptr;
+        if (!pbo->ptr)
+            pbo->ptr = gl->MapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+        mpi->planes[n] = pbo->ptr;
         gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (!pbo->ptr) {
+            MP_ERR(p, "Mapping video PBO failed.\n");
+            return false;
+        }
     }
     return true;
 }
@@ -1648,6 +2049,9 @@ void gl_video_upload_image(struct gl_video *p, struct mp_image *mpi)
 
     struct video_image *vimg = &p->image;
 
+    p->video_fbo_valid = false;
+    p->frame_rendered = false;
+
     if (p->hwdec_active) {
         mp_image_setrefp(&vimg->hwimage, mpi);
         p->have_image = true;
@@ -1656,13 +2060,20 @@ void gl_video_upload_image(struct gl_video *p, struct mp_image *mpi)
 
     assert(mpi->num_planes == p->plane_count);
 
+    // Keeping a reference is free, and lets screenshots avoid reading back the
+    // textures. Non-refcounted images would have to be copied for this.
+    mp_image_unrefp(&vimg->mpi);
+    if (mpi->refcount)
+        vimg->mpi = mp_image_new_ref(mpi);
+
     mp_image_t mpi2 = *mpi;
     bool pbo = false;
-    if (!vimg->planes[0].buffer_ptr && get_image(p, &mpi2)) {
+    if (get_image(p, &mpi2)) {
         for (int n = 0; n < p->plane_count; n++) {
             int line_bytes = mpi->plane_w[n] * p->image_desc.bytes[n];
-            memcpy_pic(mpi2.planes[n], mpi->planes[n], line_bytes, mpi->plane_h[n],
-                       mpi2.stride[n], mpi->stride[n]);
+            memcpy_pic_ex(mpi2.planes[n], mpi->planes[n], line_bytes,
+                          mpi->plane_h[n], mpi2.stride[n], mpi->stride[n],
+                          MP_COPY_STREAM | MP_COPY_THREADS);
         }
         mpi = &mpi2;
         pbo = true;
@@ -1672,11 +2083,12 @@ void gl_video_upload_image(struct gl_video *p, struct mp_image *mpi)
         struct texplane *plane = &vimg->planes[n];
         void *plane_ptr = mpi->planes[n];
         if (pbo) {
-            gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, plane->gl_buffer);
+            struct pbo *buf = &plane->pbos[vimg->cur_pbo];
+            gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, buf->buffer);
             if (!gl->UnmapBuffer(GL_PIXEL_UNPACK_BUFFER))
                 MP_FATAL(p, "Video PBO upload failed. "
                          "Remove the 'pbo' suboption.\n");
-            plane->buffer_ptr = NULL;
+            buf->ptr = NULL;
             plane_ptr = NULL; // PBO offset 0
         }
         gl->ActiveTexture(GL_TEXTURE0 + n);
@@ -1687,6 +2099,16 @@ void gl_video_upload_image(struct gl_video *p, struct mp_image *mpi)
     gl->ActiveTexture(GL_TEXTURE0);
     gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
+    if (pbo) {
+        // The texture uploads run asynchronously; the next frame goes into
+        // the next set of PBOs, so that it doesn't wait for them.
+        if (gl->mpgl_caps & MPGL_CAP_SYNC) {
+            vimg->pbo_fences[vimg->cur_pbo] =
+                gl->FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+        vimg->cur_pbo = (vimg->cur_pbo + 1) % NUM_PBOS;
+    }
+
     p->have_image = true;
 }
 
@@ -1707,6 +2129,12 @@ struct mp_image *gl_video_download_image(struct gl_video *p)
         return dlimage;
     }
 
+    if (vimg->mpi) {
+        struct mp_image *image = mp_image_new_ref(vimg->mpi);
+        mp_image_set_attributes(image, &p->image_params);
+        return image;
+    }
+
     set_image_textures(p, vimg, NULL);
 
     assert(p->texture_w >= p->image_params.w);
@@ -1926,6 +2354,14 @@ static int init_gl(struct gl_video *p)
 
     check_gl_features(p);
 
+    const char *id[3];
+    GLenum id_names[3] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+    for (int n = 0; n < 3; n++) {
+        id[n] = (const char *)gl->GetString(id_names[n]);
+        id[n] = id[n] ? id[n] : "";
+    }
+    p->driver_id = talloc_asprintf(p, "%s\n%s\n%s\n", id[0], id[1], id[2]);
+
     gl->Disable(GL_DITHER);
     gl->Disable(GL_BLEND);
     gl->Disable(GL_DEPTH_TEST);
@@ -1958,6 +2394,7 @@ void gl_video_uninit(struct gl_video *p)
     GL *gl = p->gl;
 
     uninit_video(p);
+    clear_caches(p);
 
     if (gl->DeleteVertexArrays)
         gl->DeleteVertexArrays(1, &p->vao);
@@ -2135,12 +2572,14 @@ void gl_video_set_output_depth(struct gl_video *p, int r, int g, int b)
     p->depth_g = g;
 }
 
-struct gl_video *gl_video_init(GL *gl, struct mp_log *log)
+struct gl_video *gl_video_init(GL *gl, struct mp_log *log,
+                               struct mpv_global *global)
 {
     struct gl_video *p = talloc_ptrtype(NULL, p);
     *p = (struct gl_video) {
         .gl = gl,
         .log = log,
+        .global = global,
         .opts = gl_video_opts_def,
         .gl_target = GL_TEXTURE_2D,
         .gl_debug = true,
@@ -2244,6 +2683,7 @@ void gl_video_resize_redraw(struct gl_video *p, int w, int h)
     p->gl->Viewport(p->vp_x, p->vp_y, w, h);
     p->vp_w = w;
     p->vp_h = h;
+    p->video_fbo_valid = false;
     gl_video_render_frame(p);
     mpgl_osd_redraw_cb(p->osd, draw_osd_cb, p);
 }
@@ -47,6 +47,7 @@ struct gl_video_opts {
     int alpha_mode;
     int chroma_location;
     int use_rectangle;
+    char *shader_cache_dir;
 };
 
 extern const struct m_sub_options gl_video_conf;
@@ -54,7 +55,9 @@ extern const struct gl_video_opts gl_video_opts_hq_def;
 
 struct gl_video;
 
-struct gl_video *gl_video_init(GL *gl, struct mp_log *log);
+struct mpv_global;
+struct gl_video *gl_video_init(GL *gl, struct mp_log *log,
+                               struct mpv_global *global);
 void gl_video_uninit(struct gl_video *p);
 void gl_video_set_options(struct gl_video *p, struct gl_video_opts *opts);
 bool gl_video_check_format(struct gl_video *p, int mp_format);
@@ -23,8 +23,14 @@
 #include <string.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <pthread.h>
 
 #include <unistd.h>
+#include <fcntl.h>
+#ifndef __MINGW32__
+#include <poll.h>
+#endif
 
 #include <libavutil/common.h>
 
@@ -32,6 +38,8 @@
 
 #include "config.h"
 #include "osdep/timer.h"
+#include "osdep/threads.h"
+#include "osdep/io.h"
 #include "options/options.h"
 #include "bstr/bstr.h"
 #include "vo.h"
@@ -142,6 +150,297 @@ const struct m_obj_list vo_obj_list = {
     .allow_trailer = true,
 };
 
+// Commands queued for the VO thread. Only draw_image and flip_page are run
+// asynchronously; everything else goes through vo_dispatch() and waits for
+// completion. With a single frame in flight there are never more than a few
+// commands queued.
+#define VO_QUEUE_SIZE 8
+
+enum vo_cmd_type {
+    VO_CMD_CALL,
+    VO_CMD_DRAW_IMAGE,
+    VO_CMD_FLIP_PAGE,
+};
+
+struct vo_cmd {
+    enum vo_cmd_type type;
+    // VO_CMD_CALL
+    void (*fn)(void *ctx);
+    void *ctx;
+    bool *done;
+    // VO_CMD_DRAW_IMAGE (owned by the command)
+    struct mp_image *mpi;
+    // VO_CMD_FLIP_PAGE
+    int64_t pts_us;
+    int duration;
+};
+
+struct vo_internal {
+    bool threaded;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;      // signaled on new commands
+    pthread_cond_t done;        // signaled after each finished command
+    int wakeup_pipe[2];         // for interrupting poll() on vo->event_fd
+
+    // Protected by lock.
+    struct vo_cmd queue[VO_QUEUE_SIZE];
+    int queue_start, queue_num;
+    int frames_queued;          // draw_image/flip_page commands not done yet
+    bool check_events;          // VOCTRL_CHECK_EVENTS requested
+    bool initialized;           // preinit succeeded, uninit must be called
+    bool terminate;
+    // vo->want_redraw is set by the drivers on the VO thread; this is the
+    // copy the playloop sees.
+    bool want_redraw;
+};
+
+// Move vo->want_redraw (as set by the driver) to the playloop visible flag.
+// Returns true if the playloop has to be woken up for it. Lock must be held.
+static bool update_want_redraw(struct vo *vo)
+{
+    struct vo_internal *in = vo->in;
+    if (!vo->want_redraw)
+        return false;
+    vo->want_redraw = false;
+    bool wakeup = !in->want_redraw;
+    in->want_redraw = true;
+    return wakeup;
+}
+
+static void run_cmd(struct vo *vo, struct vo_cmd *cmd)
+{
+    switch (cmd->type) {
+    case VO_CMD_CALL:
+        cmd->fn(cmd->ctx);
+        break;
+    case VO_CMD_DRAW_IMAGE:
+        vo->driver->draw_image(vo, cmd->mpi);
+        talloc_free(cmd->mpi);
+        break;
+    case VO_CMD_FLIP_PAGE:
+        if (vo->driver->flip_page_timed)
+            vo->driver->flip_page_timed(vo, cmd->pts_us, cmd->duration);
+        else
+            vo->driver->flip_page(vo);
+        break;
+    }
+}
+
+static void wakeup_vo(struct vo *vo)
+{
+    struct vo_internal *in = vo->in;
+    pthread_cond_signal(&in->wakeup);
+    if (in->wakeup_pipe[1] >= 0)
+        write(in->wakeup_pipe[1], &(char){0}, 1);
+}
+
+// Wait for new commands, and for window events on vo->event_fd if the driver
+// provides one. Lock must be held.
+static void wait_vo(struct vo *vo)
+{
+    struct vo_internal *in = vo->in;
+    double timeout = vo->wakeup_period;
+#ifndef __MINGW32__
+    if (vo->config_ok && vo->event_fd >= 0 && in->wakeup_pipe[0] >= 0) {
+        pthread_mutex_unlock(&in->lock);
+        struct pollfd fds[2] = {
+            { .fd = in->wakeup_pipe[0], .events = POLLIN },
+            { .fd = vo->event_fd,       .events = POLLIN },
+        };
+        poll(fds, 2, timeout > 0 ? timeout * 1000 : -1);
+        char buf[100];
+        while (read(in->wakeup_pipe[0], buf, sizeof(buf)) > 0) {}
+        pthread_mutex_lock(&in->lock);
+        if (fds[1].revents || (timeout > 0 && !fds[0].revents))
+            in->check_events = true;
+        return;
+    }
+#endif
+    if (vo->config_ok && timeout > 0) {
+        if (mpthread_cond_timed_wait(&in->wakeup, &in->lock, timeout))
+            in->check_events = true;
+    } else {
+        pthread_cond_wait(&in->wakeup, &in->lock);
+    }
+}
+
+static void *vo_thread(void *ptr)
+{
+    struct vo *vo = ptr;
+    struct vo_internal *in = vo->in;
+
+    pthread_mutex_lock(&in->lock);
+    while (1) {
+        if (in->queue_num) {
+            struct vo_cmd cmd = in->queue[in->queue_start];
+            in->queue_start = (in->queue_start + 1) % VO_QUEUE_SIZE;
+            in->queue_num--;
+            pthread_mutex_unlock(&in->lock);
+            run_cmd(vo, &cmd);
+            pthread_mutex_lock(&in->lock);
+            if (cmd.type != VO_CMD_CALL)
+                in->frames_queued--;
+            if (cmd.done)
+                *cmd.done = true;
+        } else if (in->terminate) {
+            break;
+        } else if (in->check_events && vo->config_ok) {
+            in->check_events = false;
+            pthread_mutex_unlock(&in->lock);
+            vo->driver->control(vo, VOCTRL_CHECK_EVENTS, NULL);
+            pthread_mutex_lock(&in->lock);
+        } else {
+            in->check_events = false;
+            wait_vo(vo);
+            continue;
+        }
+        bool wakeup = update_want_redraw(vo);
+        pthread_cond_broadcast(&in->done);
+        if (wakeup) {
+            // Not under our lock, as the input code may call into the VO.
+            pthread_mutex_unlock(&in->lock);
+            mp_input_wakeup(vo->input_ctx);
+            pthread_mutex_lock(&in->lock);
+        }
+    }
+    pthread_mutex_unlock(&in->lock);
+
+    if (in->initialized)
+        vo->driver->uninit(vo);
+    return NULL;
+}
+
+// Add a command to the queue. Lock must be held.
+static void queue_cmd(struct vo *vo, struct vo_cmd cmd)
+{
+    struct vo_internal *in = vo->in;
+    while (in->queue_num == VO_QUEUE_SIZE)
+        pthread_cond_wait(&in->done, &in->lock);
+    in->queue[(in->queue_start + in->queue_num) % VO_QUEUE_SIZE] = cmd;
+    in->queue_num++;
+    wakeup_vo(vo);
+}
+
+// Run cmd on the VO thread without waiting for it, or directly if the VO is
+// not threaded.
+static void post_cmd(struct vo *vo, struct vo_cmd cmd)
+{
+    struct vo_internal *in = vo->in;
+    if (!in->threaded) {
+        run_cmd(vo, &cmd);
+        update_want_redraw(vo);
+        return;
+    }
+    pthread_mutex_lock(&in->lock);
+    in->frames_queued++;
+    queue_cmd(vo, cmd);
+    pthread_mutex_unlock(&in->lock);
+}
+
+// Run fn(ctx) on the VO thread, and wait until it has returned. This is used
+// for all driver entry points other than draw_image and flip_page, since the
+// drivers (and the OSD state passed to them) are not thread-safe.
+static void vo_dispatch(struct vo *vo, void (*fn)(void *ctx), void *ctx)
+{
+    struct vo_internal *in = vo->in;
+    if (!in->threaded) {
+        fn(ctx);
+        update_want_redraw(vo);
+        return;
+    }
+    // Driver code calling back into the VO API (vo_mouse_movement()).
+    if (pthread_equal(pthread_self(), in->thread)) {
+        fn(ctx);
+        return;
+    }
+    bool done = false;
+    pthread_mutex_lock(&in->lock);
+    queue_cmd(vo, (struct vo_cmd){ .type = VO_CMD_CALL, .fn = fn, .ctx = ctx,
+                                   .done = &done });
+    while (!done)
+        pthread_cond_wait(&in->done, &in->lock);
+    pthread_mutex_unlock(&in->lock);
+}
+
+static bool use_thread(struct vo *vo)
+{
+    if (!vo->opts->threaded)
+        return false;
+    // The encoding VO shares its state with the audio encoder, and must run
+    // on the playloop thread.
+    if (vo->driver->encode)
+        return false;
+    // The vaapi and vdpau contexts, and the X11 connection they use, have no
+    // locking. Once the decoder or a filter on the playloop thread uses the
+    // VO's context, the VO must run on the same thread. (hwdec_api 0 is
+    // --hwdec=no.)
+    if (vo->global->opts->hwdec_api != 0 || vo->driver->shares_hwdec_ctx) {
+        MP_VERBOSE(&vo->vo_log, "Not using a VO thread with hardware "
+                   "decoding contexts.\n");
+        return false;
+    }
+    return true;
+}
+
+static bool start_thread(struct vo *vo)
+{
+    struct vo_internal *in = vo->in;
+#ifndef __MINGW32__
+    if (pipe(in->wakeup_pipe) == 0) {
+        for (int i = 0; i < 2; i++) {
+            mp_set_cloexec(in->wakeup_pipe[i]);
+            int fl = fcntl(in->wakeup_pipe[i], F_GETFL);
+            if (fl >= 0)
+                fcntl(in->wakeup_pipe[i], F_SETFL, fl | O_NONBLOCK);
+        }
+    } else {
+        MP_ERR(&vo->vo_log, "Failed to create wakeup pipe: %s\n",
+               strerror(errno));
+        in->wakeup_pipe[0] = in->wakeup_pipe[1] = -1;
+    }
+#endif
+    if (pthread_create(&in->thread, NULL, vo_thread, vo)) {
+        MP_ERR(&vo->vo_log, "Failed to create VO thread.\n");
+        return false;
+    }
+    in->threaded = true;
+    return true;
+}
+
+static void stop_thread(struct vo *vo)
+{
+    struct vo_internal *in = vo->in;
+    if (in->threaded) {
+        pthread_mutex_lock(&in->lock);
+        in->terminate = true;
+        wakeup_vo(vo);
+        pthread_mutex_unlock(&in->lock);
+        pthread_join(in->thread, NULL);
+    } else if (in->initialized) {
+        vo->driver->uninit(vo);
+    }
+    for (int i = 0; i < 2; i++) {
+        if (in->wakeup_pipe[i] >= 0)
+            close(in->wakeup_pipe[i]);
+    }
+    pthread_cond_destroy(&in->wakeup);
+    pthread_cond_destroy(&in->done);
+    pthread_mutex_destroy(&in->lock);
+}
+
+struct preinit_args {
+    struct vo *vo;
+    int ret;
+};
+
+static void run_preinit(void *p)
+{
+    struct preinit_args *a = p;
+    a->ret = a->vo->driver->preinit(a->vo);
+    a->vo->in->initialized = a->ret == 0;
+}
+
 static struct vo *vo_create(struct mpv_global *global,
                             struct input_ctx *input_ctx,
                             struct encode_lavc_context *encode_lavc_ctx,
@@ -169,6 +468,11 @@ static struct vo *vo_create(struct mpv_global *global,
         .next_pts = MP_NOPTS_VALUE,
         .next_pts2 = MP_NOPTS_VALUE,
     };
+    vo->in = talloc_zero(vo, struct vo_internal);
+    vo->in->wakeup_pipe[0] = vo->in->wakeup_pipe[1] = -1;
+    pthread_mutex_init(&vo->in->lock, NULL);
+    pthread_cond_init(&vo->in->wakeup, NULL);
+    pthread_cond_init(&vo->in->done, NULL);
     if (vo->driver->encode != !!vo->encode_lavc_ctx)
         goto error;
     struct m_config *config = m_config_from_obj_desc(vo, vo->log, &desc);
@@ -177,17 +481,73 @@ static struct vo *vo_create(struct mpv_global *global,
     if (m_config_set_obj_params(config, args) < 0)
         goto error;
     vo->priv = config->optstruct;
-    if (vo->driver->preinit(vo))
+    if (use_thread(vo) && !start_thread(vo))
+        goto error;
+    struct preinit_args a = {vo};
+    vo_dispatch(vo, run_preinit, &a);
+    if (a.ret)
         goto error;
     return vo;
 error:
+    stop_thread(vo);
     talloc_free(vo);
     return NULL;
 }
 
+struct control_args {
+    struct vo *vo;
+    uint32_t request;
+    void *data;
+    int ret;
+};
+
+static void run_control(void *p)
+{
+    struct control_args *a = p;
+    struct vo *vo = a->vo;
+    if (a->request == VOCTRL_UPDATE_WINDOW_TITLE) {
+        talloc_free(vo->window_title);
+        vo->window_title = talloc_strdup(vo, (char *)a->data);
+    }
+    a->ret = vo->driver->control(vo, a->request, a->data);
+}
+
 int vo_control(struct vo *vo, uint32_t request, void *data)
 {
-    return vo->driver->control(vo, request, data);
+    struct control_args a = {vo, request, data};
+    vo_dispatch(vo, run_control, &a);
+    return a.ret;
+}
+
+struct query_format_args {
+    struct vo *vo;
+    int format;
+    int ret;
+};
+
+static void run_query_format(void *p)
+{
+    struct query_format_args *a = p;
+    a->ret = a->vo->driver->query_format(a->vo, a->format);
+}
+
+// Return the driver's VFCAP_* flags for the given format (0 if unsupported).
+int vo_query_format(struct vo *vo, int format)
+{
+    struct query_format_args a = {vo, format};
+    vo_dispatch(vo, run_query_format, &a);
+    return a.ret;
+}
+
+struct draw_image_args {
+    struct vo *vo;
+    struct mp_image *mpi;
+};
+
+static void run_draw_image(void *p)
+{
+    struct draw_image_args *a = p;
+    a->vo->driver->draw_image(a->vo, a->mpi);
 }
 
 void vo_queue_image(struct vo *vo, struct mp_image *mpi)
@@ -195,7 +555,7 @@ void vo_queue_image(struct vo *vo, struct mp_image *mpi)
     if (!vo->config_ok)
         return;
     if (vo->driver->buffer_frames) {
-        vo->driver->draw_image(vo, mpi);
+        vo_dispatch(vo, run_draw_image, &(struct draw_image_args){vo, mpi});
         return;
     }
     vo->frame_loaded = true;
@@ -210,7 +570,9 @@ int vo_redraw_frame(struct vo *vo)
     if (!vo->config_ok)
         return -1;
     if (vo_control(vo, VOCTRL_REDRAW_FRAME, NULL) == true) {
-        vo->want_redraw = false;
+        pthread_mutex_lock(&vo->in->lock);
+        vo->in->want_redraw = false;
+        pthread_mutex_unlock(&vo->in->lock);
         vo->redrawing = true;
         return 0;
     }
@@ -221,7 +583,21 @@ bool vo_get_want_redraw(struct vo *vo)
 {
     if (!vo->config_ok)
         return false;
-    return vo->want_redraw;
+    pthread_mutex_lock(&vo->in->lock);
+    bool r = vo->in->want_redraw;
+    pthread_mutex_unlock(&vo->in->lock);
+    return r;
+}
+
+struct get_buffered_frame_args {
+    struct vo *vo;
+    bool eof;
+};
+
+static void run_get_buffered_frame(void *p)
+{
+    struct get_buffered_frame_args *a = p;
+    a->vo->driver->get_buffered_frame(a->vo, a->eof);
 }
 
 int vo_get_buffered_frame(struct vo *vo, bool eof)
@@ -232,7 +608,8 @@ int vo_get_buffered_frame(struct vo *vo, bool eof)
         return 0;
     if (!vo->driver->buffer_frames)
         return -1;
-    vo->driver->get_buffered_frame(vo, eof);
+    vo_dispatch(vo, run_get_buffered_frame,
+                &(struct get_buffered_frame_args){vo, eof});
     return vo->frame_loaded ? 0 : -1;
 }
 
@@ -251,15 +628,33 @@ void vo_new_frame_imminent(struct vo *vo)
         assert(vo->frame_loaded);
         assert(vo->waiting_mpi);
         assert(vo->waiting_mpi->pts == vo->next_pts);
-        vo->driver->draw_image(vo, vo->waiting_mpi);
-        mp_image_unrefp(&vo->waiting_mpi);
+        struct vo_internal *in = vo->in;
+        // Don't queue more than one frame ahead of the display.
+        pthread_mutex_lock(&in->lock);
+        while (in->frames_queued)
+            pthread_cond_wait(&in->done, &in->lock);
+        pthread_mutex_unlock(&in->lock);
+        post_cmd(vo, (struct vo_cmd){ .type = VO_CMD_DRAW_IMAGE,
+                                      .mpi = vo->waiting_mpi });
+        vo->waiting_mpi = NULL;
     }
 }
 
+struct draw_osd_args {
+    struct vo *vo;
+    struct osd_state *osd;
+};
+
+static void run_draw_osd(void *p)
+{
+    struct draw_osd_args *a = p;
+    a->vo->driver->draw_osd(a->vo, a->osd);
+}
+
 void vo_draw_osd(struct vo *vo, struct osd_state *osd)
 {
     if (vo->config_ok && vo->driver->draw_osd)
-        vo->driver->draw_osd(vo, osd);
+        vo_dispatch(vo, run_draw_osd, &(struct draw_osd_args){vo, osd});
 }
 
 void vo_flip_page(struct vo *vo, int64_t pts_us, int duration)
@@ -271,23 +666,32 @@ void vo_flip_page(struct vo *vo, int64_t pts_us, int duration)
         vo->next_pts = MP_NOPTS_VALUE;
         vo->next_pts2 = MP_NOPTS_VALUE;
     }
-    vo->want_redraw = false;
+    pthread_mutex_lock(&vo->in->lock);
+    vo->in->want_redraw = false;
+    pthread_mutex_unlock(&vo->in->lock);
     vo->redrawing = false;
-    if (vo->driver->flip_page_timed)
-        vo->driver->flip_page_timed(vo, pts_us, duration);
-    else
-        vo->driver->flip_page(vo);
+    post_cmd(vo, (struct vo_cmd){ .type = VO_CMD_FLIP_PAGE, .pts_us = pts_us,
+                                  .duration = duration });
     vo->hasframe = true;
 }
 
 void vo_check_events(struct vo *vo)
 {
+    struct vo_internal *in = vo->in;
     if (!vo->config_ok) {
         if (vo->registered_fd != -1)
             mp_input_rm_key_fd(vo->input_ctx, vo->registered_fd);
         vo->registered_fd = -1;
         return;
     }
+    if (in->threaded) {
+        // Merged with pending requests; the VO thread also polls by itself.
+        pthread_mutex_lock(&in->lock);
+        in->check_events = true;
+        wakeup_vo(vo);
+        pthread_mutex_unlock(&in->lock);
+        return;
+    }
     vo_control(vo, VOCTRL_CHECK_EVENTS, NULL);
 }
 
@@ -306,7 +710,7 @@ void vo_destroy(struct vo *vo)
     if (vo->registered_fd != -1)
         mp_input_rm_key_fd(vo->input_ctx, vo->registered_fd);
     mp_image_unrefp(&vo->waiting_mpi);
-    vo->driver->uninit(vo);
+    stop_thread(vo);
     talloc_free(vo);
 }
 
@@ -401,8 +805,20 @@ static int event_fd_callback(void *ctx, int fd)
     return MP_INPUT_NOTHING;
 }
 
-int vo_reconfig(struct vo *vo, struct mp_image_params *params, int flags)
+struct reconfig_args {
+    struct vo *vo;
+    struct mp_image_params *params;
+    int flags;
+    int ret;
+};
+
+static void run_reconfig(void *p)
 {
+    struct reconfig_args *a = p;
+    struct vo *vo = a->vo;
+    struct mp_image_params *params = a->params;
+    int flags = a->flags;
+
     int d_width = params->d_w;
     int d_height = params->d_h;
     aspect_save_videores(vo, params->w, params->h, d_width, d_height);
@@ -433,7 +849,18 @@ int vo_reconfig(struct vo *vo, struct mp_image_params *params, int flags)
     vo->config_count += vo->config_ok;
     if (vo->config_ok)
         vo->params = talloc_memdup(vo, &p2, sizeof(p2));
-    if (vo->registered_fd == -1 && vo->event_fd != -1 && vo->config_ok) {
+    a->ret = ret;
+}
+
+int vo_reconfig(struct vo *vo, struct mp_image_params *params, int flags)
+{
+    struct reconfig_args a = {vo, params, flags};
+    vo_dispatch(vo, run_reconfig, &a);
+    int ret = a.ret;
+    // With the VO thread, event_fd is polled by the VO thread instead.
+    if (vo->registered_fd == -1 && vo->event_fd != -1 && vo->config_ok &&
+        !vo->in->threaded)
+    {
         mp_input_add_fd(vo->input_ctx, vo->event_fd, 1, NULL, event_fd_callback,
                         NULL, vo);
         vo->registered_fd = vo->event_fd;
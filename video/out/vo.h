@@ -138,6 +138,10 @@ struct vo_driver {
     // Encoding functionality, which can be invoked via --o only.
     bool encode;
 
+    // The driver's hardware decoding context (VOCTRL_GET_HWDEC_INFO) is used
+    // outside of the VO even without hardware decoding (e.g. by vf_vavpp).
+    bool shares_hwdec_ctx;
+
     const char *name;
     const char *description;
 
@@ -276,6 +280,8 @@ struct vo {
     } aspdat;
 
     char *window_title;
+
+    struct vo_internal *in;
 };
 
 struct mpv_global;
@@ -285,6 +291,7 @@ struct vo *init_best_video_out(struct mpv_global *global,
 int vo_reconfig(struct vo *vo, struct mp_image_params *p, int flags);
 
 int vo_control(struct vo *vo, uint32_t request, void *data);
+int vo_query_format(struct vo *vo, int format);
 void vo_queue_image(struct vo *vo, struct mp_image *mpi);
 int vo_redraw_frame(struct vo *vo);
 bool vo_get_want_redraw(struct vo *vo);
@@ -27,6 +27,7 @@
 #include "config.h"
 #include "bstr/bstr.h"
 #include "osdep/io.h"
+#include "osdep/numcores.h"
 #include "options/path.h"
 #include "talloc.h"
 #include "common/msg.h"
@@ -43,7 +44,9 @@
 struct priv {
     struct image_writer_opts *opts;
     char *outdir;
+    int threads;
 
+    struct image_writer_queue *queue;
     struct mp_image *current;
     int frame;
 };
@@ -73,6 +76,11 @@ static int reconfig(struct vo *vo, struct mp_image_params *params, int flags)
         if (!checked_mkdir(vo, p->outdir))
             return -1;
 
+    if (strcmp(image_writer_file_ext(p->opts), "raw") == 0) {
+        MP_INFO(vo, "Writing raw %dx%d %s frames.\n", params->w, params->h,
+                mp_imgfmt_to_name(params->imgfmt));
+    }
+
     return 0;
 }
 
@@ -104,6 +112,9 @@ static void flip_page(struct vo *vo)
 {
     struct priv *p = vo->priv;
 
+    if (!p->current)
+        return;
+
     (p->frame)++;
 
     void *t = talloc_new(NULL);
@@ -113,11 +124,13 @@ static void flip_page(struct vo *vo)
     if (p->outdir && strlen(p->outdir))
         filename = mp_path_join(t, bstr0(p->outdir), bstr0(filename));
 
+    // The file names are assigned here, so they follow the frame order even
+    // if the workers finish out of order.
     MP_INFO(vo, "Saving %s\n", filename);
-    write_image(p->current, p->opts, filename, vo->log);
+    image_writer_queue_add(p->queue, p->current, p->opts, filename);
+    p->current = NULL;
 
     talloc_free(t);
-    mp_image_unrefp(&p->current);
 }
 
 static int query_format(struct vo *vo, uint32_t fmt)
@@ -132,11 +145,21 @@ static void uninit(struct vo *vo)
     struct priv *p = vo->priv;
 
     mp_image_unrefp(&p->current);
+    // Waits until the queued frames are written.
+    talloc_free(p->queue);
+    p->queue = NULL;
 }
 
 static int preinit(struct vo *vo)
 {
+    struct priv *p = vo->priv;
+
     vo->untimed = true;
+
+    // A few frames per thread are enough to keep all threads busy, and bound
+    // the memory used by frames waiting to be encoded.
+    int threads = p->threads > 0 ? p->threads : default_thread_count();
+    p->queue = image_writer_queue_create(vo, vo->log, threads, threads * 2);
     return 0;
 }
 
@@ -155,6 +178,7 @@ const struct vo_driver video_out_image =
     .options = (const struct m_option[]) {
         OPT_SUBSTRUCT("", opts, image_writer_conf, 0),
         OPT_STRING("outdir", outdir, 0),
+        OPT_INTRANGE("threads", threads, 0, 0, 64),
         {0},
     },
     .preinit = preinit,
@@ -29,6 +29,7 @@
 #include <math.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <errno.h>
 
 #include <libavutil/common.h>
 
@@ -38,10 +39,15 @@
 #include "common/common.h"
 #include "bstr/bstr.h"
 #include "common/msg.h"
+#include "common/global.h"
 #include "options/m_config.h"
+#include "options/options.h"
+#include "options/path.h"
+#include "osdep/io.h"
 #include "vo.h"
 #include "video/vfcap.h"
 #include "video/mp_image.h"
+#include "video/image_writer.h"
 #include "sub/osd.h"
 
 #include "gl_common.h"
@@ -69,8 +75,10 @@ struct gl_priv {
     int allow_sw;
     int swap_interval;
     char *backend;
+    char *dump_dir;
 
     int vo_flipped;
+    int frames_dumped;
 
     int frames_rendered;
 };
@@ -92,6 +100,28 @@ static void resize(struct gl_priv *p)
     vo->want_redraw = true;
 }
 
+// Write the presented frame (before swapping) to the dump directory.
+static void dump_frame(struct gl_priv *p)
+{
+    struct vo *vo = p->vo;
+    GL *gl = p->gl;
+    struct image_writer_opts *opts = vo->global->opts->screenshot_image_opts;
+
+    gl->BindFramebuffer(GL_FRAMEBUFFER, 0);
+    struct mp_image *image = glReadViewport(gl, GL_BACK);
+
+    p->frames_dumped++;
+    char *filename = talloc_asprintf(NULL, "%08d.%s", p->frames_dumped,
+                                     image_writer_file_ext(opts));
+    char *path = mp_path_join(filename, bstr0(p->dump_dir), bstr0(filename));
+
+    MP_VERBOSE(vo, "Saving %s\n", path);
+    write_image(image, opts, path, vo->log);
+
+    talloc_free(filename);
+    talloc_free(image);
+}
+
 static void flip_page(struct vo *vo)
 {
     struct gl_priv *p = vo->priv;
@@ -99,6 +129,9 @@ static void flip_page(struct vo *vo)
 
     mpgl_lock(p->glctx);
 
+    if (p->dump_dir)
+        dump_frame(p);
+
     if (p->use_glFinish)
         gl->Finish();
 
@@ -157,7 +190,8 @@ static bool config_window(struct gl_priv *p, uint32_t d_width,
         flags |= VOFLAG_GL_DEBUG;
 
     int mpgl_caps = MPGL_CAP_GL21 | MPGL_CAP_TEX_RG;
-    if (!p->allow_sw)
+    // Offscreen rendering is typically done with a software rasterizer.
+    if (!p->allow_sw && !p->glctx->offscreen)
         mpgl_caps |= MPGL_CAP_NO_SW;
     return mpgl_config_window(p->glctx, mpgl_caps, d_width, d_height, flags);
 }
@@ -328,7 +362,9 @@ static int control(struct vo *vo, uint32_t request, void *data)
     case VOCTRL_SCREENSHOT: {
         struct voctrl_screenshot_args *args = data;
         mpgl_lock(p->glctx);
-        if (args->full_window)
+        if (args->full_window && p->glctx->offscreen)
+            args->out_image = glReadViewport(p->gl, GL_BACK);
+        else if (args->full_window)
             args->out_image = glGetWindowScreenshot(p->gl);
         else
             args->out_image = gl_video_download_image(p->renderer);
@@ -384,6 +420,16 @@ static int preinit(struct vo *vo)
         goto err_out;
     p->gl = p->glctx->gl;
 
+    // Nothing is displayed, so there is no reason to wait for frame timing.
+    if (p->glctx->offscreen)
+        vo->untimed = true;
+
+    if (p->dump_dir && mkdir(p->dump_dir, 0755) < 0 && errno != EEXIST) {
+        MP_ERR(vo, "Could not create frame dump directory '%s': %s\n",
+               p->dump_dir, strerror(errno));
+        goto err_out;
+    }
+
     if (!config_window(p, 320, 200, VOFLAG_HIDDEN))
         goto err_out;
 
@@ -392,7 +438,7 @@ static int preinit(struct vo *vo)
     if (p->gl->SwapInterval)
         p->gl->SwapInterval(p->swap_interval);
 
-    p->renderer = gl_video_init(p->gl, vo->log);
+    p->renderer = gl_video_init(p->gl, vo->log, vo->global);
     gl_video_set_output_depth(p->renderer, p->glctx->depth_r, p->glctx->depth_g,
                               p->glctx->depth_b);
     gl_video_set_options(p->renderer, p->renderer_opts);
@@ -421,6 +467,7 @@ const struct m_option options[] = {
     OPT_FLAG("debug", use_gl_debug, 0),
     OPT_STRING_VALIDATE("backend", backend, 0, mpgl_validate_backend_opt),
     OPT_FLAG("sw", allow_sw, 0),
+    OPT_STRING("dump-frames", dump_dir, 0),
 
     OPT_SUBSTRUCT("", renderer_opts, gl_video_conf, 0),
     OPT_SUBSTRUCT("", icc_opts, mp_icc_conf, 0),
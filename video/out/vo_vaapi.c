@@ -643,6 +643,7 @@ static int preinit(struct vo *vo)
 const struct vo_driver video_out_vaapi = {
     .description = "VA API with X11",
     .name = "vaapi",
+    .shares_hwdec_ctx = true,
     .preinit = preinit,
     .query_format = query_format,
     .reconfig = reconfig,
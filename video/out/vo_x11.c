@@ -58,18 +58,20 @@
 
 extern int sws_flags;
 
+#define MAX_BUFFERS 10
+
 struct priv {
     struct vo *vo;
 
     struct mp_image *original_image;
 
     /* local data */
-    unsigned char *ImageData[2];
+    unsigned char *ImageData[MAX_BUFFERS];
     //! original unaligned pointer for free
-    unsigned char *ImageDataOrig[2];
+    unsigned char *ImageDataOrig[MAX_BUFFERS];
 
     /* X11 related variables */
-    XImage *myximage[2];
+    XImage *myximage[MAX_BUFFERS];
     int depth, bpp;
     XWindowAttributes attribs;
 
@@ -97,7 +99,7 @@ struct priv {
 #if HAVE_SHM
     int Shm_Warned_Slow;
 
-    XShmSegmentInfo Shminfo[2];
+    XShmSegmentInfo Shminfo[MAX_BUFFERS];
 #endif
 };
 
@@ -229,6 +231,8 @@ shmemerror:
 static void freeMyXImage(struct priv *p, int foo)
 {
     struct vo *vo = p->vo;
+    if (!p->myximage[foo])
+        return;
 #if HAVE_SHM && HAVE_XEXT
     if (p->Shmem_Flag) {
         XShmDetach(vo->x11->display, &p->Shminfo[foo]);
@@ -344,7 +348,6 @@ static bool resize(struct vo *vo)
     p->image_width = (p->dst_w + 7) & (~7);
     p->image_height = p->dst_h;
 
-    p->num_buffers = 2;
     for (int i = 0; i < p->num_buffers; i++)
         getMyXImage(p, i);
 
@@ -445,16 +448,11 @@ static void wait_for_completion(struct vo *vo, int max_outstanding)
 {
 #if HAVE_SHM && HAVE_XEXT
     struct priv *ctx = vo->priv;
-    struct vo_x11_state *x11 = vo->x11;
-    if (ctx->Shmem_Flag) {
-        while (x11->ShmCompletionWaitCount > max_outstanding) {
-            if (!ctx->Shm_Warned_Slow) {
-                MP_WARN(vo, "can't keep up! Waiting"
-                            " for XShm completion events...\n");
-                ctx->Shm_Warned_Slow = 1;
-            }
-            mp_sleep_us(1000);
-            vo_x11_check_events(vo);
+    if (ctx->Shmem_Flag && vo_x11_wait_shm_completion(vo, max_outstanding)) {
+        if (!ctx->Shm_Warned_Slow) {
+            MP_WARN(vo, "can't keep up! Waiting"
+                        " for XShm completion events...\n");
+            ctx->Shm_Warned_Slow = 1;
         }
     }
 #endif
@@ -466,8 +464,9 @@ static void flip_page(struct vo *vo)
     Display_Image(p, p->myximage[p->current_buf]);
     p->current_buf = (p->current_buf + 1) % p->num_buffers;
 
-    if (!p->Shmem_Flag)
-        XSync(vo->x11->display, False);
+    // Don't wait for the server. With XShm, draw_image() waits for the
+    // completion event of the buffer it is going to overwrite.
+    XFlush(vo->x11->display);
 }
 
 // Note: redraw_frame() can call this with NULL.
@@ -475,6 +474,9 @@ static void draw_image(struct vo *vo, mp_image_t *mpi)
 {
     struct priv *p = vo->priv;
 
+    // The server processes PutImage requests in order, and the buffers are
+    // used round-robin, so the oldest outstanding request is the one reading
+    // from the buffer that is written next.
     wait_for_completion(vo, p->num_buffers - 1);
 
     struct mp_image img = get_x_buffer(p, p->current_buf);
@@ -584,10 +586,8 @@ static void find_x11_depth(struct vo *vo)
 static void uninit(struct vo *vo)
 {
     struct priv *p = vo->priv;
-    if (p->myximage[0])
-        freeMyXImage(p, 0);
-    if (p->myximage[1])
-        freeMyXImage(p, 1);
+    for (int i = 0; i < p->num_buffers; i++)
+        freeMyXImage(p, i);
 
     talloc_free(p->original_image);
 
@@ -657,11 +657,19 @@ static int control(struct vo *vo, uint32_t request, void *data)
     return r;
 }
 
+#define OPT_BASE_STRUCT struct priv
+
 const struct vo_driver video_out_x11 = {
     .description = "X11 ( XImage/Shm )",
     .name = "x11",
     .priv_size = sizeof(struct priv),
-    .options = (const struct m_option []){{0}},
+    .priv_defaults = &(const struct priv) {
+        .num_buffers = 3,
+    },
+    .options = (const struct m_option []){
+        OPT_INTRANGE("buffers", num_buffers, 0, 2, MAX_BUFFERS),
+        {0}
+    },
     .preinit = preinit,
     .query_format = query_format,
     .reconfig = reconfig,
@@ -67,6 +67,8 @@
 #define CK_SRC_SET           1 // use and set specified / default colorkey
 #define CK_SRC_CUR           2 // use current colorkey (get it from xv)
 
+#define MAX_BUFFERS 10
+
 struct xvctx {
     struct xv_ck_info_s {
         int method; // CK_METHOD_* constants
@@ -82,7 +84,7 @@ struct xvctx {
     int current_buf;
     int current_ip_buf;
     int num_buffers;
-    XvImage *xvimage[2];
+    XvImage *xvimage[MAX_BUFFERS];
     struct mp_image *original_image;
     uint32_t image_width;
     uint32_t image_height;
@@ -93,7 +95,7 @@ struct xvctx {
     uint32_t max_width, max_height; // zero means: not set
     int Shmem_Flag;
 #if HAVE_SHM && HAVE_XEXT
-    XShmSegmentInfo Shminfo[2];
+    XShmSegmentInfo Shminfo[MAX_BUFFERS];
     int Shm_Warned_Slow;
 #endif
 };
@@ -467,8 +469,6 @@ static int config(struct vo *vo, uint32_t width, uint32_t height,
     for (i = 0; i < ctx->num_buffers; i++)
         deallocate_xvimage(vo, i);
 
-    ctx->num_buffers = 2;
-
     for (i = 0; i < ctx->num_buffers; i++) {
         if (!allocate_xvimage(vo, i)) {
             MP_FATAL(vo, "could not allocate Xv image data\n");
@@ -545,6 +545,8 @@ static bool allocate_xvimage(struct vo *vo, int foo)
 static void deallocate_xvimage(struct vo *vo, int foo)
 {
     struct xvctx *ctx = vo->priv;
+    if (!ctx->xvimage[foo])
+        return;
 #if HAVE_SHM && HAVE_XEXT
     if (ctx->Shmem_Flag) {
         XShmDetach(vo->x11->display, &ctx->Shminfo[foo]);
@@ -554,8 +556,7 @@ static void deallocate_xvimage(struct vo *vo, int foo)
     {
         av_free(ctx->xvimage[foo]->data);
     }
-    if (ctx->xvimage[foo])
-        XFree(ctx->xvimage[foo]);
+    XFree(ctx->xvimage[foo]);
 
     ctx->xvimage[foo] = NULL;
 #if HAVE_SHM && HAVE_XEXT
@@ -630,16 +631,11 @@ static void wait_for_completion(struct vo *vo, int max_outstanding)
 {
 #if HAVE_SHM && HAVE_XEXT
     struct xvctx *ctx = vo->priv;
-    struct vo_x11_state *x11 = vo->x11;
-    if (ctx->Shmem_Flag) {
-        while (x11->ShmCompletionWaitCount > max_outstanding) {
-            if (!ctx->Shm_Warned_Slow) {
-                MP_WARN(vo, "X11 can't keep up! Waiting"
-                        " for XShm completion events...\n");
-                ctx->Shm_Warned_Slow = 1;
-            }
-            mp_sleep_us(1000);
-            vo_x11_check_events(vo);
+    if (ctx->Shmem_Flag && vo_x11_wait_shm_completion(vo, max_outstanding)) {
+        if (!ctx->Shm_Warned_Slow) {
+            MP_WARN(vo, "X11 can't keep up! Waiting"
+                    " for XShm completion events...\n");
+            ctx->Shm_Warned_Slow = 1;
         }
     }
 #endif
@@ -653,8 +649,7 @@ static void flip_page(struct vo *vo)
     /* remember the currently visible buffer */
     ctx->current_buf = (ctx->current_buf + 1) % ctx->num_buffers;
 
-    if (!ctx->Shmem_Flag)
-        XSync(vo->x11->display, False);
+    XFlush(vo->x11->display);
 }
 
 static mp_image_t *get_screenshot(struct vo *vo)
@@ -907,6 +902,7 @@ const struct vo_driver video_out_xv = {
         .xv_ck_info = {CK_METHOD_MANUALFILL, CK_SRC_CUR},
         .colorkey = 0x0000ff00, // default colorkey is green
                     // (0xff000000 means that colorkey has been disabled)
+        .num_buffers = 3,
     },
     .options = (const struct m_option[]) {
         OPT_INT("port", xv_port, M_OPT_MIN, .min = 0),
@@ -921,6 +917,7 @@ const struct vo_driver video_out_xv = {
                     {"auto", CK_METHOD_AUTOPAINT})),
         OPT_INT("colorkey", colorkey, 0),
         OPT_FLAG_STORE("no-colorkey", colorkey, 0, 0x1000000),
+        OPT_INTRANGE("buffers", num_buffers, 0, 2, MAX_BUFFERS),
         {0}
     },
 };
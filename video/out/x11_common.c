@@ -34,6 +34,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
+#include <poll.h>
 
 #include "vo.h"
 #include "aspect.h"
@@ -859,6 +860,34 @@ int vo_x11_check_events(struct vo *vo)
     return ret;
 }
 
+// Wait until at most max_outstanding XShmPutImage requests are unfinished.
+// Only ShmCompletion events are taken from the queue; everything else is left
+// for vo_x11_check_events(). Returns whether it had to wait.
+bool vo_x11_wait_shm_completion(struct vo *vo, int max_outstanding)
+{
+    struct vo_x11_state *x11 = vo->x11;
+    bool waited = false;
+    while (x11->ShmCompletionWaitCount > max_outstanding) {
+        XEvent ev;
+        // Flushes, and queues whatever can be read without blocking.
+        if (XCheckTypedEvent(x11->display, x11->ShmCompletionEvent, &ev)) {
+            x11->ShmCompletionWaitCount--;
+            continue;
+        }
+        waited = true;
+        struct pollfd fd = {
+            .fd = ConnectionNumber(x11->display),
+            .events = POLLIN,
+        };
+        if (poll(&fd, 1, 1000) == 0) {
+            // E.g. the PutImage failed with an X error, which we don't see.
+            MP_WARN(x11, "Timeout waiting for XShm completion events.\n");
+            x11->ShmCompletionWaitCount = 0;
+        }
+    }
+    return waited;
+}
+
 static void vo_x11_sizehint(struct vo *vo, int x, int y, int width, int height,
                             bool override_pos)
 {
@@ -124,6 +124,7 @@ struct vo_x11_state {
 int vo_x11_init(struct vo *vo);
 void vo_x11_uninit(struct vo *vo);
 int vo_x11_check_events(struct vo *vo);
+bool vo_x11_wait_shm_completion(struct vo *vo, int max_outstanding);
 bool vo_x11_screen_is_composited(struct vo *vo);
 void fstype_help(struct mp_log *log);
 void vo_x11_config_vo_window(struct vo *vo, XVisualInfo *vis,
@@ -17,10 +17,12 @@
  */
 
 #include <assert.h>
+#include <pthread.h>
 
 #include <libswscale/swscale.h>
 #include <libavcodec/avcodec.h>
 #include <libavutil/opt.h>
+#include <libavutil/mem.h>
 
 #include "config.h"
 
@@ -140,23 +142,160 @@ static int to_gbrp(struct mp_image *dst, struct mp_image *src,
     return 0;
 }
 
-static bool cache_valid(struct mp_sws_context *ctx)
+// Number of unused, initialized SwsContexts kept per thread. Contexts are
+// handed back to the cache when a mp_sws_context is reconfigured or freed, so
+// users which alternate between a few configurations (or allocate temporary
+// contexts, like mp_image_swscale()) don't have to reinitialize them.
+#define SWS_CACHE_SIZE 8
+
+struct sws_cache_entry {
+    struct SwsContext *sws;
+    // Parameters sws was initialized with. Filters are owned copies.
+    struct mp_sws_context params;
+};
+
+struct sws_cache {
+    struct sws_cache_entry entries[SWS_CACHE_SIZE]; // most recently used first
+    int num_entries;
+    long long hits, misses;
+};
+
+static pthread_once_t sws_cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t sws_cache_key;
+
+static void free_entry(struct sws_cache_entry *e)
+{
+    sws_freeContext(e->sws);
+    sws_freeFilter(e->params.src_filter);
+    sws_freeFilter(e->params.dst_filter);
+    *e = (struct sws_cache_entry){0};
+}
+
+static void free_sws_cache(void *p)
+{
+    struct sws_cache *cache = p;
+    for (int n = 0; n < cache->num_entries; n++)
+        free_entry(&cache->entries[n]);
+    talloc_free(cache);
+}
+
+static void init_sws_cache_key(void)
+{
+    pthread_key_create(&sws_cache_key, free_sws_cache);
+}
+
+static struct sws_cache *get_sws_cache(void)
+{
+    pthread_once(&sws_cache_once, init_sws_cache_key);
+    struct sws_cache *cache = pthread_getspecific(sws_cache_key);
+    if (!cache) {
+        cache = talloc_zero(NULL, struct sws_cache);
+        pthread_setspecific(sws_cache_key, cache);
+    }
+    return cache;
+}
+
+static SwsVector *clone_vec(SwsVector *v)
+{
+    if (!v)
+        return NULL;
+    SwsVector *r = sws_allocVec(v->length);
+    if (r)
+        memcpy(r->coeff, v->coeff, v->length * sizeof(r->coeff[0]));
+    return r;
+}
+
+static SwsFilter *clone_filter(SwsFilter *f)
+{
+    if (!f)
+        return NULL;
+    SwsFilter *r = av_mallocz(sizeof(*r));
+    if (r) {
+        r->lumH = clone_vec(f->lumH);
+        r->lumV = clone_vec(f->lumV);
+        r->chrH = clone_vec(f->chrH);
+        r->chrV = clone_vec(f->chrV);
+    }
+    return r;
+}
+
+static bool vec_equals(SwsVector *a, SwsVector *b)
+{
+    if (!a || !b)
+        return a == b;
+    return a->length == b->length &&
+           memcmp(a->coeff, b->coeff, a->length * sizeof(a->coeff[0])) == 0;
+}
+
+static bool filter_equals(SwsFilter *a, SwsFilter *b)
+{
+    if (!a || !b)
+        return a == b;
+    return vec_equals(a->lumH, b->lumH) && vec_equals(a->lumV, b->lumV) &&
+           vec_equals(a->chrH, b->chrH) && vec_equals(a->chrV, b->chrV);
+}
+
+// Whether a SwsContext initialized with the parameters in b can be used for a.
+// Filters can change only together with force_reload, so comparing them is
+// optional.
+static bool params_equal(struct mp_sws_context *a, struct mp_sws_context *b,
+                         bool cmp_filters)
+{
+    return mp_image_params_equals(&a->src, &b->src) &&
+           mp_image_params_equals(&a->dst, &b->dst) &&
+           a->flags == b->flags &&
+           a->brightness == b->brightness &&
+           a->contrast == b->contrast &&
+           a->saturation == b->saturation &&
+           a->params[0] == b->params[0] &&
+           a->params[1] == b->params[1] &&
+           (!cmp_filters || (filter_equals(a->src_filter, b->src_filter) &&
+                             filter_equals(a->dst_filter, b->dst_filter)));
+}
+
+// Hand the current SwsContext back to the thread's cache.
+static void release_sws(struct mp_sws_context *ctx)
+{
+    struct sws_cache_entry e = {ctx->sws, *ctx->cached};
+    *ctx->cached = (struct mp_sws_context){0};
+    ctx->sws = NULL;
+    if (!e.sws) {
+        free_entry(&e);
+        return;
+    }
+    struct sws_cache *cache = get_sws_cache();
+    if (cache->num_entries == SWS_CACHE_SIZE)
+        free_entry(&cache->entries[--cache->num_entries]);
+    memmove(&cache->entries[1], &cache->entries[0],
+            cache->num_entries * sizeof(cache->entries[0]));
+    cache->entries[0] = e;
+    cache->num_entries++;
+}
+
+// Take a SwsContext matching the ctx parameters from the thread's cache.
+static bool acquire_cached_sws(struct mp_sws_context *ctx)
 {
-    struct mp_sws_context *old = ctx->cached;
-    if (ctx->force_reload)
-        return false;
-    return mp_image_params_equals(&ctx->src, &old->src) &&
-           mp_image_params_equals(&ctx->dst, &old->dst) &&
-           ctx->flags == old->flags &&
-           ctx->brightness == old->brightness &&
-           ctx->contrast == old->contrast &&
-           ctx->saturation == old->saturation;
+    struct sws_cache *cache = get_sws_cache();
+    for (int n = 0; n < cache->num_entries; n++) {
+        struct sws_cache_entry *e = &cache->entries[n];
+        if (params_equal(ctx, &e->params, true)) {
+            ctx->sws = e->sws;
+            *ctx->cached = e->params;
+            MP_TARRAY_REMOVE_AT(cache->entries, cache->num_entries, n);
+            cache->hits++;
+            return true;
+        }
+    }
+    cache->misses++;
+    MP_DBG(ctx, "Creating new swscale context (per-thread cache: %lld hits, "
+           "%lld misses).\n", cache->hits, cache->misses);
+    return false;
 }
 
 static void free_mp_sws(void *p)
 {
     struct mp_sws_context *ctx = p;
-    sws_freeContext(ctx->sws);
+    release_sws(ctx);
     sws_freeFilter(ctx->src_filter);
     sws_freeFilter(ctx->dst_filter);
 }
@@ -191,17 +330,19 @@ int mp_sws_reinit(struct mp_sws_context *ctx)
     src->d_h = dst->d_h = 0;
     src->outputlevels = dst->outputlevels = MP_CSP_LEVELS_AUTO;
 
-    if (cache_valid(ctx))
-        return 0;
-
-    sws_freeContext(ctx->sws);
-    ctx->sws = sws_alloc_context();
-    if (!ctx->sws)
-        return -1;
-
     mp_image_params_guess_csp(src); // sanitize colorspace/colorlevels
     mp_image_params_guess_csp(dst);
 
+    if (ctx->sws && params_equal(ctx, ctx->cached, ctx->force_reload)) {
+        ctx->force_reload = false;
+        return 0;
+    }
+
+    release_sws(ctx);
+    ctx->force_reload = false;
+    if (acquire_cached_sws(ctx))
+        return 1;
+
     struct mp_imgfmt_desc src_fmt = mp_imgfmt_get_desc(src->imgfmt);
     struct mp_imgfmt_desc dst_fmt = mp_imgfmt_get_desc(dst->imgfmt);
     if (!src_fmt.id || !dst_fmt.id)
@@ -233,6 +374,12 @@ int mp_sws_reinit(struct mp_sws_context *ctx)
     s_range = s_range && (src_fmt.flags & MP_IMGFLAG_YUV);
     d_range = d_range && (dst_fmt.flags & MP_IMGFLAG_YUV);
 
+    // Allocate only after the checks above, so that failing doesn't leave a
+    // half-initialized context behind, which release_sws() would cache.
+    ctx->sws = sws_alloc_context();
+    if (!ctx->sws)
+        return -1;
+
     av_opt_set_int(ctx->sws, "sws_flags", ctx->flags, 0);
 
     av_opt_set_int(ctx->sws, "srcw", src->w, 0);
@@ -266,11 +413,18 @@ int mp_sws_reinit(struct mp_sws_context *ctx)
                              sws_getCoefficients(d_csp), d_range,
                              ctx->brightness, ctx->contrast, ctx->saturation);
 
-    if (sws_init_context(ctx->sws, ctx->src_filter, ctx->dst_filter) < 0)
+    if (sws_init_context(ctx->sws, ctx->src_filter, ctx->dst_filter) < 0) {
+        sws_freeContext(ctx->sws);
+        ctx->sws = NULL;
         return -1;
+    }
 
-    ctx->force_reload = false;
     *ctx->cached = *ctx;
+    ctx->cached->log = NULL;
+    ctx->cached->sws = NULL;
+    ctx->cached->cached = NULL;
+    ctx->cached->src_filter = clone_filter(ctx->src_filter);
+    ctx->cached->dst_filter = clone_filter(ctx->dst_filter);
     return 1;
 }
 
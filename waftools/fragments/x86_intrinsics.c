@@ -0,0 +1,18 @@
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+static int test_sse2(const void *p) {
+    __m128i v = _mm_loadu_si128(p);
+    return _mm_cvtsi128_si32(_mm_sad_epu8(v, _mm_setzero_si128()));
+}
+
+__attribute__((target("avx2")))
+static int test_avx2(const void *p) {
+    __m256i v = _mm256_loadu_si256(p);
+    return _mm256_extract_epi32(_mm256_abs_epi16(v), 0);
+}
+
+int main(void) {
+    static const char buf[32];
+    return test_sse2(buf) + test_avx2(buf);
+}
@@ -274,6 +274,7 @@ def build(ctx):
         ( "sub/ass_mp.c",                        "libass"),
         ( "sub/dec_sub.c" ),
         ( "sub/draw_bmp.c" ),
+        ( "sub/event_index.c" ),
         ( "sub/find_subfiles.c" ),
         ( "sub/img_convert.c" ),
         ( "sub/osd.c" ),
@@ -294,6 +295,7 @@ def build(ctx):
         ( "video/fmt-conversion.c" ),
         ( "video/image_writer.c" ),
         ( "video/img_format.c" ),
+        ( "video/memcpy_pic.c" ),
         ( "video/mp_image.c" ),
         ( "video/mp_image_pool.c" ),
         ( "video/sws_utils.c" ),
@@ -307,6 +309,7 @@ def build(ctx):
         ( "video/decode/vdpau.c",                "vdpau-hwaccel" ),
         ( "video/decode/vdpau_old.c",            "vdpau-decoder" ),
         ( "video/filter/pullup.c" ),
+        ( "video/filter/slice_threads.c" ),
         ( "video/filter/vf.c" ),
         ( "video/filter/vf_crop.c" ),
         ( "video/filter/vf_delogo.c" ),
@@ -347,6 +350,7 @@ def build(ctx):
         ( "video/out/filter_kernels.c" ),
         ( "video/out/gl_cocoa.c",                "gl-cocoa" ),
         ( "video/out/gl_common.c",               "gl" ),
+        ( "video/out/gl_headless.c",             "gl-headless" ),
         ( "video/out/gl_hwdec_vaglx.c",          "vaapi-glx" ),
         ( "video/out/gl_hwdec_vda.c",            "vda-gl" ),
         ( "video/out/gl_hwdec_vdpau.c",          "vdpau-gl-x11" ),